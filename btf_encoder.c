@@ -31,11 +31,6 @@
 #include <errno.h>
 #include <stdint.h>
 
-struct elf_function {
-	const char	*name;
-	bool		 generated;
-};
-
 #define MAX_PERCPU_VAR_CNT 4096
 
 struct var_info {
@@ -66,9 +61,12 @@ struct btf_encoder {
 		uint64_t	base_addr;
 		uint64_t	sec_sz;
 	} percpu;
+	/*
+	 * The STT_FUNC symbols are looked up by name in the symtab, generated
+	 * is indexed by symbol index.
+	 */
 	struct {
-		struct elf_function *entries;
-		int		    allocated;
+		bool		    *generated;
 		int		    cnt;
 	} functions;
 };
@@ -676,53 +674,28 @@ static int32_t btf_encoder__add_decl_tag(struct btf_encoder *encoder, const char
  */
 #define KSYM_NAME_LEN 128
 
-static int functions_cmp(const void *_a, const void *_b)
+static void btf_encoder__collect_function(struct btf_encoder *encoder, GElf_Sym *sym)
 {
-	const struct elf_function *a = _a;
-	const struct elf_function *b = _b;
-
-	return strcmp(a->name, b->name);
+	if (elf_sym__type(sym) == STT_FUNC && elf_sym__name(sym, encoder->symtab))
+		encoder->functions.cnt++;
 }
 
-#ifndef max
-#define max(x, y) ((x) < (y) ? (y) : (x))
-#endif
-
-static int btf_encoder__collect_function(struct btf_encoder *encoder, GElf_Sym *sym)
+/*
+ * Returns the index of the first STT_FUNC symbol named name, so that all the
+ * functions with the same name get the same one, or -1 if there is none.
+ */
+static int64_t btf_encoder__find_function(const struct btf_encoder *encoder, const char *name)
 {
-	struct elf_function *new;
-	const char *name;
-
-	if (elf_sym__type(sym) != STT_FUNC)
-		return 0;
-	name = elf_sym__name(sym, encoder->symtab);
-	if (!name)
-		return 0;
+	const GElf_Sym *sym;
+	uint32_t id;
 
-	if (encoder->functions.cnt == encoder->functions.allocated) {
-		encoder->functions.allocated = max(1000, encoder->functions.allocated * 3 / 2);
-		new = realloc(encoder->functions.entries, encoder->functions.allocated * sizeof(*encoder->functions.entries));
-		if (!new) {
-			/*
-			 * The cleanup - delete_functions is called
-			 * in btf_encoder__encode_cu error path.
-			 */
-			return -1;
-		}
-		encoder->functions.entries = new;
+	for (sym = elf_symtab__find_by_name(encoder->symtab, name, &id); sym != NULL;
+	     sym = elf_symtab__find_next_by_name(encoder->symtab, name, &id)) {
+		if (elf_sym__type(sym) == STT_FUNC)
+			return id;
 	}
 
-	encoder->functions.entries[encoder->functions.cnt].name = name;
-	encoder->functions.entries[encoder->functions.cnt].generated = false;
-	encoder->functions.cnt++;
-	return 0;
-}
-
-static struct elf_function *btf_encoder__find_function(const struct btf_encoder *encoder, const char *name)
-{
-	struct elf_function key = { .name = name };
-
-	return bsearch(&key, encoder->functions.entries, encoder->functions.cnt, sizeof(key), functions_cmp);
+	return -1;
 }
 
 static bool btf_name_char_ok(char c, bool first)
@@ -1134,21 +1107,24 @@ static int btf_encoder__collect_percpu_var(struct btf_encoder *encoder, GElf_Sym
 
 static int btf_encoder__collect_symbols(struct btf_encoder *encoder, bool collect_percpu_vars)
 {
-	Elf32_Word sym_sec_idx;
-	uint32_t core_id;
+	uint32_t core_id, pos;
 	GElf_Sym sym;
 
 	/* cache variables' addresses, preparing for searching in symtab. */
 	encoder->percpu.var_cnt = 0;
 
-	/* search within symtab for percpu variables */
-	elf_symtab__for_each_symbol_index(encoder->symtab, core_id, sym, sym_sec_idx) {
-		if (collect_percpu_vars && btf_encoder__collect_percpu_var(encoder, &sym, sym_sec_idx))
-			return -1;
-		if (btf_encoder__collect_function(encoder, &sym))
-			return -1;
+	/* only the percpu section symbols can be percpu variables */
+	if (collect_percpu_vars && encoder->percpu.shndx != 0) {
+		elf_symtab__for_each_symbol_in_section(encoder->symtab, encoder->percpu.shndx, pos, core_id) {
+			sym = *elf_symtab__sym(encoder->symtab, core_id);
+			if (btf_encoder__collect_percpu_var(encoder, &sym, encoder->percpu.shndx))
+				return -1;
+		}
 	}
 
+	elf_symtab__for_each_symbol(encoder->symtab, core_id, sym)
+		btf_encoder__collect_function(encoder, &sym);
+
 	if (collect_percpu_vars) {
 		if (encoder->percpu.var_cnt)
 			qsort(encoder->percpu.vars, encoder->percpu.var_cnt, sizeof(encoder->percpu.vars[0]), percpu_var_cmp);
@@ -1158,8 +1134,10 @@ static int btf_encoder__collect_symbols(struct btf_encoder *encoder, bool collec
 	}
 
 	if (encoder->functions.cnt) {
-		qsort(encoder->functions.entries, encoder->functions.cnt, sizeof(encoder->functions.entries[0]),
-		      functions_cmp);
+		encoder->functions.generated = calloc(elf_symtab__nr_symbols(encoder->symtab),
+						      sizeof(*encoder->functions.generated));
+		if (encoder->functions.generated == NULL)
+			return -1;
 		if (encoder->verbose)
 			printf("Found %d functions!\n", encoder->functions.cnt);
 	}
@@ -1304,7 +1282,7 @@ out:
 	return err;
 }
 
-struct btf_encoder *btf_encoder__new(struct cu *cu, const char *detached_filename, struct btf *base_btf, bool skip_encoding_vars, bool force, bool gen_floats, bool verbose)
+struct btf_encoder *btf_encoder__new(struct cu *cu, const char *detached_filename, struct btf *base_btf, bool skip_encoding_vars, bool force, bool gen_floats, bool verbose, int nr_jobs)
 {
 	struct btf_encoder *encoder = zalloc(sizeof(*encoder));
 
@@ -1348,7 +1326,7 @@ struct btf_encoder *btf_encoder__new(struct cu *cu, const char *detached_filenam
 			goto out_delete;
 		}
 
-		encoder->symtab = elf_symtab__new(NULL, cu->elf);
+		encoder->symtab = elf_symtab__new(NULL, cu->elf, nr_jobs);
 		if (!encoder->symtab) {
 			if (encoder->verbose)
 				printf("%s: '%s' doesn't have symtab.\n", __func__, cu->filename);
@@ -1394,9 +1372,8 @@ void btf_encoder__delete(struct btf_encoder *encoder)
 	encoder->btf = NULL;
 	elf_symtab__delete(encoder->symtab);
 
-	encoder->functions.allocated = encoder->functions.cnt = 0;
-	free(encoder->functions.entries);
-	encoder->functions.entries = NULL;
+	encoder->functions.cnt = 0;
+	zfree(&encoder->functions.generated);
 
 	free(encoder);
 }
@@ -1489,17 +1466,17 @@ int btf_encoder__encode_cu(struct btf_encoder *encoder, struct cu *cu)
 		if (!ftype__has_arg_names(&fn->proto))
 			continue;
 		if (encoder->functions.cnt) {
-			struct elf_function *func;
 			const char *name;
+			int64_t id;
 
 			name = function__name(fn);
 			if (!name)
 				continue;
 
-			func = btf_encoder__find_function(encoder, name);
-			if (!func || func->generated)
+			id = btf_encoder__find_function(encoder, name);
+			if (id < 0 || encoder->functions.generated[id])
 				continue;
-			func->generated = true;
+			encoder->functions.generated[id] = true;
 		} else {
 			if (!fn->external)
 				continue;
@@ -602,6 +602,7 @@ static int cus__load_btf(struct cus *cus, struct conf_load *conf, const char *fi
 	cu->language = LANG_C;
 	cu->uses_global_strings = false;
 	cu->dfops = &btf__ops;
+	cu->seq = cus__new_cu_seq(cus);
 
 	libbpf_set_print(libbpf_log);
 
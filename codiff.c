@@ -8,6 +8,8 @@
 #include <argp.h>
 #include <assert.h>
 #include <dwarf.h>
+#include <elfutils/version.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +19,7 @@
 
 #include "dwarves.h"
 #include "dutil.h"
+#include "hash.h"
 
 static int show_struct_diffs;
 static int show_function_diffs;
@@ -69,6 +72,416 @@ static struct diff_info *diff_info__new(const struct tag *twin,
 	return dinfo;
 }
 
+/*
+ * Pairing the old and new CUs, structs, functions and members by name, looking
+ * them up linearly, made diffing big binaries, like two vmlinux files,
+ * quadratic, so index them by name, with the first one found winning, like
+ * with the linear lookups.
+ */
+struct name_index_entry {
+	const char *name;
+	void	   *ptr;
+	uint32_t   id;
+};
+
+struct name_index {
+	struct name_index_entry *entries;
+	uint32_t		bits;
+};
+
+static int name_index__init(struct name_index *index, uint32_t nr_entries)
+{
+	index->bits = 4;
+	while ((1U << index->bits) < nr_entries * 2)
+		++index->bits;
+
+	index->entries = calloc(1U << index->bits, sizeof(*index->entries));
+	return index->entries ? 0 : -ENOMEM;
+}
+
+static void name_index__exit(struct name_index *index)
+{
+	zfree(&index->entries);
+}
+
+static struct name_index_entry *name_index__slot(const struct name_index *index, const char *name)
+{
+	const uint32_t mask = (1U << index->bits) - 1;
+	uint32_t bucket = hash_str(name, index->bits);
+
+	while (index->entries[bucket].name != NULL &&
+	       strcmp(index->entries[bucket].name, name) != 0)
+		bucket = (bucket + 1) & mask;
+
+	return &index->entries[bucket];
+}
+
+static void name_index__add(struct name_index *index, const char *name, void *ptr, uint32_t id)
+{
+	struct name_index_entry *entry = name_index__slot(index, name);
+
+	if (entry->name == NULL) {
+		entry->name = name;
+		entry->ptr  = ptr;
+		entry->id   = id;
+	}
+}
+
+static struct name_index_entry *name_index__find_entry(const struct name_index *index, const char *name)
+{
+	struct name_index_entry *entry;
+
+	if (index->entries == NULL || name == NULL)
+		return NULL;
+
+	entry = name_index__slot(index, name);
+	return entry->name ? entry : NULL;
+}
+
+static void *name_index__find(const struct name_index *index, const char *name)
+{
+	struct name_index_entry *entry = name_index__find_entry(index, name);
+
+	return entry ? entry->ptr : NULL;
+}
+
+/*
+ * @structs - the struct definitions, as in cu__find_struct_by_name()
+ * @unions - the union definitions, paired just like structs
+ * @functions - as in cu__find_function_by_name()
+ * @struct_hashes - class__structural_hash() of the structs and unions, by type id
+ */
+struct codiff_cu {
+	struct cu	  *cu;
+	struct name_index structs;
+	struct name_index unions;
+	struct name_index functions;
+	uint64_t	  *struct_hashes;
+};
+
+/*
+ * Both files are loaded at the same time, each by its own thread, that can
+ * use more threads with -j, with the CUs indexed and the structural hashes of
+ * the structs computed as each CU is loaded, in the loader threads.
+ *
+ * @entries - the codiff_cu entries, by cu->seq
+ * @first - the first CU in the file
+ * @by_name - the CUs by name, as in cus__find_pair()
+ * @mutex - serializes growing @entries from the loader threads
+ */
+struct codiff_cus {
+	struct cus	  *cus;
+	const char	  *filename;
+	struct conf_load  conf_load;
+	struct codiff_cu  **entries;
+	uint32_t	  nr_entries;
+	struct codiff_cu  *first;
+	struct name_index by_name;
+	pthread_mutex_t	  mutex;
+	int		  err;
+	int		  steal_err;
+};
+
+static uint64_t hash__add(uint64_t hash, uint64_t val)
+{
+	return hash_64(hash ^ val, 64);
+}
+
+/*
+ * Hash everything diff_struct() compares, so that structs with the same hash
+ * can be considered unchanged and skipped, 0 meaning it wasn't possible to
+ * hash it as some members aren't paired by check_print_members_changes().
+ */
+static uint64_t class__structural_hash(struct class *class, const struct cu *cu)
+{
+	uint64_t hash = hash__add(class__size(class), class__nr_members(class));
+	struct class_member *member;
+	uint16_t nr_members = 0;
+
+	class__find_holes(class);
+
+	hash = hash__add(hash, class->type.nr_static_members);
+	hash = hash__add(hash, class->padding);
+	hash = hash__add(hash, class->nr_holes);
+	hash = hash__add(hash, class->nr_bit_holes);
+
+	type__for_each_member(&class->type, member) {
+		const char *name = class_member__name(member);
+		struct tag *type = cu__type(cu, member->tag.type);
+		char type_name[128];
+
+		++nr_members;
+		hash = hash__add(hash, member->tag.tag);
+		hash = hash__add(hash, name ? hash_str(name, 64) : 0);
+		hash = hash__add(hash, member->byte_offset);
+		hash = hash__add(hash, member->byte_size);
+		hash = hash__add(hash, member->bitfield_offset);
+		hash = hash__add(hash, member->bitfield_size);
+		hash = hash__add(hash, type ? hash_str(tag__name(type, cu, type_name, sizeof(type_name), NULL), 64) : 0);
+	}
+
+	if (nr_members != class->type.nr_members + class->type.nr_static_members)
+		return 0;
+
+	return hash ?: 1;
+}
+
+static const char *class__kind(const struct class *class)
+{
+	return tag__is_union(class__tag(class)) ? "union" : "struct";
+}
+
+static int codiff_cu__init(struct codiff_cu *dcu, struct cu *cu)
+{
+	uint32_t id, nr_structs = 0, nr_unions = 0;
+	struct function *function;
+	struct class *class;
+
+	dcu->cu = cu;
+
+	cu__for_each_struct_or_union(cu, id, class) {
+		if (class__name(class) == NULL || class->type.declaration)
+			continue;
+
+		if (tag__is_union(class__tag(class)))
+			++nr_unions;
+		else
+			++nr_structs;
+	}
+
+	dcu->struct_hashes = calloc(cu->types_table.nr_entries ?: 1, sizeof(*dcu->struct_hashes));
+
+	if (dcu->struct_hashes == NULL ||
+	    name_index__init(&dcu->structs, nr_structs) ||
+	    name_index__init(&dcu->unions, nr_unions) ||
+	    name_index__init(&dcu->functions, cu->functions_table.nr_entries))
+		return -ENOMEM;
+
+	cu__for_each_struct_or_union(cu, id, class) {
+		if (class__name(class) == NULL || class->type.declaration)
+			continue;
+
+		name_index__add(tag__is_union(class__tag(class)) ? &dcu->unions : &dcu->structs,
+				class__name(class), class__tag(class), id);
+		dcu->struct_hashes[id] = class__structural_hash(class, cu);
+	}
+
+	cu__for_each_function(cu, id, function) {
+		if (function__name(function) != NULL)
+			name_index__add(&dcu->functions, function__name(function), function__tag(function), 0);
+	}
+
+	return 0;
+}
+
+static void codiff_cu__delete(struct codiff_cu *dcu)
+{
+	if (dcu == NULL)
+		return;
+
+	name_index__exit(&dcu->structs);
+	name_index__exit(&dcu->unions);
+	name_index__exit(&dcu->functions);
+	free(dcu->struct_hashes);
+	free(dcu);
+}
+
+/*
+ * Find the struct or union, like @class, with @class name.
+ */
+static struct tag *codiff_cu__find_class_pair(const struct codiff_cu *dcu, struct class *class,
+					      uint64_t *hashp)
+{
+	const struct name_index *index;
+	struct name_index_entry *entry;
+
+	if (dcu == NULL)
+		return NULL;
+
+	index = tag__is_union(class__tag(class)) ? &dcu->unions : &dcu->structs;
+	entry = name_index__find_entry(index, class__name(class));
+
+	if (entry == NULL)
+		return NULL;
+
+	if (hashp)
+		*hashp = dcu->struct_hashes[entry->id];
+
+	return entry->ptr;
+}
+
+static struct tag *codiff_cu__find_function_by_name(const struct codiff_cu *dcu, const char *name)
+{
+	return dcu ? name_index__find(&dcu->functions, name) : NULL;
+}
+
+static struct codiff_cu *codiff_cus__entry(const struct codiff_cus *dcus, const struct cu *cu)
+{
+	return cu->seq < dcus->nr_entries ? dcus->entries[cu->seq] : NULL;
+}
+
+static int codiff_cus__add(struct codiff_cus *dcus, struct codiff_cu *dcu)
+{
+	uint32_t seq = dcu->cu->seq;
+	int err = 0;
+
+	pthread_mutex_lock(&dcus->mutex);
+
+	if (seq >= dcus->nr_entries) {
+		uint32_t nr_entries = dcus->nr_entries ? dcus->nr_entries * 2 : 64;
+		struct codiff_cu **entries;
+
+		while (nr_entries <= seq)
+			nr_entries *= 2;
+
+		entries = realloc(dcus->entries, nr_entries * sizeof(*entries));
+		if (entries == NULL) {
+			err = -ENOMEM;
+			goto out_unlock;
+		}
+
+		memset(entries + dcus->nr_entries, 0, (nr_entries - dcus->nr_entries) * sizeof(*entries));
+		dcus->entries	 = entries;
+		dcus->nr_entries = nr_entries;
+	}
+
+	// Each CU has its own seq, one already there would be leaked and not diffed
+	if (dcus->entries[seq] != NULL) {
+		fprintf(stderr, "codiff: %s: more than one CU numbered %u\n", dcus->filename, seq);
+		err = -EEXIST;
+		goto out_unlock;
+	}
+
+	dcus->entries[seq] = dcu;
+out_unlock:
+	pthread_mutex_unlock(&dcus->mutex);
+	return err;
+}
+
+static enum load_steal_kind codiff__steal_cu(struct cu *cu, struct conf_load *conf_load)
+{
+	struct codiff_cus *dcus = conf_load->cookie;
+	struct codiff_cu *dcu = zalloc(sizeof(*dcu));
+	int err = dcu ? codiff_cu__init(dcu, cu) : -ENOMEM;
+
+	if (err == 0)
+		err = codiff_cus__add(dcus, dcu);
+
+	if (err) {
+		codiff_cu__delete(dcu);
+		dcus->steal_err = err;
+		return LSK__STOP_LOADING;
+	}
+
+	return LSK__KEEPIT;
+}
+
+static void codiff_cus__init(struct codiff_cus *dcus, struct cus *cus, const char *filename,
+			     const struct conf_load *conf_load, int nr_jobs)
+{
+	memset(dcus, 0, sizeof(*dcus));
+	dcus->cus	      = cus;
+	dcus->filename	      = filename;
+	dcus->conf_load	      = *conf_load;
+	dcus->conf_load.steal  = codiff__steal_cu;
+	dcus->conf_load.cookie = dcus;
+	dcus->conf_load.nr_jobs = nr_jobs;
+	pthread_mutex_init(&dcus->mutex, NULL);
+}
+
+static void codiff_cus__exit(struct codiff_cus *dcus)
+{
+	for (uint32_t i = 0; i < dcus->nr_entries; ++i)
+		codiff_cu__delete(dcus->entries[i]);
+
+	zfree(&dcus->entries);
+	dcus->nr_entries = 0;
+	name_index__exit(&dcus->by_name);
+	pthread_mutex_destroy(&dcus->mutex);
+}
+
+/*
+ * With -j the CUs are added to cus in the order they finish loading, so walk
+ * them in the order they are in the file, for the output not to depend on it.
+ */
+static int codiff_cus__for_each_cu(struct codiff_cus *dcus,
+				   int (*iterator)(struct cu *cu, void *cookie),
+				   void *cookie)
+{
+	for (uint32_t i = 0; i < dcus->nr_entries; ++i) {
+		if (dcus->entries[i] == NULL)
+			continue;
+
+		int err = iterator(dcus->entries[i]->cu, cookie);
+
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * For the passes that only change the CU being iterated, so that they can run
+ * in parallel, with the same cookie for all the threads, the output is done
+ * later, by codiff_cus__for_each_cu().
+ */
+static int codiff_cus__for_each_cu_parallel(struct codiff_cus *dcus,
+					    int (*iterator)(struct cu *cu, void *cookie, FILE *fp),
+					    void *cookie)
+{
+	int i, nr_jobs = conf_load.nr_jobs > 1 ? conf_load.nr_jobs : 1;
+	void *cookies[nr_jobs];
+
+	for (i = 0; i < nr_jobs; ++i)
+		cookies[i] = cookie;
+
+	return cus__for_each_cu_parallel(dcus->cus, iterator, cookies, nr_jobs, NULL, NULL, false);
+}
+
+static void *codiff_cus__load_thread(void *arg)
+{
+	struct codiff_cus *dcus = arg;
+
+	dcus->err = cus__load_file(dcus->cus, &dcus->conf_load, dcus->filename);
+	return NULL;
+}
+
+static int codiff_cus__index_cu(struct cu *cu, void *cookie)
+{
+	struct codiff_cus *dcus = cookie;
+	struct codiff_cu *dcu = codiff_cus__entry(dcus, cu);
+
+	if (dcus->first == NULL)
+		dcus->first = dcu;
+
+	if (cu->name != NULL)
+		name_index__add(&dcus->by_name, cu->name, dcu, 0);
+
+	return 0;
+}
+
+/*
+ * Now that all the CUs are loaded, index them by name in the order they are in
+ * the file, so that the first one with a name wins, as in cus__find_pair().
+ */
+static int codiff_cus__index(struct codiff_cus *dcus)
+{
+	if (name_index__init(&dcus->by_name, cus__nr_entries(dcus->cus)))
+		return -ENOMEM;
+
+	codiff_cus__for_each_cu(dcus, codiff_cus__index_cu, dcus);
+	return 0;
+}
+
+static struct codiff_cu *codiff_cus__find_pair(const struct codiff_cus *dcus, const char *name)
+{
+	if (cus__nr_entries(dcus->cus) == 1)
+		return dcus->first;
+
+	return name_index__find(&dcus->by_name, name);
+}
+
 static void cu__check_max_len_changed_item(struct cu *cu, const char *name,
 					   uint8_t addend)
 {
@@ -78,9 +491,10 @@ static void cu__check_max_len_changed_item(struct cu *cu, const char *name,
 		cu->max_len_changed_item = len;
 }
 
-static void diff_function(const struct cu *new_cu, struct function *function,
+static void diff_function(const struct codiff_cu *new_dcu, struct function *function,
 			  struct cu *cu)
 {
+	const struct cu *new_cu = new_dcu ? new_dcu->cu : NULL;
 	struct tag *new_tag;
 	const char *name;
 
@@ -88,7 +502,7 @@ static void diff_function(const struct cu *new_cu, struct function *function,
 		return;
 
 	name = function__name(function);
-	new_tag = cu__find_function_by_name(new_cu, name);
+	new_tag = codiff_cu__find_function_by_name(new_dcu, name);
 	if (new_tag != NULL) {
 		struct function *new_function = tag__function(new_tag);
 		int32_t diff = (function__size(new_function) -
@@ -148,17 +562,20 @@ static int check_print_change(const struct class_member *old,
 
 	if (old->byte_offset != new->byte_offset) {
 		changes = 1;
-		terse_type_changes |= TCHANGEF__OFFSET;
+		if (print)
+			terse_type_changes |= TCHANGEF__OFFSET;
 	}
 
 	if (old->bitfield_offset != new->bitfield_offset) {
 		changes = 1;
-		terse_type_changes |= TCHANGEF__BIT_OFFSET;
+		if (print)
+			terse_type_changes |= TCHANGEF__BIT_OFFSET;
 	}
 
 	if (old->bitfield_size != new->bitfield_size) {
 		changes = 1;
-		terse_type_changes |= TCHANGEF__BIT_SIZE;
+		if (print)
+			terse_type_changes |= TCHANGEF__BIT_SIZE;
 	}
 
 	if (strcmp(tag__name(old_type, old_cu, old_type_name,
@@ -166,7 +583,8 @@ static int check_print_change(const struct class_member *old,
 		   tag__name(new_type, new_cu, new_type_name,
 			     sizeof(new_type_name), NULL)) != 0) {
 		changes = 1;
-		terse_type_changes |= TCHANGEF__TYPE;
+		if (print)
+			terse_type_changes |= TCHANGEF__TYPE;
 	}
 
 	if (changes && print && !show_terse_type_changes)
@@ -182,15 +600,45 @@ static int check_print_change(const struct class_member *old,
 	return changes;
 }
 
+/*
+ * Only worth indexing the members by name in big structs, for the others just
+ * look them up linearly, leaving the index empty.
+ */
+#define MEMBER_INDEX__MIN_MEMBERS 16
+
+static int name_index__init_members(struct name_index *index, const struct class *structure)
+{
+	struct class_member *member;
+
+	index->entries = NULL;
+
+	if (class__nr_members(structure) < MEMBER_INDEX__MIN_MEMBERS)
+		return 0;
+
+	if (name_index__init(index, class__nr_members(structure)))
+		return 0; // Just do it linearly
+
+	type__for_each_data_member(&structure->type, member) {
+		if (class_member__name(member) != NULL)
+			name_index__add(index, class_member__name(member), member, 0);
+	}
+
+	return 0;
+}
+
 static struct class_member *class__find_pair_member(const struct class *structure,
+						    const struct name_index *members,
 						    const struct class_member *pair_member,
 						    int *nr_anonymousp)
 {
 	const char *member_name = class_member__name(pair_member);
 	struct class_member *member;
 
-	if (member_name)
+	if (member_name) {
+		if (members->entries != NULL)
+			return name_index__find(members, member_name);
 		return class__find_member_by_name(structure, member_name);
+	}
 
 	int nr_anonymous = ++*nr_anonymousp;
 
@@ -215,11 +663,28 @@ static int check_print_members_changes(const struct class *structure,
 	int changes = 0, nr_anonymous = 0;
 	struct class_member *member;
 	uint16_t nr_twins_found = 0;
+	struct name_index new_members;
+
+	name_index__init_members(&new_members, new_structure);
+
+	/*
+	 * new_structure may have been paired with other structs, that now, with
+	 * the structural hashes, may be skipped, so don't rely on what was left
+	 * by them to find the added members.
+	 *
+	 * Only when printing, as otherwise this is called from the threads
+	 * diffing the CUs, that may share new_structure.
+	 */
+	if (print) {
+		type__for_each_member(&new_structure->type, member)
+			member->tag.visited = 0;
+	}
 
 	type__for_each_member(&structure->type, member) {
-		struct class_member *twin = class__find_pair_member(new_structure, member, &nr_anonymous);
+		struct class_member *twin = class__find_pair_member(new_structure, &new_members, member, &nr_anonymous);
 		if (twin != NULL) {
-			twin->tag.visited = 1;
+			if (print)
+				twin->tag.visited = 1;
 			++nr_twins_found;
 			if (check_print_change(member, cu, twin, new_cu, print))
 				changes = 1;
@@ -261,30 +726,36 @@ static int check_print_members_changes(const struct class *structure,
 		}
 	}
 out:
+	name_index__exit(&new_members);
 	return changes;
 }
 
-static void diff_struct(const struct cu *new_cu, struct class *structure,
-			struct cu *cu)
+static void diff_struct(const struct codiff_cu *new_dcu, struct class *structure,
+			uint64_t hash, struct cu *cu)
 {
+	const struct cu *new_cu = new_dcu ? new_dcu->cu : NULL;
+	uint64_t new_hash = 0;
 	struct tag *new_tag;
 	struct class *new_structure = NULL;
 	int32_t diff;
 
-	assert(class__is_struct(structure));
-
 	if (class__size(structure) == 0 || class__name(structure) == NULL)
 		return;
 
-	new_tag = cu__find_struct_by_name(new_cu, class__name(structure), 0, NULL);
+	new_tag = codiff_cu__find_class_pair(new_dcu, structure, &new_hash);
 	if (new_tag == NULL)
 		return;
 
+	// Unchanged, no need to look at each member
+	if (hash != 0 && hash == new_hash)
+		return;
+
 	new_structure = tag__class(new_tag);
 	if (class__size(new_structure) == 0)
 		return;
 
-	assert(class__is_struct(new_structure));
+	class__find_holes(structure);
+	class__find_holes(new_structure);
 
 	diff = class__size(structure) != class__size(new_structure) ||
 	       class__nr_members(structure) != class__nr_members(new_structure) ||
@@ -303,11 +774,11 @@ static void diff_struct(const struct cu *new_cu, struct class *structure,
 					 new_cu, diff);
 }
 
-static int cu_find_new_tags_iterator(struct cu *new_cu, void *old_cus)
+static int cu_find_new_tags_iterator(struct cu *new_cu, void *old_cus, FILE *fp __maybe_unused)
 {
-	struct cu *old_cu = cus__find_pair(old_cus, new_cu->name);
+	struct codiff_cu *old_dcu = codiff_cus__find_pair(old_cus, new_cu->name);
 
-	if (old_cu != NULL && cu__same_build_id(old_cu, new_cu))
+	if (old_dcu != NULL && cu__same_build_id(old_dcu->cu, new_cu))
 		return 0;
 
 	struct function *function;
@@ -321,8 +792,7 @@ static int cu_find_new_tags_iterator(struct cu *new_cu, void *old_cus)
 			continue;
 
 		const char *name = function__name(function);
-		struct tag *old_function = cu__find_function_by_name(old_cu,
-								     name);
+		struct tag *old_function = codiff_cu__find_function_by_name(old_dcu, name);
 		if (old_function != NULL && !tag__function(old_function)->inlined)
 			continue;
 
@@ -335,10 +805,10 @@ static int cu_find_new_tags_iterator(struct cu *new_cu, void *old_cus)
 	}
 
 	struct class *class;
-	cu__for_each_struct(new_cu, id, class) {
+	cu__for_each_struct_or_union(new_cu, id, class) {
 		const char *name = class__name(class);
 		if (name == NULL || class__size(class) == 0 ||
-		    cu__find_struct_by_name(old_cu, name, 0, NULL))
+		    codiff_cu__find_class_pair(old_dcu, class, NULL))
 			continue;
 
 		class->priv = diff_info__new(NULL, NULL, 1);
@@ -350,21 +820,23 @@ static int cu_find_new_tags_iterator(struct cu *new_cu, void *old_cus)
 	return 0;
 }
 
-static int cu_diff_iterator(struct cu *cu, void *new_cus)
+static int cu_diff_iterator(struct cu *cu, void *cookie, FILE *fp __maybe_unused)
 {
-	struct cu *new_cu = cus__find_pair(new_cus, cu->name);
+	struct codiff_cus **dcus = cookie, *old_dcus = dcus[0], *new_dcus = dcus[1];
+	struct codiff_cu *new_dcu = codiff_cus__find_pair(new_dcus, cu->name);
 
-	if (new_cu != NULL && cu__same_build_id(cu, new_cu))
+	if (new_dcu != NULL && cu__same_build_id(cu, new_dcu->cu))
 		return 0;
 
+	struct codiff_cu *dcu = codiff_cus__entry(old_dcus, cu);
 	uint32_t id;
 	struct class *class;
-	cu__for_each_struct(cu, id, class)
-		diff_struct(new_cu, class, cu);
+	cu__for_each_struct_or_union(cu, id, class)
+		diff_struct(new_dcu, class, dcu ? dcu->struct_hashes[id] : 0, cu);
 
 	struct function *function;
 	cu__for_each_function(cu, id, function)
-		diff_function(new_cu, function, cu);
+		diff_function(new_dcu, function, cu);
 
 	return 0;
 }
@@ -446,29 +918,34 @@ static void show_nr_members_changes(const struct class *structure,
 				    const struct cu *new_cu)
 {
 	struct class_member *member;
+	struct name_index members;
 	int nr_anonymous = 0;
 
+	name_index__init_members(&members, new_structure);
 	/* Find the removed ones */
 	type__for_each_member(&structure->type, member) {
-		struct class_member *twin = class__find_pair_member(new_structure, member, &nr_anonymous);
+		struct class_member *twin = class__find_pair_member(new_structure, &members, member, &nr_anonymous);
 		if (twin == NULL)
 			show_changed_member('-', member, cu);
 	}
+	name_index__exit(&members);
 
+	name_index__init_members(&members, structure);
 	nr_anonymous = 0;
 	/* Find the new ones */
 	type__for_each_member(&new_structure->type, member) {
-		struct class_member *twin = class__find_pair_member(structure, member, &nr_anonymous);
+		struct class_member *twin = class__find_pair_member(structure, &members, member, &nr_anonymous);
 		if (twin == NULL)
 			show_changed_member('+', member, new_cu);
 	}
+	name_index__exit(&members);
 }
 
 static void print_terse_type_changes(struct class *structure)
 {
 	const char *sep = "";
 
-	printf("struct %s: ", class__name(structure));
+	printf("%s %s: ", class__kind(structure), class__name(structure));
 
 	if (terse_type_changes & TCHANGEF__SIZE) {
 		fputs("size", stdout);
@@ -534,11 +1011,13 @@ static void show_diffs_structure(struct class *structure,
 
 	terse_type_changes = 0;
 
-	if (!show_terse_type_changes)
-		printf("  struct %-*.*s | %+4d\n",
-		       (int)(cu->max_len_changed_item - sizeof("struct")),
-		       (int)(cu->max_len_changed_item - sizeof("struct")),
+	if (!show_terse_type_changes) {
+		// Aligned with the "struct" ones
+		const int width = cu->max_len_changed_item - strlen(class__kind(structure)) - 1;
+
+		printf("  %s %-*.*s | %+4d\n", class__kind(structure), width, width,
 		       class__name(structure), diff);
+	}
 
 	if (diff != 0)
 		terse_type_changes |= TCHANGEF__SIZE;
@@ -622,13 +1101,13 @@ static int cu_show_diffs_iterator(struct cu *cu, void *cookie)
 	struct class *class;
 
 	if (show_terse_type_changes) {
-		cu__for_each_struct(cu, id, class)
+		cu__for_each_struct_or_union(cu, id, class)
 			show_structure_diffs_iterator(class, cu);
 		return 0;
 	}
 
 	if (cu->nr_structures_changed != 0 && show_struct_diffs) {
-		cu__for_each_struct(cu, id, class)
+		cu__for_each_struct_or_union(cu, id, class)
 			show_structure_diffs_iterator(class, cu);
 		printf(" %u struct%s changed\n", cu->nr_structures_changed,
 		       cu->nr_structures_changed > 1 ? "s" : "");
@@ -667,7 +1146,7 @@ static int cu_delete_priv(struct cu *cu, void *cookie __maybe_unused)
 	struct function *f;
 	uint32_t id;
 
-	cu__for_each_struct(cu, id, c)
+	cu__for_each_struct_or_union(cu, id, c)
 		zfree(&c->priv);
 
 	cu__for_each_function(cu, id, f)
@@ -730,6 +1209,13 @@ static const struct argp_option codiff__options[] = {
 		.name = "quiet",
 		.doc  = "Show only differences, no difference? No output",
 	},
+	{
+		.name  = "jobs",
+		.key   = 'j',
+		.arg   = "NR_JOBS",
+		.flags = OPTION_ARG_OPTIONAL, // Use sysconf(_SC_NPROCESSORS_ONLN) * 1.1 by default
+		.doc   = "run N jobs in parallel, split between the two files [default to number of online processors + 10%]",
+	},
 	{
 		.name = NULL,
 	}
@@ -745,6 +1231,14 @@ static error_t codiff__options_parser(int key, char *arg __maybe_unused,
 	case 't': show_terse_type_changes = 1;	break;
 	case 'V': verbose = 1;			break;
 	case 'q': quiet = 1;			break;
+	case 'j':
+#if _ELFUTILS_PREREQ(0, 178)
+		  conf_load.nr_jobs = arg ? atoi(arg) :
+					    sysconf(_SC_NPROCESSORS_ONLN) * 1.1;
+#else
+		  fputs("codiff: Multithreading requires elfutils >= 0.178. Continuing with a single thread...\n", stderr);
+#endif
+							break;
 	default:  return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
@@ -760,8 +1254,11 @@ static struct argp codiff__argp = {
 
 int main(int argc, char *argv[])
 {
-	int remaining, err, rc = EXIT_FAILURE;
+	int remaining, rc = EXIT_FAILURE;
 	char *old_filename, *new_filename;
+	struct codiff_cus old_dcus, new_dcus, *dcus[2] = { &old_dcus, &new_dcus, };
+	bool load_old, load_new;
+	pthread_t old_thread;
 	struct stat st;
 
 	if (argp_parse(&codiff__argp, argc, argv, 0, &remaining, NULL) ||
@@ -792,6 +1289,11 @@ failure:
 	structs_printed = strlist__new(false);
 	struct cus *old_cus = cus__new(),
 		   *new_cus = cus__new();
+
+	/* Split the -j budget between the two files */
+	codiff_cus__init(&old_dcus, old_cus, old_filename, &conf_load, (conf_load.nr_jobs + 1) / 2);
+	codiff_cus__init(&new_dcus, new_cus, new_filename, &conf_load, conf_load.nr_jobs / 2);
+
 	if (old_cus == NULL || new_cus == NULL || structs_printed == NULL) {
 		fputs("codiff: insufficient memory\n", stderr);
 		goto out_cus_delete;
@@ -803,33 +1305,57 @@ failure:
 	}
 
 	/* If old_file is a character device, leave its cus empty */
-	if (!S_ISCHR(st.st_mode)) {
-		err = cus__load_file(old_cus, &conf_load, old_filename);
-		if (err < 0) {
-			cus__print_error_msg("codiff", old_cus, old_filename, err);
-			goto out_cus_delete_priv;
-		}
-	}
+	load_old = !S_ISCHR(st.st_mode);
 
 	if (stat(new_filename, &st) != 0) {
 		fprintf(stderr, "codiff: %s (%s)\n", strerror(errno), new_filename);
+		goto out_cus_delete;
+	}
+
+	/* If new_file is a character device, leave its cus empty */
+	load_new = !S_ISCHR(st.st_mode);
+
+	if (load_old && pthread_create(&old_thread, NULL, codiff_cus__load_thread, &old_dcus) != 0) {
+		// Load one after the other, then
+		codiff_cus__load_thread(&old_dcus);
+		load_old = false;
+	}
+
+	if (load_new)
+		codiff_cus__load_thread(&new_dcus);
+
+	if (load_old)
+		pthread_join(old_thread, NULL);
+
+	if (old_dcus.err < 0) {
+		cus__print_error_msg("codiff", old_cus, old_filename, old_dcus.err);
 		goto out_cus_delete_priv;
 	}
 
-	/* If old_file is a character device, leave its cus empty */
-	if (!S_ISCHR(st.st_mode)) {
-		err = cus__load_file(new_cus, &conf_load, new_filename);
-		if (err < 0) {
-			cus__print_error_msg("codiff", new_cus, new_filename, err);
-			goto out_cus_delete_priv;
-		}
+	if (new_dcus.err < 0) {
+		cus__print_error_msg("codiff", new_cus, new_filename, new_dcus.err);
+		goto out_cus_delete_priv;
+	}
+
+	if (old_dcus.steal_err || new_dcus.steal_err) {
+		fprintf(stderr, "codiff: %s\n", strerror(-(old_dcus.steal_err ?: new_dcus.steal_err)));
+		goto out_cus_delete_priv;
+	}
+
+	if (codiff_cus__index(&old_dcus) || codiff_cus__index(&new_dcus)) {
+		fputs("codiff: insufficient memory\n", stderr);
+		goto out_cus_delete_priv;
+	}
+
+	if (codiff_cus__for_each_cu_parallel(&old_dcus, cu_diff_iterator, dcus) ||
+	    codiff_cus__for_each_cu_parallel(&new_dcus, cu_find_new_tags_iterator, &old_dcus)) {
+		fputs("codiff: insufficient memory\n", stderr);
+		goto out_cus_delete_priv;
 	}
 
-	cus__for_each_cu(old_cus, cu_diff_iterator, new_cus, NULL);
-	cus__for_each_cu(new_cus, cu_find_new_tags_iterator, old_cus, NULL);
-	cus__for_each_cu(old_cus, cu_show_diffs_iterator, NULL, NULL);
+	codiff_cus__for_each_cu(&old_dcus, cu_show_diffs_iterator, NULL);
 	if (cus__nr_entries(new_cus) > 1)
-		cus__for_each_cu(new_cus, cu_show_diffs_iterator, (void *)1, NULL);
+		codiff_cus__for_each_cu(&new_dcus, cu_show_diffs_iterator, (void *)1);
 
 	if (total_cus_changed > 1) {
 		if (show_function_diffs)
@@ -841,8 +1367,10 @@ out_cus_delete_priv:
 	cus__for_each_cu(old_cus, cu_delete_priv, NULL, NULL);
 	cus__for_each_cu(new_cus, cu_delete_priv, NULL, NULL);
 out_cus_delete:
-	cus__delete(old_cus);
-	cus__delete(new_cus);
+	codiff_cus__exit(&old_dcus);
+	codiff_cus__exit(&new_dcus);
+	cus__delete_at_exit(old_cus);
+	cus__delete_at_exit(new_cus);
 	strlist__delete(structs_printed);
 	dwarves__exit();
 out:
@@ -701,6 +701,7 @@ int ctf__load_file(struct cus *cus, struct conf_load *conf,
 	if (cu == NULL)
 		return -1;
 
+	cu->seq = cus__new_cu_seq(cus);
 	cu->language = LANG_C;
 	cu->uses_global_strings = false;
 	cu->little_endian = state->ehdr.e_ident[EI_DATA] == ELFDATA2LSB;
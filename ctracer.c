@@ -30,6 +30,11 @@
  */
 static char *class_name;
 
+/*
+ * Threads used to look for the methods, -j
+ */
+static int nr_jobs = 1;
+
 /*
  * List of compilation units being looked for functions with
  * pointers to the specified struct.
@@ -210,7 +215,7 @@ static struct function *function__filter(struct function *function,
  * function tags that have as one of its parameters a pointer to
  * the specified "class" (struct).
  */
-static int cu_find_methods_iterator(struct cu *cu, void *cookie)
+static int cu_find_methods_iterator(struct cu *cu, void *cookie, FILE *fp __maybe_unused)
 {
 	type_id_t target_type_id;
 	uint32_t function_id;
@@ -354,6 +359,9 @@ static struct class *class__clone_base_types(const struct tag *tag,
 	if (clone == NULL)
 		return NULL;
 
+	/* class__remove_member() uses the holes */
+	class__find_holes(clone);
+
 	type__for_each_data_member_safe(&clone->type, pos, next) {
 		struct tag *member_type = cu__type(cu, pos->tag.type);
 
@@ -787,7 +795,7 @@ static int cu_emit_pointer_probes_iterator(struct cu *cu, void *cookie)
  * cu_find_methods_iterator, creating the functions table that will
  * be used by ostra-cg
  */
-static int cu_emit_functions_table(struct cu *cu, void *fp)
+static int cu_emit_functions_table(struct cu *cu, void *cookie __maybe_unused, FILE *fp)
 {
        struct function *pos;
 
@@ -801,6 +809,28 @@ static int cu_emit_functions_table(struct cu *cu, void *fp)
        return 0;
 }
 
+/*
+ * The methods are looked up in each CU independently, so do it in parallel,
+ * emitting the probes, deduplicated by name in probes_emitted, has to be done
+ * serially, in CU order, as which CU gets a probe for a static function
+ * depends on it.
+ */
+static void cus__find_methods(struct cus *cus, const char *name)
+{
+	int i, jobs = nr_jobs > 1 ? nr_jobs : 1;
+	void *cookies[jobs];
+
+	for (i = 0; i < jobs; ++i)
+		cookies[i] = (void *)name;
+
+	cus__for_each_cu_parallel(cus, cu_find_methods_iterator, cookies, jobs, cu_filter, NULL, false);
+}
+
+static void cus__emit_functions_table(struct cus *cus, FILE *fp)
+{
+	cus__for_each_cu_parallel(cus, cu_emit_functions_table, NULL, nr_jobs, cu_filter, fp, true);
+}
+
 static int elf__open(const char *filename)
 {
 	int fd = open(filename, O_RDONLY);
@@ -828,7 +858,7 @@ static int elf__open(const char *filename)
 	if (init == NULL)
 		goto out_elf_end;
 
-	struct elf_symtab *symtab = elf_symtab__new(".symtab", elf);
+	struct elf_symtab *symtab = elf_symtab__new(".symtab", elf, 1);
 	if (symtab == NULL)
 		goto out_elf_end;
 
@@ -836,16 +866,15 @@ static int elf__open(const char *filename)
 	if (init_blacklist == NULL)
 		goto out_elf_symtab_delete;
 
-	uint32_t index;
-	GElf_Sym sym;
-	elf_symtab__for_each_symbol(symtab, index, sym) {
-		if (!elf_sym__is_local_function(&sym))
-			continue;
-		if (elf_sym__section(&sym) != init_index)
+	uint32_t index, pos;
+	elf_symtab__for_each_symbol_in_section(symtab, init_index, pos, index) {
+		const GElf_Sym *sym = elf_symtab__sym(symtab, index);
+
+		if (!elf_sym__is_local_function(sym))
 			continue;
-		err = strlist__add(init_blacklist, elf_sym__name(&sym, symtab));
+		err = strlist__add(init_blacklist, elf_sym__name(sym, symtab));
 		if (err == -ENOMEM) {
-			fprintf(stderr, "failed for %s(%d,%zd)\n", elf_sym__name(&sym, symtab),elf_sym__section(&sym),init_index);
+			fprintf(stderr, "failed for %s(%d,%zd)\n", elf_sym__name(sym, symtab),elf_sym__section(sym),init_index);
 			goto out_delete_blacklist;
 		}
 	}
@@ -896,6 +925,13 @@ static const struct argp_option ctracer__options[] = {
 		.name = "recursive",
 		.doc  = "recursively load files",
 	},
+	{
+		.name  = "jobs",
+		.key   = 'j',
+		.arg   = "NR_JOBS",
+		.flags = OPTION_ARG_OPTIONAL, // Use sysconf(_SC_NPROCESSORS_ONLN) * 1.1 by default
+		.doc   = "look for the methods using N jobs in parallel [default to number of online processors + 10%]",
+	},
 	{
 		.name = NULL,
 	}
@@ -913,6 +949,9 @@ static error_t ctracer__options_parser(int key, char *arg,
 	case 'D': dirname = arg;		break;
 	case 'g': glob = arg;			break;
 	case 'r': recursive = 1;		break;
+	case 'j': nr_jobs = arg ? atoi(arg) :
+			  sysconf(_SC_NPROCESSORS_ONLN) * 1.1;
+						break;
 	default:  return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
@@ -1073,32 +1112,26 @@ failure:
 	if (cu_blacklist != NULL)
 		strlist__load(cu_blacklist, cu_blacklist_filename);
 
-	cus__for_each_cu(methods_cus, cu_find_methods_iterator,
-			 class_name, cu_filter);
+	cus__find_methods(methods_cus, class_name);
 	cus__for_each_cu(methods_cus, cu_emit_probes_iterator,
 			 class_name, cu_filter);
-	cus__for_each_cu(methods_cus, cu_emit_functions_table,
-			 fp_functions, cu_filter);
+	cus__emit_functions_table(methods_cus, fp_functions);
 
 	list_for_each_entry(pos, &aliases, node) {
 		const char *alias_name = structure__name(pos);
 
-		cus__for_each_cu(methods_cus, cu_find_methods_iterator,
-				 (void *)alias_name, cu_filter);
+		cus__find_methods(methods_cus, alias_name);
 		cus__for_each_cu(methods_cus, cu_emit_probes_iterator,
 				 (void *)alias_name, cu_filter);
-		cus__for_each_cu(methods_cus, cu_emit_functions_table,
-				 fp_functions, cu_filter);
+		cus__emit_functions_table(methods_cus, fp_functions);
 	}
 
 	list_for_each_entry(pos, &pointers, node) {
 		const char *pointer_name = structure__name(pos);
-		cus__for_each_cu(methods_cus, cu_find_methods_iterator,
-				 (void *)pointer_name, cu_filter);
+		cus__find_methods(methods_cus, pointer_name);
 		cus__for_each_cu(methods_cus, cu_emit_pointer_probes_iterator,
 				 (void *)pointer_name, cu_filter);
-		cus__for_each_cu(methods_cus, cu_emit_functions_table, fp_functions,
-				 cu_filter);
+		cus__emit_functions_table(methods_cus, fp_functions);
 	}
 
 	fclose(fp_methods);
@@ -1109,7 +1142,7 @@ failure:
 
 	rc = EXIT_SUCCESS;
 out:
-	cus__delete(methods_cus);
+	cus__delete_at_exit(methods_cus);
 	dwarves__exit();
 	return rc;
 }
@@ -49,7 +49,7 @@ int main(int argc __maybe_unused, char *argv[])
 	cus__dump_class_tag_names(cus);
 	rc = EXIT_SUCCESS;
 out:
-	cus__delete(cus);
+	cus__delete_at_exit(cus);
 	dwarves__exit();
 	return rc;
 }
@@ -9,9 +9,12 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 void *zalloc(size_t size)
 {
@@ -226,3 +229,144 @@ char *strlwr(char *s)
 
 	return s;
 }
+
+size_t fprintf__string(FILE *fp, const char *s)
+{
+	// Like printf("%s", NULL) in glibc
+	if (s == NULL)
+		s = "(null)";
+
+	size_t len = strlen(s);
+
+	return fwrite(s, 1, len, fp);
+}
+
+size_t fprintf__spaces(FILE *fp, int nr_spaces)
+{
+	static const char spaces[] = "                                                                ";
+	size_t printed = 0;
+
+	while (nr_spaces > 0) {
+		int n = nr_spaces < (int)sizeof(spaces) - 1 ? nr_spaces : (int)sizeof(spaces) - 1;
+
+		printed += fwrite(spaces, 1, n, fp);
+		nr_spaces -= n;
+	}
+
+	return printed;
+}
+
+// fprintf(fp, "%-*s", width, s)
+size_t fprintf__left_aligned(FILE *fp, const char *s, int width)
+{
+	size_t printed = fprintf__string(fp, s);
+
+	if (width < 0)
+		width = -width;
+
+	if ((int)printed < width)
+		printed += fprintf__spaces(fp, width - printed);
+
+	return printed;
+}
+
+// fprintf(fp, "%*" PRIu64, width, value)
+size_t fprintf__u64(FILE *fp, uint64_t value, int width)
+{
+	char bf[24], *digits = bf + sizeof(bf);
+	size_t printed = 0, len;
+
+	do {
+		*--digits = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	len = bf + sizeof(bf) - digits;
+
+	if (width > (int)len)
+		printed = fprintf__spaces(fp, width - len);
+
+	printed += fwrite(digits, 1, len, fp);
+
+	if (width < 0 && (int)printed < -width)
+		printed += fprintf__spaces(fp, -width - printed);
+
+	return printed;
+}
+
+void fprintf__setvbuf(FILE *fp)
+{
+	if (!isatty(fileno(fp)))
+		setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+}
+
+static pthread_key_t fprintf_buf__key;
+static pthread_once_t fprintf_buf__key_once = PTHREAD_ONCE_INIT;
+
+static void fprintf_buf__delete(void *arg)
+{
+	struct fprintf_buf *buf = arg;
+
+	fclose(buf->fp);
+	free(buf->buf);
+	free(buf);
+}
+
+static void fprintf_buf__key_init(void)
+{
+	if (pthread_key_create(&fprintf_buf__key, fprintf_buf__delete) != 0)
+		fprintf_buf__key = (pthread_key_t)-1;
+}
+
+struct fprintf_buf *fprintf_buf__get(void)
+{
+	struct fprintf_buf *buf;
+
+	pthread_once(&fprintf_buf__key_once, fprintf_buf__key_init);
+	if (fprintf_buf__key == (pthread_key_t)-1)
+		return NULL;
+
+	buf = pthread_getspecific(fprintf_buf__key);
+	if (buf == NULL) {
+		buf = zalloc(sizeof(*buf));
+		if (buf == NULL)
+			return NULL;
+
+		buf->fp = open_memstream(&buf->buf, &buf->size);
+		if (buf->fp == NULL || pthread_setspecific(fprintf_buf__key, buf) != 0) {
+			if (buf->fp)
+				fclose(buf->fp);
+			free(buf->buf);
+			free(buf);
+			return NULL;
+		}
+
+		// Only this thread uses it
+		__fsetlocking(buf->fp, FSETLOCKING_BYCALLER);
+	}
+
+	if (buf->in_use)
+		return NULL;
+
+	buf->in_use = true;
+	return buf;
+}
+
+/*
+ * Writes what was printed to buf since fprintf_buf__get() to fp and makes it
+ * available for the next fprintf_buf__get() in this thread.
+ */
+size_t fprintf_buf__flush(struct fprintf_buf *buf, FILE *fp)
+{
+	size_t printed = 0;
+	off_t len;
+
+	fflush(buf->fp);
+	len = ftello(buf->fp);
+	if (len > 0)
+		printed = fwrite(buf->buf, 1, len, fp);
+
+	fseeko(buf->fp, 0, SEEK_SET);
+	buf->in_use = false;
+	return printed;
+}
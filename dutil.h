@@ -12,6 +12,8 @@
 #include <stdbool.h>
 #include <linux/stddef.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <elf.h>
 #include <gelf.h>
@@ -340,6 +342,39 @@ static inline int elf_getshdrstrndx(Elf *elf, size_t *dst)
 
 char *strlwr(char *s);
 
+/*
+ * For the fprintf routines, that print lots of small strings, numbers and
+ * padding, to avoid parsing a format for each of them. Like fprintf(), they
+ * return how many chars were printed.
+ */
+size_t fprintf__string(FILE *fp, const char *s);
+size_t fprintf__spaces(FILE *fp, int nr_spaces);
+size_t fprintf__left_aligned(FILE *fp, const char *s, int width);
+size_t fprintf__u64(FILE *fp, uint64_t value, int width);
+
+/*
+ * Use a larger buffer for fp if it isn't a terminal, so that dumps of
+ * big files are made of fewer, larger writes.
+ */
+void fprintf__setvbuf(FILE *fp);
+
+/*
+ * Per thread output buffer, a FILE that is only used by the thread that got
+ * it, so printing to it doesn't take any lock nor waits for other threads,
+ * fprintf_buf__flush() then writes what was printed to it to the real FILE in
+ * one go. Callers nesting fprintf_buf__get() get NULL and should print
+ * directly to their FILE.
+ */
+struct fprintf_buf {
+	FILE   *fp;
+	char   *buf;
+	size_t size;
+	bool   in_use;
+};
+
+struct fprintf_buf *fprintf_buf__get(void);
+size_t fprintf_buf__flush(struct fprintf_buf *buf, FILE *fp);
+
 void __zfree(void **ptr);
 
 #define zfree(ptr) __zfree((void **)(ptr))
@@ -54,12 +54,26 @@
 
 static pthread_mutex_t libdw__lock = PTHREAD_MUTEX_INITIALIZER;
 
-static uint32_t hashtags__bits = 12;
-static uint32_t max_hashtags__bits = 21;
+static const uint32_t default_hashtags__bits = 12;
+static const uint32_t default_max_hashtags__bits = 21;
 
-static uint32_t hashtags__fn(Dwarf_Off key)
+/*
+ * Not kept in globals, as several files may be loaded at the same time and
+ * the merged LTO CUs use more bits than the others.
+ */
+static uint32_t hashtags__bits(const struct conf_load *conf)
+{
+	return conf->hashtable_bits ?: default_hashtags__bits;
+}
+
+static uint32_t max_hashtags__bits(const struct conf_load *conf)
 {
-	return hash_64(key, hashtags__bits);
+	return conf->max_hashtable_bits ?: default_max_hashtags__bits;
+}
+
+static uint32_t hashtags__fn(Dwarf_Off key, uint32_t bits)
+{
+	return hash_64(key, bits);
 }
 
 bool no_bitfield_type_recode = true;
@@ -112,20 +126,43 @@ static void dwarf_tag__set_spec(struct dwarf_tag *dtag, dwarf_off_ref spec)
 	*(dwarf_off_ref *)(dtag + 1) = spec;
 }
 
+/*
+ * When recoding in parallel what needs the abstract origins is left for a
+ * serial pass, as the origins may be being recoded by some other thread.
+ */
+enum dwarf_cu_recode {
+	DWARF_CU_RECODE__ALL,
+	DWARF_CU_RECODE__NO_ORIGINS,
+	DWARF_CU_RECODE__ORIGINS,
+};
+
 struct dwarf_cu {
 	struct hlist_head *hash_tags;
 	struct hlist_head *hash_types;
 	struct dwarf_tag *last_type_lookup;
 	struct cu *cu;
 	struct dwarf_cu *type_unit;
+	enum dwarf_cu_recode recoding;
+	uint32_t hash_bits;
 };
 
-static int dwarf_cu__init(struct dwarf_cu *dcu, struct cu *cu)
+static bool dwarf_cu__recoding_types(const struct dwarf_cu *dcu)
+{
+	return dcu->recoding != DWARF_CU_RECODE__ORIGINS;
+}
+
+static bool dwarf_cu__recoding_origins(const struct dwarf_cu *dcu)
+{
+	return dcu->recoding != DWARF_CU_RECODE__NO_ORIGINS;
+}
+
+static int dwarf_cu__init(struct dwarf_cu *dcu, struct cu *cu, uint32_t hash_bits)
 {
 	static struct dwarf_tag sentinel_dtag = { .id = ULLONG_MAX, };
-	uint64_t hashtags_size = 1UL << hashtags__bits;
+	uint64_t hashtags_size = 1UL << hash_bits;
 
 	dcu->cu = cu;
+	dcu->hash_bits = hash_bits;
 
 	dcu->hash_tags = cu__malloc(cu, sizeof(struct hlist_head) * hashtags_size);
 	if (!dcu->hash_tags)
@@ -143,16 +180,17 @@ static int dwarf_cu__init(struct dwarf_cu *dcu, struct cu *cu)
 		INIT_HLIST_HEAD(&dcu->hash_types[i]);
 	}
 	dcu->type_unit = NULL;
+	dcu->recoding = DWARF_CU_RECODE__ALL;
 	// To avoid a per-lookup check against NULL in dwarf_cu__find_type_by_ref()
 	dcu->last_type_lookup = &sentinel_dtag;
 	return 0;
 }
 
-static struct dwarf_cu *dwarf_cu__new(struct cu *cu)
+static struct dwarf_cu *dwarf_cu__new(struct cu *cu, uint32_t hash_bits)
 {
 	struct dwarf_cu *dwarf_cu = cu__zalloc(cu, sizeof(*dwarf_cu));
 
-	if (dwarf_cu != NULL && dwarf_cu__init(dwarf_cu, cu) != 0) {
+	if (dwarf_cu != NULL && dwarf_cu__init(dwarf_cu, cu, hash_bits) != 0) {
 		cu__free(cu, dwarf_cu);
 		dwarf_cu = NULL;
 	}
@@ -183,22 +221,22 @@ static void __tag__print_type_not_found(struct tag *tag, const char *func)
 #define tag__print_type_not_found(tag) \
 	__tag__print_type_not_found(tag, __func__)
 
-static void hashtags__hash(struct hlist_head *hashtable,
+static void hashtags__hash(struct hlist_head *hashtable, uint32_t bits,
 			   struct dwarf_tag *dtag)
 {
-	struct hlist_head *head = hashtable + hashtags__fn(dtag->id);
+	struct hlist_head *head = hashtable + hashtags__fn(dtag->id, bits);
 	hlist_add_head(&dtag->hash_node, head);
 }
 
 static struct dwarf_tag *hashtags__find(const struct hlist_head *hashtable,
-					const Dwarf_Off id)
+					uint32_t bits, const Dwarf_Off id)
 {
 	if (id == 0)
 		return NULL;
 
 	struct dwarf_tag *tpos;
 	struct hlist_node *pos;
-	uint32_t bucket = hashtags__fn(id);
+	uint32_t bucket = hashtags__fn(id, bits);
 	const struct hlist_head *head = hashtable + bucket;
 
 	hlist_for_each_entry(tpos, pos, head, hash_node) {
@@ -215,7 +253,7 @@ static void cu__hash(struct cu *cu, struct tag *tag)
 	struct hlist_head *hashtable = tag__is_tag_type(tag) ?
 							dcu->hash_types :
 							dcu->hash_tags;
-	hashtags__hash(hashtable, tag->priv);
+	hashtags__hash(hashtable, dcu->hash_bits, tag->priv);
 }
 
 static struct dwarf_tag *dwarf_cu__find_tag_by_ref(const struct dwarf_cu *cu,
@@ -226,7 +264,7 @@ static struct dwarf_tag *dwarf_cu__find_tag_by_ref(const struct dwarf_cu *cu,
 	if (ref->from_types) {
 		return NULL;
 	}
-	return hashtags__find(cu->hash_tags, ref->off);
+	return hashtags__find(cu->hash_tags, cu->hash_bits, ref->off);
 }
 
 static struct dwarf_tag *dwarf_cu__find_type_by_ref(struct dwarf_cu *dcu,
@@ -234,6 +272,13 @@ static struct dwarf_tag *dwarf_cu__find_type_by_ref(struct dwarf_cu *dcu,
 {
 	if (dcu == NULL)
 		return NULL;
+
+	/*
+	 * When recoding in parallel the lookup cache would just bounce between
+	 * the threads, so only read it then.
+	 */
+	bool update_last_lookup = dcu->recoding != DWARF_CU_RECODE__NO_ORIGINS;
+
 	if (ref->from_types) {
 		dcu = dcu->type_unit;
 		if (dcu == NULL) {
@@ -241,12 +286,14 @@ static struct dwarf_tag *dwarf_cu__find_type_by_ref(struct dwarf_cu *dcu,
 		}
 	}
 
-	if (dcu->last_type_lookup->id == ref->off)
-		return dcu->last_type_lookup;
+	struct dwarf_tag *last_lookup = dcu->last_type_lookup;
 
-	struct dwarf_tag *dtag = hashtags__find(dcu->hash_types, ref->off);
+	if (last_lookup->id == ref->off)
+		return last_lookup;
 
-	if (dtag)
+	struct dwarf_tag *dtag = hashtags__find(dcu->hash_types, dcu->hash_bits, ref->off);
+
+	if (dtag && update_last_lookup)
 		dcu->last_type_lookup = dtag;
 
 	return dtag;
@@ -990,6 +1037,37 @@ static struct parameter *parameter__new(Dwarf_Die *die, struct cu *cu, struct co
 	return parm;
 }
 
+/*
+ * Called first with @exp->ranges NULL, to find the size and count the ranges,
+ * then, if there is more than one, again to store them.
+ */
+static void inline_expansion__read_ranges(struct inline_expansion *exp, Dwarf_Die *die)
+{
+	Dwarf_Addr base, start, end = exp->high_pc;
+	ptrdiff_t offset = 0;
+	uint32_t nr_ranges = 0;
+
+	while (1) {
+		offset = dwarf_ranges(die, offset, &base, &start, &end);
+		start = (unsigned long)start;
+		end = (unsigned long)end;
+		if (offset <= 0)
+			break;
+		if (exp->ranges != NULL) {
+			exp->ranges[nr_ranges].start = start;
+			exp->ranges[nr_ranges].end   = end;
+		} else {
+			exp->size += end - start;
+			if (exp->ip.addr == 0)
+				exp->ip.addr = start;
+		}
+		++nr_ranges;
+	}
+
+	exp->high_pc = end;
+	exp->nr_ranges = nr_ranges;
+}
+
 static struct inline_expansion *inline_expansion__new(Dwarf_Die *die, struct cu *cu, struct conf_load *conf)
 {
 	struct inline_expansion *exp = tag__alloc(cu, sizeof(*exp));
@@ -1003,6 +1081,8 @@ static struct inline_expansion *inline_expansion__new(Dwarf_Die *die, struct cu
 		dtag->type = attr_type(die, DW_AT_abstract_origin);
 		exp->ip.addr = 0;
 		exp->high_pc = 0;
+		exp->nr_ranges = 0;
+		exp->ranges = NULL;
 
 		if (!cu->has_addr_info)
 			goto out;
@@ -1014,20 +1094,17 @@ static struct inline_expansion *inline_expansion__new(Dwarf_Die *die, struct cu
 
 		exp->size = exp->high_pc - exp->ip.addr;
 		if (exp->size == 0) {
-			Dwarf_Addr base, start;
-			ptrdiff_t offset = 0;
-
-			while (1) {
-				offset = dwarf_ranges(die, offset, &base, &start,
-						      &exp->high_pc);
-				start = (unsigned long)start;
-				exp->high_pc = (unsigned long)exp->high_pc;
-				if (offset <= 0)
-					break;
-				exp->size += exp->high_pc - start;
-				if (exp->ip.addr == 0)
-					exp->ip.addr = start;
-			}
+			inline_expansion__read_ranges(exp, die);
+
+			if (exp->nr_ranges > 1) {
+				exp->ranges = cu__malloc(cu, exp->nr_ranges * sizeof(*exp->ranges));
+				if (exp->ranges == NULL) {
+					cu__free(cu, exp);
+					return NULL;
+				}
+				inline_expansion__read_ranges(exp, die);
+			} else
+				exp->nr_ranges = 0;
 		}
 	}
 out:
@@ -2074,6 +2151,12 @@ static int namespace__recode_dwarf_types(struct tag *tag, struct cu *cu)
 			continue;
 		}
 
+		if (!dwarf_cu__recoding_types(dcu)) {
+			if (pos->tag == DW_TAG_subroutine_type || pos->tag == DW_TAG_subprogram)
+				ftype__recode_dwarf_types(pos, cu);
+			continue;
+		}
+
 		switch (pos->tag) {
 		case DW_TAG_member: {
 			struct class_member *member = tag__class_member(pos);
@@ -2155,6 +2238,22 @@ static void __tag__print_abstract_origin_not_found(struct tag *tag,
 #define tag__print_abstract_origin_not_found(tag ) \
 	__tag__print_abstract_origin_not_found(tag, __func__)
 
+/*
+ * The abstract origin may not have been recoded yet, it can come later in the
+ * tables, so go from its DWARF type reference instead of using its ->type.
+ */
+static type_id_t dwarf_tag__origin_type(struct dwarf_tag *dorigin, struct dwarf_cu *dcu)
+{
+	struct dwarf_tag *dtype;
+
+	if (dorigin->type.off == 0)
+		return dorigin->tag->type;
+
+	dtype = dwarf_cu__find_type_by_ref(dcu, &dorigin->type);
+
+	return dtype ? dtype->small_id : dorigin->tag->type;
+}
+
 static void ftype__recode_dwarf_types(struct tag *tag, struct cu *cu)
 {
 	struct parameter *pos;
@@ -2168,19 +2267,25 @@ static void ftype__recode_dwarf_types(struct tag *tag, struct cu *cu)
 		if (dpos->type.off == 0) {
 			if (dpos->abstract_origin.off == 0) {
 				/* Function without parameters */
-				pos->tag.type = 0;
+				if (dwarf_cu__recoding_types(dcu))
+					pos->tag.type = 0;
 				continue;
 			}
+			if (!dwarf_cu__recoding_origins(dcu))
+				continue;
 			dtype = dwarf_cu__find_tag_by_ref(dcu, &dpos->abstract_origin);
 			if (dtype == NULL) {
 				tag__print_abstract_origin_not_found(&pos->tag);
 				continue;
 			}
 			pos->name = tag__parameter(dtype->tag)->name;
-			pos->tag.type = dtype->tag->type;
+			pos->tag.type = dwarf_tag__origin_type(dtype, dcu);
 			continue;
 		}
 
+		if (!dwarf_cu__recoding_types(dcu))
+			continue;
+
 		dtype = dwarf_cu__find_type_by_ref(dcu, &dpos->type);
 		if (dtype == NULL) {
 			tag__print_type_not_found(&pos->tag);
@@ -2204,6 +2309,8 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 			lexblock__recode_dwarf_types(tag__lexblock(pos), cu);
 			continue;
 		case DW_TAG_inlined_subroutine:
+			if (!dwarf_cu__recoding_origins(dcu))
+				continue;
 			dtype = dwarf_cu__find_tag_by_ref(dcu, &dpos->type);
 			if (dtype == NULL) {
 				tag__print_type_not_found(pos);
@@ -2216,6 +2323,9 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 			if (dpos->type.off != 0)
 				break;
 
+			if (!dwarf_cu__recoding_origins(dcu))
+				continue;
+
 			struct parameter *fp = tag__parameter(pos);
 			dtype = dwarf_cu__find_tag_by_ref(dcu,
 							  &dpos->abstract_origin);
@@ -2224,7 +2334,7 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 				continue;
 			}
 			fp->name = tag__parameter(dtype->tag)->name;
-			pos->type = dtype->tag->type;
+			pos->type = dwarf_tag__origin_type(dtype, dcu);
 			continue;
 
 		case DW_TAG_variable:
@@ -2242,6 +2352,9 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 				continue;
 			}
 
+			if (!dwarf_cu__recoding_origins(dcu))
+				continue;
+
 			dtype = dwarf_cu__find_tag_by_ref(dcu,
 							  &dpos->abstract_origin);
 			if (dtype == NULL) {
@@ -2249,13 +2362,13 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 				continue;
 			}
 			var->name = tag__variable(dtype->tag)->name;
-			pos->type = dtype->tag->type;
+			pos->type = dwarf_tag__origin_type(dtype, dcu);
 			continue;
 
 		case DW_TAG_label: {
 			struct label *l = tag__label(pos);
 
-			if (dpos->abstract_origin.off == 0)
+			if (dpos->abstract_origin.off == 0 || !dwarf_cu__recoding_origins(dcu))
 				continue;
 
 			dtype = dwarf_cu__find_tag_by_ref(dcu, &dpos->abstract_origin);
@@ -2267,6 +2380,9 @@ static void lexblock__recode_dwarf_types(struct lexblock *tag, struct cu *cu)
 			continue;
 		}
 
+		if (!dwarf_cu__recoding_types(dcu))
+			continue;
+
 		dtype = dwarf_cu__find_type_by_ref(dcu, &dpos->type);
 		if (dtype == NULL) {
 			tag__print_type_not_found(pos);
@@ -2315,6 +2431,79 @@ static void dwarf_cu__recode_btf_type_tag_ptr(struct btf_type_tag_ptr_type *tag,
 	prev_tag->type = pointee_type;
 }
 
+/*
+ * Returns false for declarations without a name nor where to get it from,
+ * that have nothing else to recode.
+ */
+static bool function__recode_dwarf_name(struct function *fn, struct cu *cu)
+{
+	struct dwarf_tag *dtag = fn->proto.tag.priv;
+	struct dwarf_tag *dtype;
+
+	if (fn->name != 0)
+		return true;
+
+	dwarf_off_ref specification = dwarf_tag__spec(dtag);
+	if (dtag->abstract_origin.off == 0 &&
+	    specification.off == 0) {
+		/*
+		 * Found on libQtGui.so.4.3.4.debug
+		 *  <3><1423de>: Abbrev Number: 209 (DW_TAG_subprogram)
+		 *      <1423e0>   DW_AT_declaration : 1
+		 */
+		return false;
+	}
+
+	if (!dwarf_cu__recoding_origins(cu->priv))
+		return true;
+
+	dtype = dwarf_cu__find_tag_by_ref(cu->priv, &dtag->abstract_origin);
+	if (dtype == NULL)
+		dtype = dwarf_cu__find_tag_by_ref(cu->priv, &specification);
+	if (dtype != NULL)
+		fn->name = tag__function(dtype->tag)->name;
+	else {
+		fprintf(stderr,
+			"%s: couldn't find name for "
+			"function %#llx, abstract_origin=%#llx,"
+			" specification=%#llx\n", __func__,
+			(unsigned long long)dtag->id,
+			(unsigned long long)dtag->abstract_origin.off,
+			(unsigned long long)specification.off);
+	}
+
+	return true;
+}
+
+/*
+ * The serial pass after recoding in parallel, for what was left because it
+ * needs the abstract origins.
+ */
+static int tag__recode_dwarf_origins(struct tag *tag, struct cu *cu)
+{
+	if (tag__has_namespace(tag))
+		return namespace__recode_dwarf_types(tag, cu);
+
+	switch (tag->tag) {
+	case DW_TAG_subprogram: {
+		struct function *fn = tag__function(tag);
+
+		if (!function__recode_dwarf_name(fn, cu))
+			return 0;
+		lexblock__recode_dwarf_types(&fn->lexblock, cu);
+	}
+		/* Fall thru */
+	case DW_TAG_subroutine_type:
+		ftype__recode_dwarf_types(tag, cu);
+		break;
+	case DW_TAG_lexical_block:
+		lexblock__recode_dwarf_types(tag__lexblock(tag), cu);
+		break;
+	}
+
+	return 0;
+}
+
 static int tag__recode_dwarf_type(struct tag *tag, struct cu *cu)
 {
 	struct dwarf_tag *dtag = tag->priv;
@@ -2324,6 +2513,9 @@ static int tag__recode_dwarf_type(struct tag *tag, struct cu *cu)
 	if (dtag == NULL)
 		return 0;
 
+	if (!dwarf_cu__recoding_types(cu->priv))
+		return tag__recode_dwarf_origins(tag, cu);
+
 	if (tag__is_type(tag))
 		type__recode_dwarf_specification(tag, cu);
 
@@ -2334,32 +2526,8 @@ static int tag__recode_dwarf_type(struct tag *tag, struct cu *cu)
 	case DW_TAG_subprogram: {
 		struct function *fn = tag__function(tag);
 
-		if (fn->name == 0)  {
-			dwarf_off_ref specification = dwarf_tag__spec(dtag);
-			if (dtag->abstract_origin.off == 0 &&
-			    specification.off == 0) {
-				/*
-				 * Found on libQtGui.so.4.3.4.debug
-				 *  <3><1423de>: Abbrev Number: 209 (DW_TAG_subprogram)
-				 *      <1423e0>   DW_AT_declaration : 1
-				 */
-				return 0;
-			}
-			dtype = dwarf_cu__find_tag_by_ref(cu->priv, &dtag->abstract_origin);
-			if (dtype == NULL)
-				dtype = dwarf_cu__find_tag_by_ref(cu->priv, &specification);
-			if (dtype != NULL)
-				fn->name = tag__function(dtype->tag)->name;
-			else {
-				fprintf(stderr,
-					"%s: couldn't find name for "
-					"function %#llx, abstract_origin=%#llx,"
-					" specification=%#llx\n", __func__,
-					(unsigned long long)dtag->id,
-					(unsigned long long)dtag->abstract_origin.off,
-					(unsigned long long)specification.off);
-			}
-		}
+		if (!function__recode_dwarf_name(fn, cu))
+			return 0;
 		lexblock__recode_dwarf_types(&fn->lexblock, cu);
 	}
 		/* Fall thru */
@@ -2475,11 +2643,10 @@ static int cu__resolve_func_ret_types(struct cu *cu)
 	return 0;
 }
 
-static int cu__recode_dwarf_types_table(struct cu *cu,
-					struct ptr_table *pt,
-					uint32_t i)
+static int __cu__recode_dwarf_types_table(struct cu *cu, struct ptr_table *pt,
+					  uint32_t i, uint32_t end)
 {
-	for (; i < pt->nr_entries; ++i) {
+	for (; i < end; ++i) {
 		struct tag *tag = pt->entries[i];
 
 		if (tag != NULL) /* void, see cu__new */
@@ -2489,7 +2656,14 @@ static int cu__recode_dwarf_types_table(struct cu *cu,
 	return 0;
 }
 
-static int cu__recode_dwarf_types(struct cu *cu)
+static int cu__recode_dwarf_types_table(struct cu *cu,
+					struct ptr_table *pt,
+					uint32_t i)
+{
+	return __cu__recode_dwarf_types_table(cu, pt, i, pt->nr_entries);
+}
+
+static int cu__recode_dwarf_types_tables(struct cu *cu)
 {
 	if (cu__recode_dwarf_types_table(cu, &cu->types_table, 1) ||
 	    cu__recode_dwarf_types_table(cu, &cu->tags_table, 0) ||
@@ -2498,6 +2672,134 @@ static int cu__recode_dwarf_types(struct cu *cu)
 	return 0;
 }
 
+/*
+ * Big CUs, think merged LTO ones, with millions of entries, have their tables
+ * split in chunks recoded in parallel, the lookups only read the hash tables.
+ * What needs the abstract origins is then done serially.
+ */
+#define RECODE_PARALLEL_MIN_ENTRIES	(1U << 16)
+#define RECODE_PARALLEL_CHUNK		4096U
+
+struct recode_dwarf_types_parallel {
+	struct cu	 *cu;
+	struct ptr_table *tables[3];
+	uint32_t	 table;
+	uint32_t	 next;
+	int		 error;
+	pthread_mutex_t	 mutex;
+};
+
+static bool recode_dwarf_types_parallel__next_chunk(struct recode_dwarf_types_parallel *rp,
+						    struct ptr_table **pt,
+						    uint32_t *start, uint32_t *end)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&rp->mutex);
+
+	while (!rp->error && rp->table < sizeof(rp->tables) / sizeof(rp->tables[0])) {
+		struct ptr_table *table = rp->tables[rp->table];
+
+		if (rp->next >= table->nr_entries) {
+			++rp->table;
+			rp->next = 0;
+			continue;
+		}
+
+		*pt    = table;
+		*start = rp->next;
+		rp->next += RECODE_PARALLEL_CHUNK;
+		if (rp->next > table->nr_entries)
+			rp->next = table->nr_entries;
+		*end = rp->next;
+		found = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&rp->mutex);
+
+	return found;
+}
+
+static void *cu__recode_dwarf_types_tables_thread(void *arg)
+{
+	struct recode_dwarf_types_parallel *rp = arg;
+	struct ptr_table *pt;
+	uint32_t start, end;
+
+	while (recode_dwarf_types_parallel__next_chunk(rp, &pt, &start, &end)) {
+		if (__cu__recode_dwarf_types_table(rp->cu, pt, start, end)) {
+			pthread_mutex_lock(&rp->mutex);
+			rp->error = -1;
+			pthread_mutex_unlock(&rp->mutex);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int cu__recode_dwarf_types_tables_parallel(struct cu *cu, int nr_jobs)
+{
+	struct recode_dwarf_types_parallel rp = {
+		.cu	= cu,
+		.tables = { &cu->types_table, &cu->tags_table, &cu->functions_table, },
+		.next	= 1, /* void, see cu__new */
+	};
+	pthread_t threads[nr_jobs];
+	int thr;
+
+	pthread_mutex_init(&rp.mutex, NULL);
+
+	/* This thread is one of the nr_jobs */
+	for (thr = 0; thr < nr_jobs - 1; ++thr) {
+		if (pthread_create(&threads[thr], NULL, cu__recode_dwarf_types_tables_thread, &rp))
+			break;
+	}
+
+	cu__recode_dwarf_types_tables_thread(&rp);
+
+	while (--thr >= 0)
+		pthread_join(threads[thr], NULL);
+
+	pthread_mutex_destroy(&rp.mutex);
+
+	return rp.error;
+}
+
+static bool cu__recode_dwarf_types_in_parallel(struct cu *cu, int nr_jobs)
+{
+	/* Bitfield recoding adds new base types to the types_table */
+	if (nr_jobs < 2 || !no_bitfield_type_recode)
+		return false;
+
+	return (cu->types_table.nr_entries + cu->tags_table.nr_entries +
+		cu->functions_table.nr_entries) >= RECODE_PARALLEL_MIN_ENTRIES;
+}
+
+/*
+ * nr_jobs is only > 1 for the CUs loaded by the thread calling the loader,
+ * the type unit and the merged LTO one, not from the CU threads.
+ */
+static int cu__recode_dwarf_types(struct cu *cu, int nr_jobs)
+{
+	struct dwarf_cu *dcu = cu->priv;
+	int err;
+
+	if (!cu__recode_dwarf_types_in_parallel(cu, nr_jobs))
+		return cu__recode_dwarf_types_tables(cu);
+
+	dcu->recoding = DWARF_CU_RECODE__NO_ORIGINS;
+	err = cu__recode_dwarf_types_tables_parallel(cu, nr_jobs);
+	if (!err) {
+		dcu->recoding = DWARF_CU_RECODE__ORIGINS;
+		err = cu__recode_dwarf_types_tables(cu);
+	}
+	dcu->recoding = DWARF_CU_RECODE__ALL;
+
+	return err ? -1 : 0;
+}
+
 static const char *dwarf_tag__decl_file(const struct tag *tag,
 					const struct cu *cu)
 {
@@ -2576,7 +2878,8 @@ static int die__process_and_recode(Dwarf_Die *die, struct cu *cu, struct conf_lo
 	int ret = die__process(die, cu, conf);
 	if (ret != 0)
 		return ret;
-	ret = cu__recode_dwarf_types(cu);
+	/* Already in one of the CU threads, when loading with nr_jobs > 1 */
+	ret = cu__recode_dwarf_types(cu, 1);
 	if (ret != 0)
 		return ret;
 
@@ -2749,7 +3052,7 @@ static int __cus__load_debug_types(struct conf_load *conf, Dwfl_Module *mod, Dwa
 				return DWARF_CB_ABORT;
 			}
 
-			if (dwarf_cu__init(dcup, cu) != 0)
+			if (dwarf_cu__init(dcup, cu, hashtags__bits(conf)) != 0)
 				return DWARF_CB_ABORT;
 			dcup->cu = cu;
 			/* Funny hack.  */
@@ -2770,7 +3073,7 @@ static int __cus__load_debug_types(struct conf_load *conf, Dwfl_Module *mod, Dwa
 		off = noff;
 	}
 
-	if (*cup != NULL && cu__recode_dwarf_types(*cup) != 0)
+	if (*cup != NULL && cu__recode_dwarf_types(*cup, conf->nr_jobs) != 0)
 		return DWARF_CB_ABORT;
 
 	return 0;
@@ -2862,7 +3165,7 @@ struct dwarf_cus {
 	struct dwarf_cu	    *type_dcu;
 };
 
-static int dwarf_cus__create_and_process_cu(struct dwarf_cus *dcus, Dwarf_Die *cu_die, uint8_t pointer_size)
+static int dwarf_cus__create_and_process_cu(struct dwarf_cus *dcus, Dwarf_Die *cu_die, uint8_t pointer_size, uint32_t seq)
 {
 	/*
 	 * DW_AT_name in DW_TAG_compile_unit can be NULL, first seen in:
@@ -2874,7 +3177,9 @@ static int dwarf_cus__create_and_process_cu(struct dwarf_cus *dcus, Dwarf_Die *c
 	if (cu == NULL || cu__set_common(cu, dcus->conf, dcus->mod, dcus->elf) != 0)
 		return DWARF_CB_ABORT;
 
-	struct dwarf_cu *dcu = dwarf_cu__new(cu);
+	cu->seq = seq;
+
+	struct dwarf_cu *dcu = dwarf_cu__new(cu, hashtags__bits(dcus->conf));
 
 	if (dcu == NULL)
 		return DWARF_CB_ABORT;
@@ -2890,7 +3195,8 @@ static int dwarf_cus__create_and_process_cu(struct dwarf_cus *dcus, Dwarf_Die *c
        return DWARF_CB_OK;
 }
 
-static int dwarf_cus__nextcu(struct dwarf_cus *dcus, Dwarf_Die *die_mem, Dwarf_Die **cu_die, uint8_t *pointer_size, uint8_t *offset_size)
+static int dwarf_cus__nextcu(struct dwarf_cus *dcus, Dwarf_Die *die_mem, Dwarf_Die **cu_die, uint8_t *pointer_size, uint8_t *offset_size,
+			     uint32_t *seq)
 {
 	Dwarf_Off noff;
 	size_t cuhl;
@@ -2906,8 +3212,10 @@ static int dwarf_cus__nextcu(struct dwarf_cus *dcus, Dwarf_Die *die_mem, Dwarf_D
 	ret = dwarf_nextcu(dcus->dw, dcus->off, &noff, &cuhl, NULL, pointer_size, offset_size);
 	if (ret == 0) {
 		*cu_die = dwarf_offdie(dcus->dw, dcus->off + cuhl, die_mem);
-		if (*cu_die != NULL)
+		if (*cu_die != NULL) {
 			dcus->off = noff;
+			*seq = cus__new_cu_seq(dcus->cus);
+		}
 	}
 
 out_unlock:
@@ -2921,12 +3229,13 @@ static void *dwarf_cus__process_cu_thread(void *arg)
 	struct dwarf_cus *dcus = arg;
 	uint8_t pointer_size, offset_size;
 	Dwarf_Die die_mem, *cu_die;
+	uint32_t seq;
 
-	while (dwarf_cus__nextcu(dcus, &die_mem, &cu_die, &pointer_size, &offset_size) == 0) {
+	while (dwarf_cus__nextcu(dcus, &die_mem, &cu_die, &pointer_size, &offset_size, &seq) == 0) {
 		if (cu_die == NULL)
 			break;
 
-		if (dwarf_cus__create_and_process_cu(dcus, cu_die, pointer_size) == DWARF_CB_ABORT)
+		if (dwarf_cus__create_and_process_cu(dcus, cu_die, pointer_size, seq) == DWARF_CB_ABORT)
 			goto out_abort;
 	}
 
@@ -2976,7 +3285,7 @@ static int __dwarf_cus__process_cus(struct dwarf_cus *dcus)
 		if (cu_die == NULL)
 			break;
 
-		if (dwarf_cus__create_and_process_cu(dcus, cu_die, pointer_size) == DWARF_CB_ABORT)
+		if (dwarf_cus__create_and_process_cu(dcus, cu_die, pointer_size, cus__new_cu_seq(dcus->cus)) == DWARF_CB_ABORT)
 			return DWARF_CB_ABORT;
 
 		dcus->off = noff;
@@ -3020,6 +3329,8 @@ static int cus__merge_and_process_cu(struct cus *cus, struct conf_load *conf,
 			if (cu == NULL || cu__set_common(cu, conf, mod, elf) != 0)
 				goto out_abort;
 
+			cu->seq = cus__new_cu_seq(cus);
+
 			dcu = zalloc(sizeof(*dcu));
 			if (dcu == NULL)
 				goto out_abort;
@@ -3028,14 +3339,15 @@ static int cus__merge_and_process_cu(struct cus *cus, struct conf_load *conf,
 			 * Let us start with max_hashtags__bits and
 			 * go down to find a proper hashtag bit value.
 			 */
-			uint32_t default_hbits = hashtags__bits;
-			for (hashtags__bits = max_hashtags__bits;
-			     hashtags__bits >= default_hbits;
-			     hashtags__bits--) {
-				if (dwarf_cu__init(dcu, cu) == 0)
+			uint32_t default_hbits = hashtags__bits(conf);
+			uint32_t hbits;
+			for (hbits = max_hashtags__bits(conf);
+			     hbits >= default_hbits;
+			     hbits--) {
+				if (dwarf_cu__init(dcu, cu, hbits) == 0)
 					break;
 			}
-			if (hashtags__bits < default_hbits)
+			if (hbits < default_hbits)
 				goto out_abort;
 
 			dcu->cu = cu;
@@ -3058,7 +3370,7 @@ static int cus__merge_and_process_cu(struct cus *cus, struct conf_load *conf,
 		return 0;
 
 	/* process merged cu */
-	if (cu__recode_dwarf_types(cu) != LSK__KEEPIT)
+	if (cu__recode_dwarf_types(cu, conf->nr_jobs) != LSK__KEEPIT)
 		goto out_abort;
 
 	/*
@@ -3102,6 +3414,8 @@ static int cus__load_module(struct cus *cus, struct conf_load *conf,
 	}
 
 	if (type_cu != NULL) {
+		// Comes before all the CUs in the file, the ones using it
+		type_cu->seq = cus__new_cu_seq(cus);
 		type_lsk = cu__finalize(type_cu, conf);
 		if (type_lsk == LSK__KEEPIT) {
 			cus__add(cus, type_cu);
@@ -3248,20 +3562,11 @@ static int dwarf__load_file(struct cus *cus, struct conf_load *conf,
 {
 	int fd, err;
 
-	if (conf->max_hashtable_bits != 0) {
-		if (conf->max_hashtable_bits > 31)
-			return -E2BIG;
-
-		max_hashtags__bits = conf->max_hashtable_bits;
-	}
+	if (conf->max_hashtable_bits > 31)
+		return -E2BIG;
 
-	if (conf->hashtable_bits != 0) {
-		if (conf->hashtable_bits > max_hashtags__bits)
-			return -E2BIG;
-
-		hashtags__bits = conf->hashtable_bits;
-	} else if (hashtags__bits > max_hashtags__bits)
-		return -EINVAL;
+	if (hashtags__bits(conf) > max_hashtags__bits(conf))
+		return conf->hashtable_bits != 0 ? -E2BIG : -EINVAL;
 
 	elf_version(EV_CURRENT);
 
@@ -149,6 +149,12 @@ void lexblock__delete(struct lexblock *block)
 	free(block);
 }
 
+static void inline_expansion__delete(struct inline_expansion *exp)
+{
+	free(exp->ranges);
+	free(exp);
+}
+
 void tag__delete(struct tag *tag)
 {
 	if (tag == NULL)
@@ -170,6 +176,8 @@ void tag__delete(struct tag *tag)
 		function__delete(tag__function(tag));	break;
 	case DW_TAG_lexical_block:
 		lexblock__delete(tag__lexblock(tag));	break;
+	case DW_TAG_inlined_subroutine:
+		inline_expansion__delete(tag__inline_expansion(tag)); break;
 	default:
 		free(tag);
 	}
@@ -343,6 +351,7 @@ void __type__init(struct type *type)
 	INIT_LIST_HEAD(&type->node);
 	INIT_LIST_HEAD(&type->type_enum);
 	type->sizeof_member = NULL;
+	type->decode_plan = NULL;
 	type->member_prefix = NULL;
 	type->member_prefix_len = 0;
 }
@@ -417,17 +426,9 @@ reevaluate:
 	return result;
 }
 
-static void cu__find_class_holes(struct cu *cu)
-{
-	uint32_t id;
-	struct class *pos;
-
-	cu__for_each_struct(cu, id, pos)
-		class__find_holes(pos);
-}
-
 struct cus {
 	uint32_t	 nr_entries;
+	uint32_t	 nr_cus_seq;
 	struct list_head cus;
 	pthread_mutex_t  mutex;
 	void		 (*loader_exit)(struct cus *cus);
@@ -454,6 +455,16 @@ uint32_t cus__nr_entries(const struct cus *cus)
 	return cus->nr_entries;
 }
 
+/*
+ * The loaders use this to number the CUs in the order they are in the files,
+ * the stealer may get them out of order when loading with multiple threads.
+ * Must be called with cus__lock() held if other threads may be calling it.
+ */
+uint32_t cus__new_cu_seq(struct cus *cus)
+{
+	return cus->nr_cus_seq++;
+}
+
 void cus__add(struct cus *cus, struct cu *cu)
 {
 	cus__lock(cus);
@@ -462,8 +473,6 @@ void cus__add(struct cus *cus, struct cu *cu)
 	list_add_tail(&cu->node, &cus->cus);
 
 	cus__unlock(cus);
-
-	cu__find_class_holes(cu);
 }
 
 static void ptr_table__init(struct ptr_table *pt)
@@ -659,6 +668,7 @@ struct cu *cu__new(const char *name, uint8_t addr_size,
 
 		cu->addr_size = addr_size;
 		cu->extra_dbg_info = 0;
+		cu->seq = 0;
 
 		cu->nr_inline_expansions   = 0;
 		cu->size_inline_expansions = 0;
@@ -1094,6 +1104,13 @@ size_t tag__size(const struct tag *tag, const struct cu *cu)
 {
 	size_t size;
 
+	/*
+	 * Tools call this from threads working on the same CU, so publish the
+	 * cached size with release/acquire, see below.
+	 */
+	if (__atomic_load_n(&tag->size_cached, __ATOMIC_ACQUIRE))
+		return __atomic_load_n(&tag->cached_size, __ATOMIC_RELAXED);
+
 	switch (tag->tag) {
 	case DW_TAG_string_type:
 		return tag__string_type(tag)->nr_entries;
@@ -1130,6 +1147,23 @@ size_t tag__size(const struct tag *tag, const struct cu *cu)
 		} else if (tag__has_type_loop(tag, type, NULL, 0, NULL))
 			return -1;
 		size = tag__size(type, cu);
+
+		if (tag->tag == DW_TAG_array_type)
+			size *= array_type__nr_entries(tag__array_type(tag));
+
+		/*
+		 * Typedefs, arrays, modifiers, etc: cache it so that we don't
+		 * have to follow the type chain again, members have byte_size.
+		 */
+		if (tag->tag != DW_TAG_member && tag->tag != DW_TAG_inheritance &&
+		    size != (size_t)-1 && size <= UINT32_MAX) {
+			struct tag *ctag = (struct tag *)tag;
+
+			__atomic_store_n(&ctag->cached_size, size, __ATOMIC_RELAXED);
+			__atomic_store_n(&ctag->size_cached, true, __ATOMIC_RELEASE);
+		}
+
+		return size;
 	}
 
 	if (tag->tag == DW_TAG_array_type)
@@ -1138,6 +1172,20 @@ size_t tag__size(const struct tag *tag, const struct cu *cu)
 	return size;
 }
 
+/*
+ * To be used when the size of types is changed, e.g. when pahole
+ * --word_size resizes structs, so that typedefs, arrays, etc get
+ * tag__size() recalculated.
+ */
+void cu__invalidate_tag_sizes(struct cu *cu)
+{
+	uint32_t id;
+	struct tag *pos;
+
+	cu__for_each_type(cu, id, pos)
+		tag__invalidate_size(pos);
+}
+
 const char *variable__name(const struct variable *var)
 {
 	return var->name;
@@ -1923,6 +1971,193 @@ void cus__for_each_cu(struct cus *cus,
 	cus__unlock(cus);
 }
 
+struct cus_parallel_output {
+	char	*buf;
+	size_t	size;
+	bool	done;
+};
+
+struct cus_parallel_iter {
+	struct cu		   **cus;
+	struct cus_parallel_output *outputs;
+	uint32_t		   nr_cus;
+	uint32_t		   next;
+	uint32_t		   next_to_flush;
+	uint32_t		   stop_at;
+	int			   error;
+	bool			   ordered;
+	FILE			   *output;
+	int			   (*iterator)(struct cu *cu, void *cookie, FILE *fp);
+	struct cu		   *(*filter)(struct cu *cu);
+	pthread_mutex_t		   mutex;
+};
+
+struct cus_parallel_thread {
+	struct cus_parallel_iter *iter;
+	void			 *cookie;
+};
+
+/* Must be called with iter->mutex held */
+static void cus_parallel_iter__output(struct cus_parallel_iter *iter, uint32_t idx)
+{
+	struct cus_parallel_output *output = &iter->outputs[idx];
+
+	output->done = true;
+
+	if (!iter->ordered) {
+		if (output->buf != NULL && idx < iter->stop_at)
+			fwrite(output->buf, 1, output->size, iter->output);
+		zfree(&output->buf);
+		return;
+	}
+
+	while (iter->next_to_flush < iter->stop_at && iter->outputs[iter->next_to_flush].done) {
+		output = &iter->outputs[iter->next_to_flush++];
+		if (output->buf != NULL)
+			fwrite(output->buf, 1, output->size, iter->output);
+		zfree(&output->buf);
+	}
+}
+
+static void *cus_parallel_thread__run(void *arg)
+{
+	struct cus_parallel_thread *thread = arg;
+	struct cus_parallel_iter *iter = thread->iter;
+
+	while (1) {
+		struct cus_parallel_output output = { .buf = NULL, };
+		FILE *fp = NULL;
+		uint32_t idx;
+		int ret = 0;
+
+		pthread_mutex_lock(&iter->mutex);
+		if (iter->error || iter->next >= iter->stop_at) {
+			pthread_mutex_unlock(&iter->mutex);
+			break;
+		}
+		idx = iter->next++;
+		pthread_mutex_unlock(&iter->mutex);
+
+		struct cu *cu = iter->cus[idx];
+
+		if (iter->filter != NULL)
+			cu = iter->filter(cu);
+
+		if (cu != NULL) {
+			if (iter->output != NULL) {
+				fp = open_memstream(&output.buf, &output.size);
+				if (fp == NULL) {
+					pthread_mutex_lock(&iter->mutex);
+					iter->error = -ENOMEM;
+					pthread_mutex_unlock(&iter->mutex);
+					break;
+				}
+			}
+
+			ret = iter->iterator(cu, thread->cookie, fp);
+
+			if (fp != NULL)
+				fclose(fp);
+		}
+
+		pthread_mutex_lock(&iter->mutex);
+		/* Like in cus__for_each_cu(), stop after this one */
+		if (ret && idx + 1 < iter->stop_at)
+			iter->stop_at = idx + 1;
+		iter->outputs[idx].buf  = output.buf;
+		iter->outputs[idx].size = output.size;
+		if (iter->output != NULL)
+			cus_parallel_iter__output(iter, idx);
+		pthread_mutex_unlock(&iter->mutex);
+	}
+
+	return NULL;
+}
+
+/** cus__for_each_cu_parallel - cus__for_each_cu() using nr_jobs threads
+ * @iterator - called for each CU, concurrently from several threads
+ * @cookies - nr_jobs entries, one per thread, so that they can accumulate
+ *	      results without locking and have them merged at the end, can be NULL
+ * @output - if not NULL, @iterator gets a per CU FILE to print to that will be
+ *	     written to @output when the CU is done
+ * @ordered - write the per CU outputs in the same order as cus__for_each_cu()
+ *
+ * If @iterator returns non zero no more CUs will be handed to the threads
+ * and, as in cus__for_each_cu(), the output of CUs after it is discarded.
+ */
+int cus__for_each_cu_parallel(struct cus *cus,
+			      int (*iterator)(struct cu *cu, void *cookie, FILE *fp),
+			      void *cookies[], int nr_jobs,
+			      struct cu *(*filter)(struct cu *cu),
+			      FILE *output, bool ordered)
+{
+	struct cus_parallel_iter iter = {
+		.iterator = iterator,
+		.filter	  = filter,
+		.output	  = output,
+		.ordered  = ordered,
+	};
+	struct cu *pos;
+	int i, err = 0;
+
+	if (nr_jobs < 1)
+		nr_jobs = 1;
+
+	pthread_t threads[nr_jobs];
+	struct cus_parallel_thread thread_args[nr_jobs];
+
+	cus__lock(cus);
+
+	if (cus->nr_entries == 0)
+		goto out_unlock;
+
+	iter.cus = malloc(cus->nr_entries * sizeof(struct cu *));
+	iter.outputs = zalloc(cus->nr_entries * sizeof(struct cus_parallel_output));
+	if (iter.cus == NULL || iter.outputs == NULL) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+
+	list_for_each_entry(pos, &cus->cus, node)
+		iter.cus[iter.nr_cus++] = pos;
+
+	iter.stop_at = iter.nr_cus;
+	pthread_mutex_init(&iter.mutex, NULL);
+
+	for (i = 0; i < nr_jobs; ++i) {
+		thread_args[i].iter   = &iter;
+		thread_args[i].cookie = cookies ? cookies[i] : NULL;
+	}
+
+	if (nr_jobs == 1) {
+		cus_parallel_thread__run(&thread_args[0]);
+	} else {
+		for (i = 0; i < nr_jobs; ++i) {
+			if (pthread_create(&threads[i], NULL, cus_parallel_thread__run, &thread_args[i]) != 0)
+				break;
+		}
+
+		/* Couldn't create any thread? Do it all in this one then */
+		if (i == 0)
+			cus_parallel_thread__run(&thread_args[0]);
+
+		while (--i >= 0)
+			pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&iter.mutex);
+	err = iter.error;
+
+	/* The ones after an iterator asked to stop */
+	for (i = 0; i < (int)iter.nr_cus; ++i)
+		free(iter.outputs[i].buf);
+out_unlock:
+	cus__unlock(cus);
+	free(iter.cus);
+	free(iter.outputs);
+	return err;
+}
+
 int cus__load_dir(struct cus *cus, struct conf_load *conf,
 		  const char *dirname, const char *filename_mask,
 		  const int recursive)
@@ -2412,6 +2647,7 @@ struct cus *cus__new(void)
 
 	if (cus != NULL) {
 		cus->nr_entries  = 0;
+		cus->nr_cus_seq  = 0;
 		cus->priv	 = NULL;
 		cus->loader_exit = NULL;
 		INIT_LIST_HEAD(&cus->cus);
@@ -2443,6 +2679,45 @@ void cus__delete(struct cus *cus)
 	free(cus);
 }
 
+/*
+ * Full teardown is only interesting when looking for leaks, i.e. when built
+ * with DEBUG_CHECK_LEAKS, with AddressSanitizer or when running under
+ * valgrind, that injects its vgpreload_*.so helpers via LD_PRELOAD.
+ */
+#if defined(DEBUG_CHECK_LEAKS) || defined(__SANITIZE_ADDRESS__)
+#define CUS__FULL_TEARDOWN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define CUS__FULL_TEARDOWN 1
+#endif
+#endif
+
+static bool cus__needs_full_teardown(void)
+{
+#ifdef CUS__FULL_TEARDOWN
+	return true;
+#else
+	const char *preload = getenv("LD_PRELOAD");
+
+	return preload != NULL && strstr(preload, "vgpreload") != NULL;
+#endif
+}
+
+/**
+ * cus__delete_at_exit - release a cus instance when the process is exiting
+ * @cus: the cus instance, may be NULL
+ *
+ * Freeing every tag of every CU in a big binary such as vmlinux takes a
+ * noticeable amount of time that is of no use when the process is about to
+ * exit, the kernel reclaims it all at once, so skip it, unless some leak
+ * checker is watching, in which case do a full cus__delete().
+ */
+void cus__delete_at_exit(struct cus *cus)
+{
+	if (cus__needs_full_teardown())
+		cus__delete(cus);
+}
+
 void cus__set_priv(struct cus *cus, void *priv)
 {
 	cus->priv = priv;
@@ -131,6 +131,7 @@ struct cus;
 
 struct cus *cus__new(void);
 void cus__delete(struct cus *cus);
+void cus__delete_at_exit(struct cus *cus);
 
 int cus__load_file(struct cus *cus, struct conf_load *conf,
 		   const char *filename);
@@ -158,8 +159,14 @@ struct function *cus__find_function_at_addr(struct cus *cus, uint64_t addr, stru
 void cus__for_each_cu(struct cus *cus, int (*iterator)(struct cu *cu, void *cookie),
 		      void *cookie,
 		      struct cu *(*filter)(struct cu *cu));
+int cus__for_each_cu_parallel(struct cus *cus,
+			      int (*iterator)(struct cu *cu, void *cookie, FILE *fp),
+			      void *cookies[], int nr_jobs,
+			      struct cu *(*filter)(struct cu *cu),
+			      FILE *output, bool ordered);
 bool cus__empty(const struct cus *cus);
 uint32_t cus__nr_entries(const struct cus *cus);
+uint32_t cus__new_cu_seq(struct cus *cus);
 
 void cus__lock(struct cus *cus);
 void cus__unlock(struct cus *cus);
@@ -244,6 +251,7 @@ struct cu {
 	Dwfl_Module	 *dwfl;
 	struct obstack	 obstack;
 	uint32_t	 cached_symtab_nr_entries;
+	uint32_t	 seq;		/* Order in the files being loaded */
 	bool		 use_obstack;
 	uint8_t		 addr_size;
 	uint8_t		 extra_dbg_info:1;
@@ -407,6 +415,8 @@ int cu__for_all_tags(struct cu *cu,
 /** struct tag - basic representation of a debug info element
  * @priv - extra data, for instance, DWARF offset, id, decl_{file,line}
  * @top_level -
+ * @size_cached - @cached_size is valid, see tag__size(), set with release semantics
+ * @cached_size - tag__size() for tags that need to follow ->type to find it
  */
 struct tag {
 	struct list_head node;
@@ -415,7 +425,9 @@ struct tag {
 	bool		 visited;
 	bool		 top_level;
 	bool		 has_btf_type_tag;
+	bool		 size_cached;
 	uint16_t	 recursivity_level;
+	uint32_t	 cached_size;
 	void		 *priv;
 };
 
@@ -577,6 +589,13 @@ void tag__not_found_die(const char *file, int line, const char *func);
 					  __LINE__, __func__); } while (0)
 
 size_t tag__size(const struct tag *tag, const struct cu *cu);
+
+static inline void tag__invalidate_size(struct tag *tag)
+{
+	tag->size_cached = false;
+}
+
+void cu__invalidate_tag_sizes(struct cu *cu);
 size_t tag__nr_cachelines(const struct conf_fprintf *conf, const struct tag *tag, const struct cu *cu);
 struct tag *tag__follow_typedef(const struct tag *tag, const struct cu *cu);
 struct tag *tag__strip_typedefs_and_modifiers(const struct tag *tag, const struct cu *cu);
@@ -687,10 +706,23 @@ struct ip_tag {
 	uint64_t   addr;
 };
 
+struct inline_expansion_range {
+	uint64_t start;
+	uint64_t end;
+};
+
+/*
+ * @ip.addr - where the first of its address ranges starts
+ * @size - the sum of the sizes of its address ranges
+ * @ranges - when it is in more than one address range, i.e. DW_AT_ranges,
+ *	     all @nr_ranges of them, in the order they are in the DWARF
+ */
 struct inline_expansion {
-	struct ip_tag	 ip;
-	size_t		 size;
-	uint64_t	 high_pc;
+	struct ip_tag		      ip;
+	size_t			      size;
+	uint64_t		      high_pc;
+	uint32_t		      nr_ranges;
+	struct inline_expansion_range *ranges;
 };
 
 static inline struct inline_expansion *
@@ -997,6 +1029,7 @@ int tag__is_base_type(const struct tag *tag, const struct cu *cu);
 bool tag__is_array(const struct tag *tag, const struct cu *cu);
 
 struct class_member_filter;
+struct type_decode_plan;
 
 struct tag_cu_node {
 	struct list_head node;
@@ -1030,6 +1063,7 @@ struct type {
 	struct class_member *sizeof_member;
 	struct class_member *type_member;
 	struct class_member_filter *filter;
+	struct type_decode_plan *decode_plan;
 	struct list_head type_enum;
 	char 		 *member_prefix;
 	uint16_t	 member_prefix_len;
@@ -1229,6 +1263,18 @@ static inline int class__is_struct(const struct class *cls)
 }
 
 void class__find_holes(struct class *cls);
+
+/**
+ * class__invalidate_holes - make the next class__find_holes() redo the work
+ * @cls - class instance whose layout was changed, e.g. by class__reorganize()
+ *
+ * The hole analysis is done on demand and then cached in @cls.
+ */
+static inline void class__invalidate_holes(struct class *cls)
+{
+	cls->holes_searched = false;
+}
+
 int class__has_hole_ge(const struct class *cls, const uint16_t size);
 
 bool class__infer_packed_attributes(struct class *cls, const struct cu *cu);
@@ -148,6 +148,15 @@ static struct conf_fprintf conf_fprintf__defaults = {
 
 const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
 
+// fprintf(fp, "%.*s", indent, tabs)
+static size_t fprintf__tabs(FILE *fp, int indent)
+{
+	if (indent < 0 || indent >= (int)sizeof(tabs))
+		indent = sizeof(tabs) - 1;
+
+	return fwrite(tabs, 1, indent, fp);
+}
+
 
 size_t tag__nr_cachelines(const struct conf_fprintf *conf, const struct tag *tag, const struct cu *cu)
 {
@@ -241,7 +250,7 @@ static size_t array_type__fprintf(const struct tag *tag,
 			if (at->nr_entries[i] != 0 || !conf->last_member || single_member || conf->union_member)
 				printed += fprintf(fp, "[%u]", at->nr_entries[i]);
 			else
-				printed += fprintf(fp, "[]");
+				printed += fprintf__string(fp, "[]");
 		}
 	}
 
@@ -258,7 +267,7 @@ static size_t array_type__fprintf(const struct tag *tag,
 		if (flat_dimensions != 0 || !conf->last_member || single_member || conf->union_member)
 			printed += fprintf(fp, "[%llu]", flat_dimensions);
 		else
-			printed += fprintf(fp, "[]");
+			printed += fprintf__string(fp, "[]");
 	}
 
 	return printed;
@@ -293,21 +302,21 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 
 	tag_type = cu__type(cu, tag->type);
 	if (tag_type == NULL) {
-		printed = fprintf(fp, "typedef ");
+		printed = fprintf__string(fp, "typedef ");
 		printed += tag__id_not_found_fprintf(fp, tag->type);
 		return printed + fprintf(fp, " %s", type__name(type));
 	}
 
 	switch (tag_type->tag) {
 	case DW_TAG_array_type:
-		printed = fprintf(fp, "typedef ");
+		printed = fprintf__string(fp, "typedef ");
 		return printed + array_type__fprintf(tag_type, cu, type__name(type), pconf, fp);
 	case DW_TAG_pointer_type:
 		if (tag_type->type == 0) /* void pointer */
 			break;
 		ptr_type = cu__type(cu, tag_type->type);
 		if (ptr_type == NULL) {
-			printed = fprintf(fp, "typedef ");
+			printed = fprintf__string(fp, "typedef ");
 			printed += tag__id_not_found_fprintf(fp, tag_type->type);
 			return printed + fprintf(fp, " *%s", type__name(type));
 		}
@@ -317,7 +326,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		is_pointer = 1;
 		/* Fall thru */
 	case DW_TAG_subroutine_type:
-		printed = fprintf(fp, "typedef ");
+		printed = fprintf__string(fp, "typedef ");
 		return printed + ftype__fprintf(tag__ftype(tag_type), cu, type__name(type),
 						0, is_pointer, 0, true, pconf, fp);
 	case DW_TAG_class_type:
@@ -330,7 +339,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		struct conf_fprintf tconf = *pconf;
 
 		tconf.suffix = type__name(type);
-		return fprintf(fp, "typedef ") + __class__fprintf(tag__class(tag_type), cu, &tconf, fp);
+		return fprintf__string(fp, "typedef ") + __class__fprintf(tag__class(tag_type), cu, &tconf, fp);
 	}
 	case DW_TAG_enumeration_type: {
 		struct type *ctype = tag__type(tag_type);
@@ -341,7 +350,7 @@ size_t typedef__fprintf(const struct tag *tag, const struct cu *cu,
 		struct conf_fprintf tconf = *pconf;
 
 		tconf.suffix = type__name(type);
-		return fprintf(fp, "typedef ") + enumeration__fprintf(tag_type, &tconf, fp);
+		return fprintf__string(fp, "typedef ") + enumeration__fprintf(tag_type, &tconf, fp);
 	}
 	}
 
@@ -353,7 +362,7 @@ static size_t imported_declaration__fprintf(const struct tag *tag,
 					    const struct cu *cu, FILE *fp)
 {
 	char bf[BUFSIZ];
-	size_t printed = fprintf(fp, "using ::");
+	size_t printed = fprintf__string(fp, "using ::");
 	const struct tag *decl = cu__function(cu, tag->type);
 
 	if (decl == NULL) {
@@ -409,7 +418,7 @@ size_t enumeration__fprintf(const struct tag *tag, const struct conf_fprintf *co
 		printed += fprintf(fp, "%.*s\t%-*s = ", indent, tabs,
 				   max_entry_name_len, enumerator__name(pos));
 		printed += fprintf(fp, conf->hex_fmt ?  "%#x" : "%u", pos->value);
-		printed += fprintf(fp, ",\n");
+		printed += fprintf__string(fp, ",\n");
 	}
 
 	printed += fprintf(fp, "%.*s}", indent, tabs);
@@ -628,7 +637,7 @@ static size_t type__fprintf_stats(struct type *type, const struct cu *cu,
 	if (type->nr_static_members != 0)
 		printed += fprintf(fp, ", static members: %u */\n", type->nr_static_members);
 	else
-		printed += fprintf(fp, " */\n");
+		printed += fprintf__string(fp, " */\n");
 
 	return printed;
 }
@@ -716,7 +725,7 @@ static size_t type__fprintf(struct tag *type, const struct cu *cu,
 			type = type_type;
 		}
 		if (typedef_expanded)
-			printed += fprintf(fp, " */ ");
+			printed += fprintf__string(fp, " */ ");
 	}
 
 	tconf = *conf;
@@ -763,9 +772,10 @@ next_type:
 		/* Fall Thru */
 	default:
 print_default:
-		printed += fprintf(fp, "%-*s %s", tconf.type_spacing,
-				   tag__name(type, cu, tbf, sizeof(tbf), &tconf),
-				   name);
+		printed += fprintf__left_aligned(fp, tag__name(type, cu, tbf, sizeof(tbf), &tconf),
+						 tconf.type_spacing);
+		fputc(' ', fp);
+		printed += 1 + fprintf__string(fp, name);
 		break;
 	case DW_TAG_subroutine_type:
 		printed += ftype__fprintf(tag__ftype(type), cu, name, 0, 0,
@@ -795,11 +805,11 @@ print_default:
 		ctype = tag__type(type);
 
 		if (type__name(ctype) != NULL && !expand_types) {
-			printed += fprintf(fp, "%s %-*s %s",
-					   (type->tag == DW_TAG_class_type &&
-					    !tconf.classes_as_structs) ? "class" : "struct",
-					   tconf.type_spacing - 7,
-					   type__name(ctype), name ?: "");
+			printed += fprintf__string(fp, (type->tag == DW_TAG_class_type &&
+							!tconf.classes_as_structs) ? "class " : "struct ");
+			printed += fprintf__left_aligned(fp, type__name(ctype), tconf.type_spacing - 7);
+			fputc(' ', fp);
+			printed += 1 + fprintf__string(fp, name ?: "");
 		} else {
 			struct class *cclass = tag__class(type);
 
@@ -814,7 +824,10 @@ print_default:
 		ctype = tag__type(type);
 
 		if (type__name(ctype) != NULL && !expand_types) {
-			printed += fprintf(fp, "union %-*s %s", tconf.type_spacing - 6, type__name(ctype), name ?: "");
+			printed += fprintf__string(fp, "union ");
+			printed += fprintf__left_aligned(fp, type__name(ctype), tconf.type_spacing - 6);
+			fputc(' ', fp);
+			printed += 1 + fprintf__string(fp, name ?: "");
 		} else {
 			tconf.type_spacing -= 8;
 			printed += union__fprintf(ctype, cu, &tconf, fp);
@@ -823,9 +836,12 @@ print_default:
 	case DW_TAG_enumeration_type:
 		ctype = tag__type(type);
 
-		if (type__name(ctype) != NULL)
-			printed += fprintf(fp, "enum %-*s %s", tconf.type_spacing - 5, type__name(ctype), name ?: "");
-		else
+		if (type__name(ctype) != NULL) {
+			printed += fprintf__string(fp, "enum ");
+			printed += fprintf__left_aligned(fp, type__name(ctype), tconf.type_spacing - 5);
+			fputc(' ', fp);
+			printed += 1 + fprintf__string(fp, name ?: "");
+		} else
 			printed += enumeration__fprintf(type, &tconf, fp);
 		break;
 	}
@@ -844,11 +860,56 @@ static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
 						uint32_t offset,
 						FILE *fp);
 
+/*
+ * The offset and size comment is printed for most lines in pahole's output, so
+ * avoid parsing formats for it when not using --hex.
+ */
+static size_t class_member__fprintf_offset_comment(struct class_member *member, uint32_t offset,
+						   int spacing, bool hex_fmt, FILE *fp)
+{
+	const unsigned int size = member->byte_size;
+	unsigned int bitfield_offset = member->bitfield_offset;
+	int size_spacing = 5;
+	size_t printed;
+
+	if (member->bitfield_offset < 0)
+		bitfield_offset = member->byte_size * 8 + member->bitfield_offset;
+
+	if (hex_fmt) {
+		printed = fprintf(fp, "%*s/* %#5x", spacing, " ", offset);
+
+		if (member->bitfield_size != 0) {
+			printed += fprintf(fp, ":%#2x", bitfield_offset);
+			size_spacing -= 3;
+		}
+
+		return printed + fprintf(fp, " %#*x */", size_spacing, size);
+	}
+
+	// "%*s" for " " prints at least one space, left aligned if spacing < 0
+	if (spacing < 0)
+		spacing = -spacing;
+
+	printed  = fprintf__spaces(fp, spacing > 1 ? spacing : 1);
+	printed += fprintf__string(fp, "/* ");
+	printed += fprintf__u64(fp, offset, 5);
+
+	if (member->bitfield_size != 0) {
+		fputc(':', fp);
+		printed += 1 + fprintf__u64(fp, bitfield_offset, 2);
+		size_spacing -= 3;
+	}
+
+	fputc(' ', fp);
+	printed += 1 + fprintf__u64(fp, size, size_spacing);
+
+	return printed + fprintf__string(fp, " */");
+}
+
 static size_t class_member__fprintf(struct class_member *member, bool union_member,
 				     struct tag *type, const struct cu *cu,
 				     struct conf_fprintf *conf, FILE *fp)
 {
-	const int size = member->byte_size;
 	int member_alignment_printed = 0;
 	struct conf_fprintf sconf = *conf;
 	uint32_t offset = member->byte_offset;
@@ -870,11 +931,11 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 
 	if (member->tag.tag == DW_TAG_inheritance) {
 		name = "<ancestor>";
-		printed += fprintf(fp, "/* ");
+		printed += fprintf__string(fp, "/* ");
 	}
 
 	if (member->is_static)
-		printed += fprintf(fp, "static ");
+		printed += fprintf__string(fp, "static ");
 
 	/* For struct-like constructs, the name of the member cannot be
 	 * conflated with the name of its type, otherwise __attribute__ are
@@ -885,8 +946,8 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 		printed += type__fprintf(type, cu, NULL, &sconf, fp);
 		if (name) {
 			if (!type__name(tag__type(type)))
-				printed += fprintf(fp, " ");
-			printed += fprintf(fp, "%s", name);
+				printed += fprintf__string(fp, " ");
+			printed += fprintf__string(fp, name);
 		}
 	} else {
 		printed += type__fprintf(type, cu, name, &sconf, fp);
@@ -914,64 +975,28 @@ static size_t class_member__fprintf(struct class_member *member, bool union_memb
 		if (!sconf.suppress_offset_comment) {
 			/* Check if this is a anonymous union */
 			int slen = member_alignment_printed + (cm_name ? (int)strlen(cm_name) : -1);
-			int size_spacing = 5;
 
 			if (tag__is_struct(type) && tag__class(type)->is_packed && !conf->suppress_packed) {
 				int packed_len = sizeof("__attribute__((__packed__))");
 				slen += packed_len;
 			}
 
-			printed += fprintf(fp, sconf.hex_fmt ?
-							"%*s/* %#5x" :
-							"%*s/* %5u",
-					   (sconf.type_spacing +
-					    sconf.name_spacing - slen - 3),
-					   " ", offset);
-
-			if (member->bitfield_size != 0) {
-				unsigned int bitfield_offset = member->bitfield_offset;
-
-				if (member->bitfield_offset < 0)
-					bitfield_offset = member->byte_size * 8 + member->bitfield_offset;
-
-				printed += fprintf(fp, sconf.hex_fmt ?  ":%#2x" : ":%2u", bitfield_offset);
-				size_spacing -= 3;
-			}
-
-			printed += fprintf(fp, sconf.hex_fmt ?  " %#*x */" : " %*u */", size_spacing, size);
+			printed += class_member__fprintf_offset_comment(member, offset,
+									(sconf.type_spacing +
+									 sconf.name_spacing - slen - 3),
+									sconf.hex_fmt, fp);
 		}
 	} else {
 		int spacing = sconf.type_spacing + sconf.name_spacing - printed;
 
 		if (member->tag.tag == DW_TAG_inheritance) {
-			const size_t p = fprintf(fp, " */");
+			const size_t p = fprintf__string(fp, " */");
 			printed += p;
 			spacing -= p;
 		}
-		if (!sconf.suppress_offset_comment) {
-			int size_spacing = 5;
-
-			printed += fprintf(fp, sconf.hex_fmt ?
-						"%*s/* %#5x" : "%*s/* %5u",
-					   spacing > 0 ? spacing : 0, " ",
-					   offset);
-
-			if (member->bitfield_size != 0) {
-				unsigned int bitfield_offset = member->bitfield_offset;
-
-				if (member->bitfield_offset < 0)
-					bitfield_offset = member->byte_size * 8 + member->bitfield_offset;
-
-				printed += fprintf(fp, sconf.hex_fmt ?
-							":%#2x" : ":%2u",
-						   bitfield_offset);
-				size_spacing -= 3;
-			}
-
-			printed += fprintf(fp, sconf.hex_fmt ?
-						" %#*x */" : " %*u */",
-					   size_spacing, size);
-		}
+		if (!sconf.suppress_offset_comment)
+			printed += class_member__fprintf_offset_comment(member, offset, spacing > 0 ? spacing : 0,
+									sconf.hex_fmt, fp);
 	}
 	return printed + printed_cacheline;
 }
@@ -1039,13 +1064,13 @@ static size_t union__fprintf(struct type *type, const struct cu *cu,
 		struct tag *pos_type = cu__type(cu, pos->tag.type);
 
 		if (pos_type == NULL) {
-			printed += fprintf(fp, "%.*s", uconf.indent, tabs);
+			printed += fprintf__tabs(fp, uconf.indent);
 			printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 			continue;
 		}
 
 		uconf.union_member = 1;
-		printed += fprintf(fp, "%.*s", uconf.indent, tabs);
+		printed += fprintf__tabs(fp, uconf.indent);
 		printed += union_member__fprintf(pos, pos_type, cu, &uconf, fp);
 		fputc('\n', fp);
 		++printed;
@@ -1080,12 +1105,12 @@ size_t ftype__fprintf_parms(const struct ftype *ftype,
 	char sbf[128];
 	struct tag *type;
 	const char *name, *stype;
-	size_t printed = fprintf(fp, "(");
+	size_t printed = fprintf__string(fp, "(");
 
 	ftype__for_each_parameter(ftype, pos) {
 		if (!first_parm) {
 			if (indent == 0)
-				printed += fprintf(fp, ", ");
+				printed += fprintf__string(fp, ", ");
 			else
 				printed += fprintf(fp, ",\n%.*s",
 						   indent, tabs);
@@ -1132,11 +1157,11 @@ print_it:
 
 	/* No parameters? */
 	if (first_parm)
-		printed += fprintf(fp, "void)");
+		printed += fprintf__string(fp, "void)");
 	else if (ftype->unspec_parms)
-		printed += fprintf(fp, ", ...)");
+		printed += fprintf__string(fp, ", ...)");
 	else
-		printed += fprintf(fp, ")");
+		printed += fprintf__string(fp, ")");
 	return printed;
 }
 
@@ -1164,9 +1189,9 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 			printed += tag__id_not_found_fprintf(fp, exp->ip.tag.type);
 			break;
 		}
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf__tabs(fp, indent);
 		name = function__name(alias);
-		n = fprintf(fp, "%s", name);
+		n = fprintf__string(fp, name);
 		size_t namelen = 0;
 		if (name != NULL)
 			namelen = strlen(name);
@@ -1185,7 +1210,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 	}
 		break;
 	case DW_TAG_variable:
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf__tabs(fp, indent);
 		n = fprintf(fp, "%s %s; /* scope: %s */",
 			    variable__type_name(vtag, cu, bf, sizeof(bf)),
 			    variable__name(vtag),
@@ -1195,7 +1220,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 		break;
 	case DW_TAG_label: {
 		const struct label *label = vtag;
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf__tabs(fp, indent);
 		fputc('\n', fp);
 		++printed;
 		c = fprintf(fp, "%s:", label__name(label));
@@ -1208,7 +1233,7 @@ static size_t function__tag_fprintf(const struct tag *tag, const struct cu *cu,
 		fputc('\n', fp);
 		return printed + 1;
 	default:
-		printed = fprintf(fp, "%.*s", indent, tabs);
+		printed = fprintf__tabs(fp, indent);
 		n = fprintf(fp, "%s <%llx>", dwarf_tag_name(tag->tag),
 			    tag__orig_id(tag, cu));
 		c += n;
@@ -1240,7 +1265,7 @@ size_t lexblock__fprintf(const struct lexblock *block, const struct cu *cu,
 					   function__name(function),
 					   (unsigned long long)offset);
 	}
-	printed += fprintf(fp, "\n");
+	printed += fprintf__string(fp, "\n");
 	list_for_each_entry(pos, &block->tags, node)
 		printed += function__tag_fprintf(pos, cu, function, indent + 1,
 						 conf, fp);
@@ -1280,13 +1305,13 @@ static size_t function__fprintf(const struct tag *tag, const struct cu *cu,
 
 	if (func->virtuality == DW_VIRTUALITY_virtual ||
 	    func->virtuality == DW_VIRTUALITY_pure_virtual)
-		printed += fprintf(fp, "virtual ");
+		printed += fprintf__string(fp, "virtual ");
 
 	printed += ftype__fprintf(ftype, cu, function__name(func),
 				  inlined, 0, 0, false, conf, fp);
 
 	if (func->virtuality == DW_VIRTUALITY_pure_virtual)
-		printed += fprintf(fp, " = 0");
+		printed += fprintf__string(fp, " = 0");
 
 	return printed;
 }
@@ -1308,7 +1333,7 @@ size_t function__fprintf_stats(const struct tag *tag, const struct cu *cu,
 		printed += fprintf(fp, ", inline expansions: %u (%d bytes)",
 			func->lexblock.nr_inline_expansions,
 			func->lexblock.size_inline_expansions);
-	return printed + fprintf(fp, " */\n");
+	return printed + fprintf__string(fp, " */\n");
 }
 
 static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
@@ -1333,7 +1358,7 @@ static size_t class__fprintf_cacheline_boundary(struct conf_fprintf *conf,
 					   "*/\n", cacheline,
 					   cacheline_in_bytes, cacheline_pos);
 
-		printed += fprintf(fp, "%.*s", indent, tabs);
+		printed += fprintf__tabs(fp, indent);
 
 		*conf->cachelinep = cacheline;
 	}
@@ -1403,6 +1428,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 	cconf.indent = indent + 1;
 	cconf.no_semicolon = 0;
 
+	class__find_holes(class);
 	class__infer_packed_attributes(class, cu);
 
 	/* First look if we have DW_TAG_inheritance */
@@ -1413,15 +1439,15 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			continue;
 
 		if (first) {
-			printed += fprintf(fp, " :");
+			printed += fprintf__string(fp, " :");
 			first = 0;
 		} else
-			printed += fprintf(fp, ",");
+			printed += fprintf__string(fp, ",");
 
 		pos = tag__class_member(tag_pos);
 
 		if (pos->virtuality == DW_VIRTUALITY_virtual)
-			printed += fprintf(fp, " virtual");
+			printed += fprintf__string(fp, " virtual");
 
 		accessibility = tag__accessibility(tag_pos);
 		if (accessibility != NULL)
@@ -1435,7 +1461,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			printed += tag__id_not_found_fprintf(fp, tag_pos->type);
 	}
 
-	printed += fprintf(fp, " {\n");
+	printed += fprintf__string(fp, " {\n");
 
 	if (class->pre_bit_hole > 0 && !cconf.suppress_comments) {
 		if (!newline++) {
@@ -1476,7 +1502,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 		    tag_pos->tag != DW_TAG_inheritance) {
 			if (!cconf.show_only_data_members) {
 				printed += tag__fprintf(tag_pos, cu, &cconf, fp);
-				printed += fprintf(fp, "\n\n");
+				printed += fprintf__string(fp, "\n\n");
 			}
 			continue;
 		}
@@ -1507,7 +1533,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 				struct tag *pos_type = cu__type(cu, pos->tag.type);
 
 				if (pos_type == NULL) {
-					printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+					printed += fprintf__tabs(fp, cconf.indent);
 					printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 					continue;
 				}
@@ -1520,7 +1546,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 					bitfield_size = 0;
 				}
 
-				printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+				printed += fprintf__tabs(fp, cconf.indent);
 				printed += type__fprintf(pos_type, cu, "", &cconf, fp);
 				printed += fprintf(fp, ":%u;\n", bitfield_size);
 			}
@@ -1570,7 +1596,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 
 		struct tag *pos_type = cu__type(cu, pos->tag.type);
 		if (pos_type == NULL) {
-			printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+			printed += fprintf__tabs(fp, cconf.indent);
 			printed += tag__id_not_found_fprintf(fp, pos->tag.type);
 			continue;
 		}
@@ -1579,7 +1605,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 		cconf.first_member = last == NULL;
 
 		size = pos->byte_size;
-		printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+		printed += fprintf__tabs(fp, cconf.indent);
 		printed += struct_member__fprintf(pos, pos_type, cu, &cconf, fp);
 
 		if (tag__is_struct(pos_type) && !cconf.suppress_comments) {
@@ -1703,7 +1729,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			printed += fprintf(fp, "\n%.*s/* Force padding: */\n", cconf.indent, tabs);
 
 			for (added_padding = 0; added_padding < class->padding; added_padding += size) {
-				printed += fprintf(fp, "%.*s", cconf.indent, tabs);
+				printed += fprintf__tabs(fp, cconf.indent);
 				printed += type__fprintf(tag_pos, cu, "", &cconf, fp);
 				printed += fprintf(fp, ":%u;\n", bit_size);
 			}
@@ -1725,7 +1751,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 			if (sum_holes > 0)
 				printed += fprintf(fp, ", holes: %d, sum holes: %u",
 						   class->nr_holes, sum_holes);
-			printed += fprintf(fp, " */\n");
+			printed += fprintf__string(fp, " */\n");
 		}
 		if (sum_bits > 0) {
 			printed += fprintf(fp, "%.*s/* sum bitfield members: %u bits",
@@ -1735,7 +1761,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 						   class->nr_bit_holes, sum_bit_holes);
 			else
 				printed += fprintf(fp, " (%u bytes)", sum_bits / 8);
-			printed += fprintf(fp, " */\n");
+			printed += fprintf__string(fp, " */\n");
 		}
 	}
 	if (class->padding > 0)
@@ -1760,7 +1786,7 @@ static size_t __class__fprintf(struct class *class, const struct cu *cu,
 					   nr_forced_alignment_holes,
 					   sum_forced_alignment_holes);
 		}
-		printed += fprintf(fp, " */\n");
+		printed += fprintf__string(fp, " */\n");
 	}
 	cacheline = (cconf.base_offset + type->size) % conf->cacheline_size;
 	if (cacheline != 0)
@@ -1789,7 +1815,7 @@ out:
 	printed += fprintf(fp, "%.*s}", indent, tabs);
 
 	if (class->is_packed && !cconf.suppress_packed)
-		printed += fprintf(fp, " __attribute__((__packed__))");
+		printed += fprintf__string(fp, " __attribute__((__packed__))");
 
 	if (cconf.suffix)
 		printed += fprintf(fp, " %s", cconf.suffix);
@@ -1808,7 +1834,13 @@ out:
 
 size_t class__fprintf(struct class *class, const struct cu *cu, FILE *fp)
 {
-	return __class__fprintf(class, cu, NULL, fp);
+	struct fprintf_buf *buf = fprintf_buf__get();
+
+	if (buf == NULL)
+		return __class__fprintf(class, cu, NULL, fp);
+
+	__class__fprintf(class, cu, NULL, buf->fp);
+	return fprintf_buf__flush(buf, fp);
 }
 
 static size_t variable__fprintf(const struct tag *tag, const struct cu *cu,
@@ -1824,7 +1856,7 @@ static size_t variable__fprintf(const struct tag *tag, const struct cu *cu,
 			const char *varprefix = variable__prefix(var);
 
 			if (varprefix != NULL)
-				printed += fprintf(fp, "%s", varprefix);
+				printed += fprintf__string(fp, varprefix);
 			printed += type__fprintf(type, cu, name, conf, fp);
 		}
 	}
@@ -1844,14 +1876,14 @@ static size_t namespace__fprintf(const struct tag *tag, const struct cu *cu,
 
 	namespace__for_each_tag(space, pos) {
 		printed += tag__fprintf(pos, cu, &cconf, fp);
-		printed += fprintf(fp, "\n\n");
+		printed += fprintf__string(fp, "\n\n");
 	}
 
-	return printed + fprintf(fp, "}");
+	return printed + fprintf__string(fp, "}");
 }
 
-size_t tag__fprintf(struct tag *tag, const struct cu *cu,
-		    const struct conf_fprintf *conf, FILE *fp)
+static size_t __tag__fprintf(struct tag *tag, const struct cu *cu,
+			     const struct conf_fprintf *conf, FILE *fp)
 {
 	size_t printed = 0;
 	struct conf_fprintf tconf;
@@ -1883,12 +1915,12 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 		++tag->recursivity_level;
 
 	if (pconf->show_decl_info) {
-		printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+		printed += fprintf__tabs(fp, pconf->indent);
 		printed += fprintf(fp, "/* Used at: %s */\n", cu->name);
-		printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+		printed += fprintf__tabs(fp, pconf->indent);
 		printed += tag__fprintf_decl_info(tag, cu, fp);
 	}
-	printed += fprintf(fp, "%.*s", pconf->indent, tabs);
+	printed += fprintf__tabs(fp, pconf->indent);
 
 	switch (tag->tag) {
 	case DW_TAG_array_type:
@@ -1950,6 +1982,23 @@ size_t tag__fprintf(struct tag *tag, const struct cu *cu,
 	return printed;
 }
 
+size_t tag__fprintf(struct tag *tag, const struct cu *cu,
+		    const struct conf_fprintf *conf, FILE *fp)
+{
+	/*
+	 * Print the whole tag to this thread's buffer, where the many calls to
+	 * stdio routines made to print it take no lock, then write it to fp
+	 * at once.
+	 */
+	struct fprintf_buf *buf = fprintf_buf__get();
+
+	if (buf == NULL)
+		return __tag__fprintf(tag, cu, conf, fp);
+
+	__tag__fprintf(tag, cu, conf, buf->fp);
+	return fprintf_buf__flush(buf, fp);
+}
+
 void cus__print_error_msg(const char *progname, const struct cus *cus,
 			  const char *filename, const int err)
 {
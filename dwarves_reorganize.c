@@ -7,13 +7,16 @@
   Copyright (C) 2007 Arnaldo Carvalho de Melo <acme@redhat.com>
 */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "list.h"
 #include "dwarves_reorganize.h"
 #include "dwarves.h"
 
 static void class__recalc_holes(struct class *class)
 {
-	class->holes_searched = 0;
+	class__invalidate_holes(class);
 	class__find_holes(class);
 }
 
@@ -846,3 +849,571 @@ restart:
 		}
 	}
 }
+
+/*
+ * Optimal reorganization: members, or runs of bitfield members, that have to
+ * stay together, are units with a size and an alignment, and the minimal
+ * size of a struct is the sum of the sizes of its units rounded up to the
+ * struct alignment. Sorting the units by alignment, biggest first, gets to
+ * that when the unit sizes are multiples of their alignments, the usual case,
+ * when it doesn't we search for it with a branch and bound over the
+ * distinct (alignment, size) unit classes.
+ */
+struct reorg_unit {
+	struct class_member *first;
+	struct class_member *last;
+	uint32_t	    offset;
+	uint32_t	    new_offset;
+	uint32_t	    size;
+	uint32_t	    alignment;
+	uint32_t	    index;
+	uint32_t	    unit_class;
+};
+
+struct reorg_unit_class {
+	uint32_t size;
+	uint32_t alignment;
+	uint32_t nr_units;
+};
+
+struct reorg_search {
+	struct reorg_unit_class *classes;
+	uint32_t		nr_classes;
+	uint32_t		nr_units;
+	uint32_t		alignment;
+	uint32_t		tail_alignment;
+	uint32_t		*path;
+	uint32_t		*best_path;
+	size_t			best_size;
+	unsigned long		nr_nodes;
+};
+
+/* Enough for all the structs in vmlinux that need searching, in a few ms each */
+#define REORG_SEARCH_MAX_NODES (1UL << 18)
+
+static uint32_t lowest_power_of_two_divisor(uint32_t offset)
+{
+	return offset & -offset;
+}
+
+static uint32_t class_member__reorg_alignment(struct class_member *member, const struct cu *cu)
+{
+	struct tag *type = tag__strip_typedefs_and_modifiers(&member->tag, cu);
+	uint32_t alignment = tag__natural_alignment(type, cu);
+
+	if (member->alignment > alignment)
+		alignment = member->alignment;
+
+	return alignment;
+}
+
+static int reorg_unit__cmp(const void *a, const void *b)
+{
+	const struct reorg_unit *ua = a, *ub = b;
+	const bool a_multiple = ua->size % ua->alignment == 0,
+		   b_multiple = ub->size % ub->alignment == 0;
+
+	if (ua->alignment != ub->alignment)
+		return ua->alignment < ub->alignment ? 1 : -1;
+	if (a_multiple != b_multiple)
+		return a_multiple ? -1 : 1;
+	if (ua->size != ub->size)
+		return ua->size < ub->size ? 1 : -1;
+	return ua->index < ub->index ? -1 : 1;
+}
+
+/*
+ * Splits the members in units, returns the number of units, zero if the
+ * layout can't be modeled, say because there are C++ things like inheritance
+ * or static members, zero sized markers or overlapping members, -1 if out of
+ * memory.
+ */
+static int class__reorg_units(struct class *class, const struct cu *cu, struct reorg_unit **punits)
+{
+	struct reorg_unit *units = malloc(class->type.nr_members * sizeof(*units)), *unit = NULL;
+	uint32_t nr_units = 0, prev_end = 0;
+	struct tag *tag;
+
+	if (units == NULL)
+		return -1;
+
+	type__for_each_tag(&class->type, tag) {
+		struct class_member *member = tag__class_member(tag);
+
+		if (tag->tag != DW_TAG_member || member->is_static)
+			goto out_unmodeled;
+
+		// Continues the bitfield run?
+		if (member->bitfield_size != 0 && unit != NULL && unit->last->bitfield_size != 0 &&
+		    &unit->last->tag.node == tag->node.prev) {
+			uint32_t alignment = class_member__reorg_alignment(member, cu);
+
+			if (member->byte_offset < unit->offset)
+				goto out_unmodeled;
+			if (member->byte_offset + member->byte_size > unit->offset + unit->size)
+				unit->size = member->byte_offset + member->byte_size - unit->offset;
+			if (alignment > unit->alignment)
+				unit->alignment = alignment;
+			if (unit->offset % unit->alignment != 0)
+				goto out_unmodeled;
+			unit->last = member;
+			prev_end = unit->offset + unit->size;
+			continue;
+		}
+
+		if (nr_units == class->type.nr_members || member->byte_offset < prev_end)
+			goto out_unmodeled;
+
+		unit = &units[nr_units];
+		unit->first	= unit->last = member;
+		unit->offset	= member->byte_offset;
+		unit->size	= member->byte_size;
+		unit->alignment = class_member__reorg_alignment(member, cu);
+		unit->index	= nr_units++;
+
+		if (member->bitfield_size != 0) {
+			if (unit->offset % unit->alignment != 0)
+				goto out_unmodeled;
+		} else if (unit->offset != 0 && unit->offset % unit->alignment != 0) {
+			// Say a __packed__ struct, take the alignment it has
+			unit->alignment = lowest_power_of_two_divisor(unit->offset);
+		} else if (unit->offset != 0 && unit->offset - prev_end >= unit->alignment) {
+			// It would be placed before if it had just its natural alignment
+			unit->alignment = lowest_power_of_two_divisor(unit->offset);
+		}
+
+		// Only a flexible array at the end can be zero sized
+		if (unit->size == 0 && !list_is_last(&tag->node, &class->type.namespace.tags))
+			goto out_unmodeled;
+
+		prev_end = unit->offset + unit->size;
+	}
+
+	*punits = units;
+	return nr_units;
+
+out_unmodeled:
+	free(units);
+	return 0;
+}
+
+static void reorg_search__visit(struct reorg_search *search, uint32_t depth, size_t offset, size_t remaining)
+{
+	uint32_t i;
+
+	if (++search->nr_nodes > REORG_SEARCH_MAX_NODES)
+		return;
+
+	if (depth == search->nr_units) {
+		size_t size = roundup(roundup(offset, search->tail_alignment), search->alignment);
+
+		if (size < search->best_size) {
+			search->best_size = size;
+			memcpy(search->best_path, search->path, depth * sizeof(*search->path));
+		}
+		return;
+	}
+
+	// Can't get any better than with no more holes
+	if (roundup(offset + remaining, search->alignment) >= search->best_size)
+		return;
+
+	for (i = 0; i < search->nr_classes; ++i) {
+		struct reorg_unit_class *unit_class = &search->classes[i];
+
+		if (unit_class->nr_units == 0)
+			continue;
+
+		--unit_class->nr_units;
+		search->path[depth] = i;
+		reorg_search__visit(search, depth + 1, roundup(offset, unit_class->alignment) + unit_class->size,
+				    remaining - unit_class->size);
+		++unit_class->nr_units;
+	}
+}
+
+/*
+ * Reorders @units, already sorted by alignment, in the best order found, if
+ * better than that, returning the resulting size.
+ */
+static size_t reorg_units__search(struct reorg_unit *units, uint32_t nr_units, uint32_t alignment,
+				  uint32_t tail_alignment, size_t size, size_t remaining)
+{
+	struct reorg_search search = {
+		.nr_units	= nr_units,
+		.alignment	= alignment,
+		.tail_alignment = tail_alignment,
+		.best_size	= size,
+	};
+	struct reorg_unit *sorted = NULL;
+	uint32_t i, j;
+
+	search.classes	 = malloc(nr_units * sizeof(*search.classes));
+	search.path	 = malloc(nr_units * sizeof(*search.path));
+	search.best_path = malloc(nr_units * sizeof(*search.best_path));
+	sorted		 = malloc(nr_units * sizeof(*sorted));
+	if (search.classes == NULL || search.path == NULL || search.best_path == NULL || sorted == NULL)
+		goto out_free;
+
+	// The units are sorted by alignment and size, so the ones in a class are together
+	for (i = 0; i < nr_units; ++i) {
+		if (i == 0 || units[i].size != units[i - 1].size || units[i].alignment != units[i - 1].alignment) {
+			search.classes[search.nr_classes].size	    = units[i].size;
+			search.classes[search.nr_classes].alignment = units[i].alignment;
+			search.classes[search.nr_classes].nr_units  = 0;
+			++search.nr_classes;
+		}
+		units[i].unit_class = search.nr_classes - 1;
+		++search.classes[search.nr_classes - 1].nr_units;
+	}
+
+	reorg_search__visit(&search, 0, 0, remaining);
+
+	if (search.best_size >= size)
+		goto out_free;
+
+	// Take the units in each class in the order they were
+	memcpy(sorted, units, nr_units * sizeof(*sorted));
+	for (i = 0; i < nr_units; ++i) {
+		for (j = 0; j < nr_units; ++j) {
+			if (sorted[j].first != NULL && sorted[j].unit_class == search.best_path[i]) {
+				units[i] = sorted[j];
+				sorted[j].first = NULL;
+				break;
+			}
+		}
+	}
+	size = search.best_size;
+out_free:
+	free(search.classes);
+	free(search.path);
+	free(search.best_path);
+	free(sorted);
+	return size;
+}
+
+/*
+ * Rebuilds the member list and offsets with the units, already sorted by
+ * their new offsets, at their new offsets.
+ */
+static void class__move_reorg_units(struct class *class, struct reorg_unit *units, uint32_t nr_units, size_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_units; ++i) {
+		struct reorg_unit *unit = &units[i];
+		struct class_member *member = unit->first, *next;
+		int32_t delta = unit->new_offset - unit->offset;
+
+		while (1) {
+			next = list_next_entry(member, tag.node);
+			member->byte_offset += delta;
+			member->bit_offset  += delta * 8;
+			list_move_tail(&member->tag.node, &class->type.namespace.tags);
+			if (member == unit->last)
+				break;
+			member = next;
+		}
+	}
+
+	class->type.size = size;
+	class__recalc_holes(class);
+}
+
+void class__reorganize_optimal(struct class *class, const struct cu *cu,
+			       const int verbose, FILE *fp)
+{
+	struct reorg_unit *units = NULL;
+	uint32_t alignment = class->type.alignment ?: 1, tail_alignment = 1;
+	size_t offset = 0, remaining = 0, min_size, size;
+	bool flexible_array = false;
+	int nr_units, i;
+
+	class__find_holes(class);
+
+	// Nothing to gain
+	if (class->nr_holes == 0 && class->nr_bit_holes == 0 && class->padding == 0)
+		return;
+
+	nr_units = class__reorg_units(class, cu, &units);
+	if (nr_units <= 0)
+		goto out_fallback;
+
+	// The flexible array stays at the end
+	if (units[nr_units - 1].size == 0) {
+		tail_alignment = units[--nr_units].alignment;
+		flexible_array = true;
+	}
+
+	for (i = 0; i < nr_units; ++i) {
+		remaining += units[i].size;
+		if (units[i].alignment > alignment)
+			alignment = units[i].alignment;
+	}
+	if (tail_alignment > alignment)
+		alignment = tail_alignment;
+
+	// Aligned differently than what we can infer, __packed__, etc
+	if (class__size(class) % alignment != 0)
+		goto out_fallback;
+
+	qsort(units, nr_units, sizeof(*units), reorg_unit__cmp);
+
+	for (i = 0; i < nr_units; ++i)
+		offset = roundup(offset, units[i].alignment) + units[i].size;
+	size = roundup(roundup(offset, tail_alignment), alignment);
+
+	min_size = roundup(remaining, alignment);
+	if (size > min_size)
+		size = reorg_units__search(units, nr_units, alignment, tail_alignment, size, remaining);
+
+	if (size >= class__size(class)) {
+		free(units);
+		return;
+	}
+
+	if (verbose)
+		fprintf(fp, "/* Sorting members by alignment, %s size: %zd bytes */\n",
+			size == min_size ? "minimal" : "best found", size);
+
+	// The flexible array, if any, stays last
+	if (flexible_array)
+		++nr_units;
+
+	offset = 0;
+	for (i = 0; i < nr_units; ++i) {
+		units[i].new_offset = roundup(offset, units[i].alignment);
+		offset = units[i].new_offset + units[i].size;
+	}
+
+	class__move_reorg_units(class, units, nr_units, size);
+
+	if (verbose > 1) {
+		class__fprintf(class, cu, fp);
+		fputc('\n', fp);
+	}
+
+	free(units);
+	return;
+
+out_fallback:
+	free(units);
+	class__reorganize(class, cu, verbose, fp);
+}
+
+/*
+ * Reorganization guided by how often each member is accessed: the units
+ * written to are put first, then, starting in the next cacheline, so that
+ * writes don't invalidate the cacheline with the ones mostly read, the other
+ * units that are accessed, hottest first, and then the cold ones, that are
+ * also used to fill the holes left, including the one separating the written
+ * to and the mostly read units.
+ */
+struct reorg_gap {
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct reorg_placement {
+	struct reorg_gap *gaps;
+	uint32_t	 nr_gaps;
+	size_t		 end;
+};
+
+static void reorg_placement__add_gap(struct reorg_placement *placement, uint32_t idx, uint32_t offset, uint32_t size)
+{
+	if (size == 0)
+		return;
+
+	memmove(&placement->gaps[idx + 1], &placement->gaps[idx],
+		(placement->nr_gaps - idx) * sizeof(*placement->gaps));
+	placement->gaps[idx].offset = offset;
+	placement->gaps[idx].size   = size;
+	++placement->nr_gaps;
+}
+
+/* Places @unit in the first hole after @min_offset where it fits, at the end if none */
+static void reorg_placement__place(struct reorg_placement *placement, struct reorg_unit *unit, uint32_t min_offset)
+{
+	uint32_t i;
+
+	for (i = 0; i < placement->nr_gaps; ++i) {
+		struct reorg_gap gap = placement->gaps[i];
+		uint32_t offset = roundup(gap.offset > min_offset ? gap.offset : min_offset, unit->alignment);
+
+		if (offset + unit->size > gap.offset + gap.size)
+			continue;
+
+		unit->new_offset = offset;
+		// Replace the gap with what is left before and after the unit
+		memmove(&placement->gaps[i], &placement->gaps[i + 1],
+			(placement->nr_gaps - i - 1) * sizeof(*placement->gaps));
+		--placement->nr_gaps;
+		reorg_placement__add_gap(placement, i, offset + unit->size, gap.offset + gap.size - offset - unit->size);
+		reorg_placement__add_gap(placement, i, gap.offset, offset - gap.offset);
+		return;
+	}
+
+	unit->new_offset = roundup(placement->end, unit->alignment);
+	reorg_placement__add_gap(placement, placement->nr_gaps, placement->end, unit->new_offset - placement->end);
+	placement->end = unit->new_offset + unit->size;
+}
+
+static void reorg_placement__skip_to(struct reorg_placement *placement, size_t offset)
+{
+	reorg_placement__add_gap(placement, placement->nr_gaps, placement->end, offset - placement->end);
+	placement->end = offset;
+}
+
+/*
+ * @heat - reads plus writes, to sort the hot units
+ * @write_hot - see class_member_access__write_hot()
+ */
+struct reorg_unit_access {
+	struct reorg_unit *unit;
+	uint64_t	  heat;
+	bool		  write_hot;
+};
+
+static int reorg_unit_access__cmp(const void *a, const void *b)
+{
+	const struct reorg_unit_access *aa = a, *ab = b;
+
+	if (aa->heat != ab->heat)
+		return aa->heat < ab->heat ? 1 : -1;
+
+	return reorg_unit__cmp(aa->unit, ab->unit);
+}
+
+static int reorg_unit__cmp_new_offset(const void *a, const void *b)
+{
+	const struct reorg_unit *ua = a, *ub = b;
+
+	return ua->new_offset < ub->new_offset ? -1 : ua->new_offset > ub->new_offset;
+}
+
+static const struct class_member_access *class_member__find_access(struct class_member *member,
+								    const struct class_member_access *accesses,
+								    int nr_accesses)
+{
+	const char *name = class_member__name(member);
+	int i;
+
+	if (name == NULL)
+		return NULL;
+
+	for (i = 0; i < nr_accesses; ++i) {
+		if (strcmp(accesses[i].name, name) == 0)
+			return &accesses[i];
+	}
+
+	return NULL;
+}
+
+int class__reorganize_by_access(struct class *class, const struct cu *cu,
+				const struct class_member_access *accesses, int nr_accesses,
+				uint32_t cacheline_size, const int verbose, FILE *fp)
+{
+	uint32_t alignment = class->type.alignment ?: 1, tail_alignment = 1;
+	struct reorg_placement placement = { .nr_gaps = 0, };
+	struct reorg_unit_access *unit_accesses = NULL;
+	struct reorg_unit *units = NULL, *sorted = NULL;
+	bool flexible_array = false, has_write_hot = false;
+	int nr_units, i, err = -1;
+	size_t size, read_start;
+
+	nr_units = class__reorg_units(class, cu, &units);
+	if (nr_units <= 0)
+		return -1;
+
+	if (units[nr_units - 1].size == 0) {
+		tail_alignment = units[--nr_units].alignment;
+		flexible_array = true;
+	}
+
+	unit_accesses	= zalloc(nr_units * sizeof(*unit_accesses));
+	sorted		= malloc((nr_units + 1) * sizeof(*sorted));
+	placement.gaps	= malloc((2 * nr_units + 1) * sizeof(*placement.gaps));
+	if (unit_accesses == NULL || sorted == NULL || placement.gaps == NULL)
+		goto out_free;
+
+	for (i = 0; i < nr_units; ++i) {
+		struct reorg_unit_access *unit_access = &unit_accesses[i];
+		struct class_member *member = units[i].first;
+		uint64_t reads = 0, writes = 0;
+
+		while (1) {
+			const struct class_member_access *access = class_member__find_access(member, accesses, nr_accesses);
+
+			if (access != NULL) {
+				reads  += access->reads;
+				writes += access->writes;
+			}
+			if (member == units[i].last)
+				break;
+			member = list_next_entry(member, tag.node);
+		}
+
+		unit_access->unit      = &units[i];
+		unit_access->heat      = reads + writes;
+		unit_access->write_hot = class_member_access__write_hot(reads, writes);
+		has_write_hot |= unit_access->write_hot;
+
+		if (units[i].alignment > alignment)
+			alignment = units[i].alignment;
+	}
+	if (tail_alignment > alignment)
+		alignment = tail_alignment;
+
+	// Aligned differently than what we can infer, __packed__, etc
+	if (class__size(class) % alignment != 0)
+		goto out_free;
+
+	qsort(unit_accesses, nr_units, sizeof(*unit_accesses), reorg_unit_access__cmp);
+
+	for (i = 0; i < nr_units; ++i) {
+		if (unit_accesses[i].write_hot)
+			reorg_placement__place(&placement, unit_accesses[i].unit, 0);
+	}
+
+	if (has_write_hot && placement.end % cacheline_size != 0)
+		reorg_placement__skip_to(&placement, roundup(placement.end, cacheline_size));
+
+	// The mostly read ones can't use the holes in the cachelines written to
+	read_start = placement.end;
+	for (i = 0; i < nr_units && unit_accesses[i].heat != 0; ++i) {
+		if (!unit_accesses[i].write_hot)
+			reorg_placement__place(&placement, unit_accesses[i].unit, read_start);
+	}
+
+	// The cold ones, packed as tightly as possible
+	for (; i < nr_units; ++i)
+		reorg_placement__place(&placement, unit_accesses[i].unit, 0);
+
+	if (flexible_array) {
+		units[nr_units].new_offset = roundup(placement.end, tail_alignment);
+		placement.end = units[nr_units++].new_offset;
+	}
+
+	size = roundup(placement.end, alignment);
+
+	if (verbose)
+		fprintf(fp, "/* Moving written to members to the start, then the mostly read ones, "
+			    "from the next cacheline, then the cold ones: %zd bytes */\n", size);
+
+	memcpy(sorted, units, nr_units * sizeof(*sorted));
+	qsort(sorted, nr_units, sizeof(*sorted), reorg_unit__cmp_new_offset);
+	class__move_reorg_units(class, sorted, nr_units, size);
+
+	if (verbose > 1) {
+		class__fprintf(class, cu, fp);
+		fputc('\n', fp);
+	}
+	err = 0;
+out_free:
+	free(placement.gaps);
+	free(sorted);
+	free(unit_accesses);
+	free(units);
+	return err;
+}
@@ -9,6 +9,7 @@
 */
 
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -27,4 +28,28 @@ void class__fixup_alignment(struct class *cls, const struct cu *cu);
 void class__reorganize(struct class *cls, const struct cu *cu,
 		       const int verbose, FILE *fp);
 
+void class__reorganize_optimal(struct class *cls, const struct cu *cu,
+			       const int verbose, FILE *fp);
+
+/*
+ * @name - of the member
+ * @reads, @writes - how many times it was read or written, from a profile,
+ *		     e.g. made with 'perf c2c' or 'perf mem'
+ */
+struct class_member_access {
+	const char *name;
+	uint64_t   reads;
+	uint64_t   writes;
+};
+
+/* Written at least once for every ten reads, keep away from the mostly read ones */
+static inline bool class_member_access__write_hot(uint64_t reads, uint64_t writes)
+{
+	return writes != 0 && writes * 10 >= reads;
+}
+
+int class__reorganize_by_access(struct class *cls, const struct cu *cu,
+				const struct class_member_access *accesses, int nr_accesses,
+				uint32_t cacheline_size, const int verbose, FILE *fp);
+
 #endif /* _DWARVES_REORGANIZE_H_ */
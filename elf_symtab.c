@@ -6,16 +6,323 @@
 */
 
 #include <malloc.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "dutil.h"
 #include "elf_symtab.h"
+#include "hash.h"
 
 #define HASHSYMS__BITS 8
 #define HASHSYMS__SIZE (1UL << HASHSYMS__BITS)
 
-struct elf_symtab *elf_symtab__new(const char *name, Elf *elf)
+/* Chain terminator in name_buckets/name_next */
+#define ELF_SYMTAB__NO_SYM UINT32_MAX
+
+/* Don't use threads to build the index for less than this per thread */
+#define ELF_SYMTAB__MIN_SYMS_PER_JOB 16384
+
+struct elf_symtab__index_job {
+	pthread_t	  thread;
+	struct elf_symtab *symtab;
+	uint32_t	  start;
+	uint32_t	  end;
+	uint32_t	  nr_syms_by_addr;
+};
+
+static int elf_symtab_addr__cmp(const void *a, const void *b)
+{
+	const struct elf_symtab_addr *aa = a, *ab = b;
+
+	if (aa->addr != ab->addr)
+		return aa->addr < ab->addr ? -1 : 1;
+	return aa->id < ab->id ? -1 : aa->id > ab->id;
+}
+
+/*
+ * Decodes the [start, end) symbols, leaving the hash of their names in
+ * name_next, to be chained later, and the defined ones, sorted by address,
+ * in the [start, start + nr_syms_by_addr) slice of syms_by_addr.
+ */
+static void *elf_symtab__index_job(void *arg)
+{
+	struct elf_symtab__index_job *job = arg;
+	struct elf_symtab *symtab = job->symtab;
+	struct elf_symtab_addr *by_addr = symtab->syms_by_addr + job->start;
+	uint32_t id;
+
+	job->nr_syms_by_addr = 0;
+
+	for (id = job->start; id < job->end; ++id) {
+		struct elf_symtab_entry *entry = &symtab->entries[id];
+		Elf32_Word sec_idx;
+
+		if (!elf_sym__get(symtab->syms, symtab->syms_sec_idx_table,
+				  id, &entry->sym, &sec_idx)) {
+			memset(&entry->sym, 0, sizeof(entry->sym));
+			sec_idx = SHN_UNDEF;
+		}
+		entry->sec_idx = sec_idx;
+
+		if (entry->sym.st_name != 0)
+			symtab->name_next[id] = hash_str(elf_sym__name(&entry->sym, symtab),
+							 symtab->name_bits);
+		else
+			symtab->name_next[id] = ELF_SYMTAB__NO_SYM;
+
+		if (entry->sym.st_shndx == SHN_UNDEF)
+			continue;
+
+		by_addr[job->nr_syms_by_addr].addr = elf_sym__value(&entry->sym);
+		by_addr[job->nr_syms_by_addr].id   = id;
+		++job->nr_syms_by_addr;
+	}
+
+	qsort(by_addr, job->nr_syms_by_addr, sizeof(*by_addr), elf_symtab_addr__cmp);
+	return NULL;
+}
+
+static int elf_symtab__merge_syms_by_addr(struct elf_symtab *symtab,
+					  struct elf_symtab__index_job *jobs,
+					  int nr_jobs)
+{
+	struct elf_symtab_addr *by_addr;
+	uint32_t i, nr = 0;
+	int j;
+
+	for (j = 0; j < nr_jobs; ++j)
+		nr += jobs[j].nr_syms_by_addr;
+
+	by_addr = malloc((nr ?: 1) * sizeof(*by_addr));
+	if (by_addr == NULL)
+		return -1;
+
+	for (i = 0; i < nr; ++i) {
+		struct elf_symtab__index_job *min = NULL;
+
+		for (j = 0; j < nr_jobs; ++j) {
+			struct elf_symtab__index_job *job = &jobs[j];
+
+			if (job->nr_syms_by_addr == 0)
+				continue;
+			if (min == NULL ||
+			    elf_symtab_addr__cmp(&symtab->syms_by_addr[job->start],
+						 &symtab->syms_by_addr[min->start]) < 0)
+				min = job;
+		}
+
+		by_addr[i] = symtab->syms_by_addr[min->start++];
+		--min->nr_syms_by_addr;
+	}
+
+	free(symtab->syms_by_addr);
+	symtab->syms_by_addr = by_addr;
+	symtab->nr_syms_by_addr = nr;
+	return 0;
+}
+
+static int elf_symtab__index_sections(struct elf_symtab *symtab)
+{
+	uint32_t id;
+
+	symtab->section_first = calloc(symtab->nr_sections + 1, sizeof(uint32_t));
+	symtab->syms_by_section = malloc((symtab->nr_syms ?: 1) * sizeof(uint32_t));
+	if (symtab->section_first == NULL || symtab->syms_by_section == NULL)
+		return -1;
+
+	for (id = 0; id < symtab->nr_syms; ++id) {
+		uint32_t sec_idx = symtab->entries[id].sec_idx;
+
+		if (sec_idx < symtab->nr_sections)
+			++symtab->section_first[sec_idx + 1];
+	}
+
+	for (id = 1; id <= symtab->nr_sections; ++id)
+		symtab->section_first[id] += symtab->section_first[id - 1];
+
+	/*
+	 * Use section_first[N] as the cursor for section N, leaving it with
+	 * where section N + 1 starts, then shift it all back in place.
+	 */
+	for (id = 0; id < symtab->nr_syms; ++id) {
+		uint32_t sec_idx = symtab->entries[id].sec_idx;
+
+		if (sec_idx < symtab->nr_sections)
+			symtab->syms_by_section[symtab->section_first[sec_idx]++] = id;
+	}
+
+	memmove(symtab->section_first + 1, symtab->section_first,
+		symtab->nr_sections * sizeof(uint32_t));
+	symtab->section_first[0] = 0;
+	return 0;
+}
+
+/*
+ * The symbols are decoded and hashed in parallel, using up to nr_jobs threads,
+ * in ranges of at least ELF_SYMTAB__MIN_SYMS_PER_JOB symbols, each range also
+ * sorted by address. The ranges are then merged and the name chains and
+ * section buckets are built in symbol index order.
+ */
+static int elf_symtab__index(struct elf_symtab *symtab, int nr_jobs)
+{
+	uint32_t nr_syms = symtab->nr_syms, id;
+	int j;
+
+	if ((uint32_t)nr_jobs > nr_syms / ELF_SYMTAB__MIN_SYMS_PER_JOB)
+		nr_jobs = nr_syms / ELF_SYMTAB__MIN_SYMS_PER_JOB;
+	if (nr_jobs < 1)
+		nr_jobs = 1;
+
+	symtab->name_bits = 4;
+	while (symtab->name_bits < 24 && (1U << symtab->name_bits) < nr_syms)
+		++symtab->name_bits;
+
+	symtab->entries	     = malloc((nr_syms ?: 1) * sizeof(*symtab->entries));
+	symtab->name_next    = malloc((nr_syms ?: 1) * sizeof(*symtab->name_next));
+	symtab->name_buckets = malloc((1U << symtab->name_bits) * sizeof(*symtab->name_buckets));
+	symtab->syms_by_addr = malloc((nr_syms ?: 1) * sizeof(*symtab->syms_by_addr));
+
+	struct elf_symtab__index_job *jobs = calloc(nr_jobs, sizeof(*jobs));
+
+	if (symtab->entries == NULL || symtab->name_next == NULL ||
+	    symtab->name_buckets == NULL || symtab->syms_by_addr == NULL || jobs == NULL)
+		goto out_enomem;
+
+	for (j = 0; j < nr_jobs; ++j) {
+		jobs[j].symtab = symtab;
+		jobs[j].start  = (uint64_t)nr_syms * j / nr_jobs;
+		jobs[j].end    = (uint64_t)nr_syms * (j + 1) / nr_jobs;
+	}
+
+	/* The first range is done by this thread, or any that couldn't be started */
+	for (j = 1; j < nr_jobs; ++j) {
+		if (pthread_create(&jobs[j].thread, NULL, elf_symtab__index_job, &jobs[j]) != 0)
+			break;
+	}
+
+	int nr_threads = j;
+
+	for (; j < nr_jobs; ++j)
+		elf_symtab__index_job(&jobs[j]);
+	elf_symtab__index_job(&jobs[0]);
+
+	for (j = 1; j < nr_threads; ++j)
+		pthread_join(jobs[j].thread, NULL);
+
+	if (elf_symtab__merge_syms_by_addr(symtab, jobs, nr_jobs))
+		goto out_enomem;
+
+	memset(symtab->name_buckets, 0xff, (1U << symtab->name_bits) * sizeof(*symtab->name_buckets));
+
+	/* Backwards, so that the chains end up in ascending symbol index order */
+	for (id = nr_syms; id-- > 0; ) {
+		uint32_t bucket = symtab->name_next[id];
+
+		if (bucket == ELF_SYMTAB__NO_SYM)
+			continue;
+
+		symtab->name_next[id] = symtab->name_buckets[bucket];
+		symtab->name_buckets[bucket] = id;
+	}
+
+	if (elf_symtab__index_sections(symtab))
+		goto out_enomem;
+
+	free(jobs);
+	return 0;
+
+out_enomem:
+	free(jobs);
+	return -1;
+}
+
+static void elf_symtab__index_delete(struct elf_symtab *symtab)
+{
+	zfree(&symtab->entries);
+	zfree(&symtab->name_buckets);
+	zfree(&symtab->name_next);
+	zfree(&symtab->syms_by_addr);
+	zfree(&symtab->section_first);
+	zfree(&symtab->syms_by_section);
+}
+
+static const GElf_Sym *__elf_symtab__find_by_name(const struct elf_symtab *symtab, uint32_t id,
+						  const char *name, uint32_t *idp)
+{
+	for (; id != ELF_SYMTAB__NO_SYM; id = symtab->name_next[id]) {
+		const GElf_Sym *sym = elf_symtab__sym(symtab, id);
+
+		if (strcmp(elf_sym__name(sym, symtab), name) == 0) {
+			if (idp)
+				*idp = id;
+			return sym;
+		}
+	}
+
+	return NULL;
+}
+
+const GElf_Sym *elf_symtab__find_by_name(const struct elf_symtab *symtab,
+					 const char *name, uint32_t *idp)
+{
+	return __elf_symtab__find_by_name(symtab, symtab->name_buckets[hash_str(name, symtab->name_bits)],
+					  name, idp);
+}
+
+/* The next symbol with the same name as the one at *idp, in symbol index order */
+const GElf_Sym *elf_symtab__find_next_by_name(const struct elf_symtab *symtab,
+					      const char *name, uint32_t *idp)
+{
+	return __elf_symtab__find_by_name(symtab, symtab->name_next[*idp], name, idp);
+}
+
+/*
+ * Looks only at the symbols starting at the highest address <= addr, the
+ * first, in symbol index order, whose size covers addr is returned or, if
+ * none does, the first one if it starts at addr, e.g. zero sized labels.
+ */
+const GElf_Sym *elf_symtab__find_by_addr(const struct elf_symtab *symtab,
+					 uint64_t addr, uint32_t *idp)
+{
+	const struct elf_symtab_addr *by_addr = symtab->syms_by_addr;
+	uint32_t lo = 0, hi = symtab->nr_syms_by_addr, first;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (by_addr[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return NULL;
+
+	first = hi = lo;
+	while (first > 0 && by_addr[first - 1].addr == by_addr[hi - 1].addr)
+		--first;
+
+	for (lo = first; lo < hi; ++lo) {
+		const GElf_Sym *sym = elf_symtab__sym(symtab, by_addr[lo].id);
+
+		if (addr - by_addr[lo].addr < elf_sym__size(sym)) {
+			first = lo;
+			goto found;
+		}
+	}
+
+	if (by_addr[first].addr != addr)
+		return NULL;
+found:
+	if (idp)
+		*idp = by_addr[first].id;
+	return elf_symtab__sym(symtab, by_addr[first].id);
+}
+
+struct elf_symtab *elf_symtab__new(const char *name, Elf *elf, int nr_jobs)
 {
 	size_t symtab_index;
 
@@ -88,7 +395,18 @@ struct elf_symtab *elf_symtab__new(const char *name, Elf *elf)
 
 	symtab->nr_syms = shdr.sh_size / shdr.sh_entsize;
 
+	size_t nr_sections;
+
+	if (elf_getshdrnum(elf, &nr_sections) != 0)
+		goto out_free_name;
+	symtab->nr_sections = nr_sections;
+
+	if (elf_symtab__index(symtab, nr_jobs))
+		goto out_delete_index;
+
 	return symtab;
+out_delete_index:
+	elf_symtab__index_delete(symtab);
 out_free_name:
 	zfree(&symtab->name);
 out_delete:
@@ -100,6 +418,7 @@ void elf_symtab__delete(struct elf_symtab *symtab)
 {
 	if (symtab == NULL)
 		return;
+	elf_symtab__index_delete(symtab);
 	zfree(&symtab->name);
 	free(symtab);
 }
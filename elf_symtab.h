@@ -12,6 +12,26 @@
 #include <gelf.h>
 #include <elf.h>
 
+struct elf_symtab_entry {
+	GElf_Sym  sym;
+	/* st_shndx or, for SHN_XINDEX, the SHT_SYMTAB_SHNDX entry */
+	uint32_t  sec_idx;
+};
+
+struct elf_symtab_addr {
+	uint64_t  addr;
+	uint32_t  id;
+};
+
+/*
+ * The symbols are decoded just once, by elf_symtab__new(), that also builds
+ * the indexes used by the lookup functions below:
+ *
+ * name_buckets/name_next: name hash, chained by symbol index, in ascending order
+ * syms_by_addr: the defined symbols, sorted by address and symbol index
+ * syms_by_section: the symbol indexes grouped by section, the symbols in
+ *		    section N being from section_first[N] to section_first[N + 1]
+ */
 struct elf_symtab {
 	uint32_t  nr_syms;
 	Elf_Data  *syms;
@@ -19,9 +39,18 @@ struct elf_symtab {
 	/* Data of SHT_SYMTAB_SHNDX section. */
 	Elf_Data  *syms_sec_idx_table;
 	char	  *name;
+	struct elf_symtab_entry *entries;
+	uint32_t  *name_buckets;
+	uint32_t  *name_next;
+	uint32_t  name_bits;
+	uint32_t  nr_syms_by_addr;
+	struct elf_symtab_addr *syms_by_addr;
+	uint32_t  nr_sections;
+	uint32_t  *section_first;
+	uint32_t  *syms_by_section;
 };
 
-struct elf_symtab *elf_symtab__new(const char *name, Elf *elf);
+struct elf_symtab *elf_symtab__new(const char *name, Elf *elf, int nr_jobs);
 void elf_symtab__delete(struct elf_symtab *symtab);
 
 static inline uint32_t elf_symtab__nr_symbols(const struct elf_symtab *symtab)
@@ -29,6 +58,45 @@ static inline uint32_t elf_symtab__nr_symbols(const struct elf_symtab *symtab)
 	return symtab->nr_syms;
 }
 
+static inline const GElf_Sym *elf_symtab__sym(const struct elf_symtab *symtab,
+					     uint32_t id)
+{
+	return &symtab->entries[id].sym;
+}
+
+static inline uint32_t elf_symtab__sym_sec_idx(const struct elf_symtab *symtab,
+					       uint32_t id)
+{
+	return symtab->entries[id].sec_idx;
+}
+
+/*
+ * Index in syms_by_section of the first symbol in section sec_idx, sections
+ * past the last one, like SHN_ABS and SHN_COMMON, have no symbols.
+ */
+static inline uint32_t elf_symtab__section_first(const struct elf_symtab *symtab,
+						 uint32_t sec_idx)
+{
+	if (sec_idx > symtab->nr_sections)
+		sec_idx = symtab->nr_sections;
+	return symtab->section_first[sec_idx];
+}
+
+static inline uint32_t elf_symtab__section_nr_symbols(const struct elf_symtab *symtab,
+						      uint32_t sec_idx)
+{
+	if (sec_idx >= symtab->nr_sections)
+		return 0;
+	return symtab->section_first[sec_idx + 1] - symtab->section_first[sec_idx];
+}
+
+const GElf_Sym *elf_symtab__find_by_name(const struct elf_symtab *symtab,
+					 const char *name, uint32_t *idp);
+const GElf_Sym *elf_symtab__find_next_by_name(const struct elf_symtab *symtab,
+					      const char *name, uint32_t *idp);
+const GElf_Sym *elf_symtab__find_by_addr(const struct elf_symtab *symtab,
+					 uint64_t addr, uint32_t *idp);
+
 static inline const char *elf_sym__name(const GElf_Sym *sym,
 					const struct elf_symtab *symtab)
 {
@@ -100,9 +168,9 @@ elf_sym__get(Elf_Data *syms, Elf_Data *syms_sec_idx_table,
  * @sym: GElf_Sym iterator
  */
 #define elf_symtab__for_each_symbol(symtab, index, sym) \
-	for (index = 0, gelf_getsym(symtab->syms, index, &sym);\
-	     index < symtab->nr_syms; \
-	     index++, gelf_getsym(symtab->syms, index, &sym))
+	for (index = 0; \
+	     index < symtab->nr_syms && (sym = symtab->entries[index].sym, true); \
+	     index++)
 
 /**
  * elf_symtab__for_each_symbol_index - iterate through all the symbols,
@@ -114,8 +182,24 @@ elf_sym__get(Elf_Data *syms, Elf_Data *syms_sec_idx_table,
  * @sym_sec_idx: symbol's index
  */
 #define elf_symtab__for_each_symbol_index(symtab, id, sym, sym_sec_idx)		\
-	for (id = 0; id < symtab->nr_syms; id++)				\
-		if (elf_sym__get(symtab->syms, symtab->syms_sec_idx_table,	\
-				 id, &sym, &sym_sec_idx))
+	for (id = 0;								\
+	     id < symtab->nr_syms && (sym = symtab->entries[id].sym,		\
+				      sym_sec_idx = symtab->entries[id].sec_idx, true); \
+	     id++)
+
+/**
+ * elf_symtab__for_each_symbol_in_section - iterate through the symbols in a
+ * section, in symbol index order
+ *
+ * @symtab: struct elf_symtab instance to iterate
+ * @sec_idx: section index, taking extended symbols indexes into account
+ * @pos: uint32_t position in symtab->syms_by_section
+ * @id: uint32_t symbol index
+ */
+#define elf_symtab__for_each_symbol_in_section(symtab, sec_idx, pos, id)	\
+	for (pos = elf_symtab__section_first(symtab, sec_idx);			\
+	     pos < elf_symtab__section_first(symtab, (sec_idx) + 1) &&		\
+	     (id = symtab->syms_by_section[pos], true);				\
+	     pos++)
 
 #endif /* _ELF_SYMTAB_H_ */
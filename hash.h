@@ -21,4 +21,14 @@ static inline uint64_t hash_64(const uint64_t val, const unsigned int bits)
 	return (val * 11400714819323198485LLU) >> (64 - bits);
 }
 
+static inline uint64_t hash_str(const char *str, const unsigned int bits)
+{
+	uint64_t val = 0;
+
+	while (*str)
+		val = val * 31 + *str++;
+
+	return hash_64(val, bits);
+}
+
 #endif /* _LINUX_HASH_H */
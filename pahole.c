@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <bpf/btf.h>
 #include "bpf/libbpf.h"
 
@@ -42,6 +44,15 @@ static const char *base_btf_file;
 
 static const char *prettify_input_filename;
 static FILE *prettify_input;
+static bool prettify_stats;
+static const char *prettify_stats_exprs;
+
+enum prettify_format {
+	PRETTIFY_FORMAT__TEXT,
+	PRETTIFY_FORMAT__BINARY,
+};
+
+static enum prettify_format prettify_format;
 
 static uint8_t class__include_anonymous;
 static uint8_t class__include_nested_anonymous;
@@ -70,6 +81,9 @@ static size_t cacheline_size;
 static uint8_t find_containers;
 static uint8_t find_pointers_in_structs;
 static int reorganize;
+static bool reorganize_optimal;
+static const char *reorganize_profile_filename;
+static const char *instances_filename;
 static bool show_private_classes;
 static bool defined_in;
 static bool just_unions;
@@ -88,6 +102,32 @@ static struct conf_load conf_load = {
 	.conf_fprintf = &conf,
 };
 
+struct structure;
+
+struct classes_output_entry {
+	off_t		 start, end;
+	struct structure *str;
+	bool		 skip;
+};
+
+struct classes_output {
+	struct list_head	    node;
+	uint32_t		    seq;
+	uint32_t		    nr_entries;
+	uint32_t		    nr_allocated;
+	struct classes_output_entry *entries;
+	FILE			    *fp;
+	char			    *buf;
+	size_t			    size;
+};
+
+/*
+ * @seq - of the CU it was first found in, the one printing it
+ * @output - where it was printed when using -j, while not written to stdout
+ * @output_entry - its entry in @output
+ * @nr_instances - estimate of how many instances there are, for --reorganize without -C
+ * @reorg_candidate - passed the filters and has holes or padding, for --reorganize without -C
+ */
 struct structure {
 	struct list_head  node;
 	struct rb_node	  rb_node;
@@ -96,6 +136,11 @@ struct structure {
 	uint32_t	  id;
 	uint32_t	  nr_files;
 	uint32_t	  nr_methods;
+	uint32_t	  seq;
+	struct classes_output *output;
+	uint32_t	  output_entry;
+	uint64_t	  nr_instances;
+	bool		  reorg_candidate;
 };
 
 static struct structure *structure__new(struct class *class, struct cu *cu, uint32_t id)
@@ -108,6 +153,10 @@ static struct structure *structure__new(struct class *class, struct cu *cu, uint
 		st->class      = class;
 		st->cu	       = cu;
 		st->id	       = id;
+		st->seq	       = cu->seq;
+		st->output     = NULL;
+		st->nr_instances    = 1;
+		st->reorg_candidate = false;
 	}
 
 	return st;
@@ -343,12 +392,46 @@ static struct structure *__structures__add(struct class *class, struct cu *cu, u
 	return str;
 }
 
-static struct structure *structures__add(struct class *class, struct cu *cu, uint32_t id, bool *existing_entry)
+static int classes_output__add_entry(struct classes_output *output, struct structure *str);
+
+/*
+ * @output - if not NULL, where the CU is printing to, the new entry for this
+ *	     class in it is returned in @output_entry
+ */
+static struct structure *structures__add(struct class *class, struct cu *cu, uint32_t id, bool *existing_entry,
+					 struct classes_output *output, uint32_t *output_entry)
 {
 	struct structure *str;
 
 	pthread_mutex_lock(&structures_lock);
 	str = __structures__add(class, cu, id, existing_entry);
+
+	if (output == NULL || str == NULL)
+		goto out_unlock;
+
+	/*
+	 * Printed by a CU that comes later in the file and wasn't written to
+	 * stdout yet, as that waits for this one, so print it here instead.
+	 */
+	if (*existing_entry && str->seq > cu->seq && str->output != NULL) {
+		str->output->entries[str->output_entry].skip = true;
+		str->class = class;
+		str->cu	   = cu;
+		str->id	   = id;
+		str->seq   = cu->seq;
+		str->nr_files++;
+		*existing_entry = false;
+	}
+
+	if (!*existing_entry) {
+		int entry = classes_output__add_entry(output, str);
+
+		if (entry < 0)
+			str = NULL;
+		else
+			*output_entry = entry;
+	}
+out_unlock:
 	pthread_mutex_unlock(&structures_lock);
 
 	return str;
@@ -378,9 +461,9 @@ static void nr_definitions_formatter(struct structure *st)
 	printf("%s%c%u\n", class__name(st->class), separator, st->nr_files);
 }
 
-static void nr_members_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void nr_members_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
-	printf("%s%c%u\n", class__name(class), separator, class__nr_members(class));
+	fprintf(fp, "%s%c%u\n", class__name(class), separator, class__nr_members(class));
 }
 
 static void nr_methods_formatter(struct structure *st)
@@ -388,25 +471,157 @@ static void nr_methods_formatter(struct structure *st)
 	printf("%s%c%u\n", class__name(st->class), separator, st->nr_methods);
 }
 
-static void size_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void size_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
-	printf("%s%c%d%c%u\n", class__name(class), separator,
+	class__find_holes(class);
+	fprintf(fp, "%s%c%d%c%u\n", class__name(class), separator,
 	       class__size(class), separator, tag__is_union(class__tag(class)) ? 0 : class->nr_holes);
 }
 
-static void class_name_len_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+static void class_name_len_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
 {
 	const char *name = class__name(class);
-	printf("%s%c%zd\n", name, separator, strlen(name));
+	fprintf(fp, "%s%c%zd\n", name, separator, strlen(name));
+}
+
+static void class_name_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused, FILE *fp)
+{
+	fprintf(fp, "%s\n", class__name(class));
+}
+
+/*
+ * --false_sharing: members used for synchronization, locks, atomics, refcounts,
+ * etc, are written to often, maybe from several CPUs at the same time, so
+ * look for the cachelines they share with other members.
+ */
+static const char *sync_type_names[] = {
+	"arch_spinlock_t", "atomic64_t", "atomic_long_t", "atomic_t", "kref", "local64_t",
+	"local_t", "lockref", "mutex", "percpu_ref", "qspinlock", "raw_spinlock",
+	"raw_spinlock_t", "refcount_struct", "refcount_t", "rw_semaphore", "rwlock_t",
+	"semaphore", "seqcount", "seqcount_t", "seqlock_t", "spinlock", "spinlock_t",
+};
+
+static int sync_type_name__cmp(const void *name, const void *entry)
+{
+	return strcmp(name, *(const char **)entry);
+}
+
+static bool type_name__is_sync(const char *name)
+{
+	return name != NULL && bsearch(name, sync_type_names, sizeof(sync_type_names) / sizeof(sync_type_names[0]),
+				       sizeof(sync_type_names[0]), sync_type_name__cmp) != NULL;
+}
+
+/*
+ * Looks at the typedefs and at the contents of structs up to a cacheline in
+ * size, e.g. 'struct wait_queue_head' has a 'spinlock_t'.
+ */
+static bool tag__is_sync(struct tag *tag, struct cu *cu, int depth)
+{
+	while (tag != NULL) {
+		if (tag__is_typedef(tag)) {
+			if (type_name__is_sync(type__name(tag__type(tag))))
+				return true;
+		} else if (tag__is_struct(tag) || tag__is_union(tag)) {
+			struct type *type = tag__type(tag);
+			struct class_member *member;
+
+			if (type_name__is_sync(type__name(type)))
+				return true;
+
+			if (depth == 0 || type->size > conf.cacheline_size)
+				return false;
+
+			type__for_each_data_member(type, member) {
+				if (tag__is_sync(cu__type(cu, member->tag.type), cu, depth - 1))
+					return true;
+			}
+			return false;
+		} else if (!tag__is_modifier(tag) && tag->tag != DW_TAG_array_type)
+			return false;
+
+		tag = cu__type(cu, tag->type);
+	}
+
+	return false;
+}
+
+/* The cachelines the member is in, a zero sized one counts as being in the one at its offset */
+static void class_member__cachelines(struct class_member *member, uint32_t *first, uint32_t *last)
+{
+	*first = member->byte_offset / conf.cacheline_size;
+	*last  = (member->byte_offset + (member->byte_size ?: 1) - 1) / conf.cacheline_size;
 }
 
-static void class_name_formatter(struct class *class, struct cu *cu __maybe_unused, uint32_t id __maybe_unused)
+/*
+ * The risk score is the number of pairs of members sharing a cacheline where
+ * at least one is used for synchronization, the suggested split points are the
+ * members that share a cacheline with the previous one, with one of them being
+ * used for synchronization.
+ */
+static void false_sharing_formatter(struct class *class, struct cu *cu, uint32_t id __maybe_unused, FILE *fp)
 {
-	puts(class__name(class));
+	const uint32_t nr_cachelines = class__size(class) / conf.cacheline_size + 1;
+	uint32_t *nr_sync = zalloc(nr_cachelines * sizeof(uint32_t)),
+		 *nr_others = zalloc(nr_cachelines * sizeof(uint32_t)), i;
+	struct class_member *member, *prev = NULL;
+	bool prev_is_sync = false, first_split = true;
+	uint64_t score = 0;
+
+	if (!tag__is_struct(class__tag(class)) || nr_sync == NULL || nr_others == NULL)
+		goto out_free;
+
+	type__for_each_data_member(&class->type, member) {
+		uint32_t first, last;
+		uint32_t *counts = tag__is_sync(cu__type(cu, member->tag.type), cu, 2) ? nr_sync : nr_others;
+
+		class_member__cachelines(member, &first, &last);
+		for (i = first; i <= last && i < nr_cachelines; ++i)
+			++counts[i];
+	}
+
+	for (i = 0; i < nr_cachelines; ++i)
+		score += (uint64_t)nr_sync[i] * (nr_sync[i] - 1) / 2 + (uint64_t)nr_sync[i] * nr_others[i];
+
+	if (score == 0)
+		goto out_free;
+
+	fprintf(fp, "%s%c%" PRIu64 "%c", class__name(class), separator, score, separator);
+
+	type__for_each_data_member(&class->type, member) {
+		bool is_sync = tag__is_sync(cu__type(cu, member->tag.type), cu, 2);
+		uint32_t first, last, prev_first, prev_last;
+
+		class_member__cachelines(member, &first, &last);
+
+		if (prev != NULL && (is_sync || prev_is_sync)) {
+			class_member__cachelines(prev, &prev_first, &prev_last);
+			if (first == prev_last) {
+				fprintf(fp, "%s%s", first_split ? "" : ",", class_member__name(member) ?: "<anonymous>");
+				first_split = false;
+			}
+		}
+
+		prev = member;
+		prev_is_sync = is_sync;
+	}
+	fputc('\n', fp);
+
+	if (global_verbose) {
+		for (i = 0; i < nr_cachelines; ++i) {
+			if (nr_sync[i] != 0 && nr_sync[i] + nr_others[i] > 1)
+				fprintf(fp, "%ccacheline %u: %u synchronization and %u other members\n",
+					separator, i, nr_sync[i], nr_others[i]);
+		}
+	}
+out_free:
+	free(nr_sync);
+	free(nr_others);
 }
 
-static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
+static void class_formatter(struct class *class, struct cu *cu, uint32_t id, FILE *fp)
 {
+	struct conf_fprintf cconf = conf; // May be called from multiple threads
 	struct tag *typedef_alias = NULL;
 	struct tag *tag = class__tag(class);
 	const char *name = class__name(class);
@@ -432,17 +647,17 @@ static void class_formatter(struct class *class, struct cu *cu, uint32_t id)
 	if (typedef_alias != NULL) {
 		struct type *tdef = tag__type(typedef_alias);
 
-		conf.prefix = "typedef";
-		conf.suffix = type__name(tdef);
+		cconf.prefix = "typedef";
+		cconf.suffix = type__name(tdef);
 	} else
-		conf.prefix = conf.suffix = NULL;
+		cconf.prefix = cconf.suffix = NULL;
 
-	tag__fprintf(tag, cu, &conf, stdout);
+	tag__fprintf(tag, cu, &cconf, fp);
 
-	putchar('\n');
+	fputc('\n', fp);
 }
 
-static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
+static void print_packable_info(struct class *c, struct cu *cu, uint32_t id, FILE *fp)
 {
 	const struct tag *t = class__tag(c);
 	const size_t orig_size = class__size(c);
@@ -459,19 +674,19 @@ static void print_packable_info(struct class *c, struct cu *cu, uint32_t id)
 			name = class__name(tag__class(tdef));
 	}
 	if (name != NULL)
-		printf("%s%c%zd%c%zd%c%zd\n",
-		       name, separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
+		fprintf(fp, "%s%c%zd%c%zd%c%zd\n",
+			name, separator,
+			orig_size, separator,
+			new_size, separator,
+			savings);
 	else
-		printf("%s(%d)%c%zd%c%zd%c%zd\n",
-		       tag__decl_file(t, cu),
-		       tag__decl_line(t, cu),
-		       separator,
-		       orig_size, separator,
-		       new_size, separator,
-		       savings);
+		fprintf(fp, "%s(%d)%c%zd%c%zd%c%zd\n",
+			tag__decl_file(t, cu),
+			tag__decl_line(t, cu),
+			separator,
+			orig_size, separator,
+			new_size, separator,
+			savings);
 }
 
 static void (*stats_formatter)(struct structure *st);
@@ -488,16 +703,175 @@ static struct class *class__filter(struct class *class, struct cu *cu,
 				   uint32_t tag_id);
 
 static void (*formatter)(struct class *class,
-			 struct cu *cu, uint32_t id) = class_formatter;
+			 struct cu *cu, uint32_t id, FILE *fp) = class_formatter;
+
+/*
+ * With -j the CUs get to pahole_stealer() from several threads, out of order,
+ * so when printing all the classes each CU prints to its own buffer, written
+ * to stdout in the order the CUs are in the file. As without -j, a class is
+ * printed by the first CU it is in: if it was already printed by a CU that
+ * comes later in the file its entry there is skipped.
+ */
+static struct {
+	pthread_mutex_t	 mutex;
+	struct list_head pending; // Not yet written, sorted by seq
+	uint32_t	 next_seq;
+} classes_outputs = {
+	.mutex	 = PTHREAD_MUTEX_INITIALIZER,
+	.pending = LIST_HEAD_INIT(classes_outputs.pending),
+};
+
+static bool classes_output__needed(struct conf_load *conf_load)
+{
+	return conf_load->nr_jobs > 1 && class_name == NULL && !btf_encode && !reorganize &&
+	       stats_formatter != nr_methods_formatter &&
+	       (show_packable || formatter != NULL) &&
+	       !(sort_output && formatter == class_formatter);
+}
+
+static struct classes_output *classes_output__new(struct cu *cu)
+{
+	struct classes_output *output = zalloc(sizeof(*output));
+
+	if (output == NULL)
+		return NULL;
+
+	output->seq = cu->seq;
+	output->fp = open_memstream(&output->buf, &output->size);
+	if (output->fp == NULL) {
+		free(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+static void classes_output__delete(struct classes_output *output)
+{
+	uint32_t i;
+
+	// So that structures__add() doesn't touch it when a CU that comes before shows up
+	pthread_mutex_lock(&structures_lock);
+	for (i = 0; i < output->nr_entries; ++i) {
+		struct structure *str = output->entries[i].str;
+
+		if (str->output == output)
+			str->output = NULL;
+	}
+	pthread_mutex_unlock(&structures_lock);
+
+	if (output->fp)
+		fclose(output->fp);
+	free(output->buf);
+	free(output->entries);
+	free(output);
+}
+
+/* Must be called with structures_lock held, returns the index of the new entry */
+static int classes_output__add_entry(struct classes_output *output, struct structure *str)
+{
+	if (output->nr_entries == output->nr_allocated) {
+		uint32_t nr_allocated = output->nr_allocated ? output->nr_allocated * 2 : 64;
+		struct classes_output_entry *entries = realloc(output->entries, nr_allocated * sizeof(*entries));
+
+		if (entries == NULL)
+			return -ENOMEM;
+
+		output->entries	     = entries;
+		output->nr_allocated = nr_allocated;
+	}
+
+	str->output	  = output;
+	str->output_entry = output->nr_entries;
+
+	struct classes_output_entry *entry = &output->entries[output->nr_entries++];
+
+	entry->start = ftello(output->fp);
+	entry->end   = entry->start;
+	entry->str   = str;
+	entry->skip  = false;
+
+	return str->output_entry;
+}
+
+static void classes_output__write(struct classes_output *output)
+{
+	off_t pos = 0;
+	uint32_t i;
+
+	for (i = 0; i < output->nr_entries; ++i) {
+		struct classes_output_entry *entry = &output->entries[i];
+
+		if (!entry->skip)
+			continue;
+
+		fwrite(output->buf + pos, 1, entry->start - pos, stdout);
+		pos = entry->end;
+	}
+
+	fwrite(output->buf + pos, 1, output->size - pos, stdout);
+}
+
+/*
+ * Called when a CU is done, writes its output and the pending ones after it
+ * if all the CUs before it are done.
+ */
+static void classes_output__done(struct classes_output *output)
+{
+	struct classes_output *pos;
+
+	fclose(output->fp);
+	output->fp = NULL;
+
+	pthread_mutex_lock(&classes_outputs.mutex);
+
+	list_for_each_entry(pos, &classes_outputs.pending, node) {
+		if (pos->seq > output->seq)
+			break;
+	}
+	list_add_tail(&output->node, &pos->node);
+
+	while (!list_empty(&classes_outputs.pending)) {
+		output = list_first_entry(&classes_outputs.pending, struct classes_output, node);
+
+		if (output->seq != classes_outputs.next_seq)
+			break;
+
+		list_del(&output->node);
+		classes_output__write(output);
+		classes_output__delete(output);
+		++classes_outputs.next_seq;
+	}
+
+	pthread_mutex_unlock(&classes_outputs.mutex);
+}
+
+/* Writes the ones left waiting for CUs that never got to pahole_stealer() */
+static void classes_outputs__flush(void)
+{
+	struct classes_output *output, *n;
+
+	pthread_mutex_lock(&classes_outputs.mutex);
+
+	list_for_each_entry_safe(output, n, &classes_outputs.pending, node) {
+		list_del(&output->node);
+		classes_output__write(output);
+		classes_output__delete(output);
+	}
+
+	pthread_mutex_unlock(&classes_outputs.mutex);
+}
 
-static void print_classes(struct cu *cu)
+static void print_classes(struct cu *cu, struct classes_output *output)
 {
+	FILE *fp = output ? output->fp : stdout;
 	uint32_t id;
 	struct class *pos;
 
 	cu__for_each_struct_or_union(cu, id, pos) {
 		bool existing_entry;
 		struct structure *str;
+		int64_t output_entry = -1;
 
 		if (pos->type.namespace.name == 0 &&
 		    !(class__include_anonymous ||
@@ -515,7 +889,9 @@ static void print_classes(struct cu *cu)
 		 * and I'm sleepy, will leave for later...
 		 */
 		if (pos->type.namespace.name != 0) {
-			str = structures__add(pos, cu, id, &existing_entry);
+			uint32_t entry;
+
+			str = structures__add(pos, cu, id, &existing_entry, output, &entry);
 			if (str == NULL) {
 				fprintf(stderr, "pahole: insufficient memory for "
 					"processing %s, skipping it...\n", cu->name);
@@ -524,28 +900,200 @@ static void print_classes(struct cu *cu)
 
 			/* Already printed... */
 			if (existing_entry) {
+				pthread_mutex_lock(&structures_lock);
 				str->nr_files++;
+				pthread_mutex_unlock(&structures_lock);
 				continue;
 			}
+
+			if (output)
+				output_entry = entry;
 		}
 
 		if (show_packable && !global_verbose)
-			print_packable_info(pos, cu, id);
+			print_packable_info(pos, cu, id, fp);
 		else if (sort_output && formatter == class_formatter)
 			continue; // we'll print it at the end, in order, out of structures__tree
 		else if (formatter != NULL)
-			formatter(pos, cu, id);
+			formatter(pos, cu, id, fp);
+
+		if (output_entry >= 0)
+			output->entries[output_entry].end = ftello(fp);
+	}
+}
+
+/*
+ * --sort with -j: format the classes in multiple threads, each to its own
+ * buffer, written to stdout in order as soon as all the ones before are done.
+ */
+struct ordered_classes_output {
+	char   *buf;
+	size_t size;
+	bool   done;
+};
+
+struct ordered_classes {
+	struct structure	      **structures;
+	struct ordered_classes_output *outputs;
+	uint32_t		      nr_structures;
+	uint32_t		      next;
+	uint32_t		      next_to_write;
+	pthread_mutex_t		      mutex;
+};
+
+static void *ordered_classes__worker(void *arg)
+{
+	struct ordered_classes *oc = arg;
+
+	while (1) {
+		struct ordered_classes_output output = { .buf = NULL, };
+		uint32_t idx;
+
+		pthread_mutex_lock(&oc->mutex);
+		idx = oc->next++;
+		pthread_mutex_unlock(&oc->mutex);
+
+		if (idx >= oc->nr_structures)
+			break;
+
+		struct structure *st = oc->structures[idx];
+		FILE *fp = open_memstream(&output.buf, &output.size);
+
+		if (fp != NULL) {
+			class_formatter(st->class, st->cu, st->id, fp);
+			fclose(fp);
+		}
+
+		pthread_mutex_lock(&oc->mutex);
+		oc->outputs[idx] = output;
+		oc->outputs[idx].done = true;
+
+		while (oc->next_to_write < oc->nr_structures && oc->outputs[oc->next_to_write].done) {
+			struct structure *pst = oc->structures[oc->next_to_write];
+			struct ordered_classes_output *pos = &oc->outputs[oc->next_to_write++];
+
+			// Couldn't get a buffer? Print it here, in order
+			if (pos->buf == NULL)
+				class_formatter(pst->class, pst->cu, pst->id, stdout);
+			else
+				fwrite(pos->buf, 1, pos->size, stdout);
+			zfree(&pos->buf);
+		}
+		pthread_mutex_unlock(&oc->mutex);
+	}
+
+	return NULL;
+}
+
+static int structures__cmp_cu(const void *a, const void *b)
+{
+	const struct cu *cu_a = (*(const struct structure **)a)->cu,
+			*cu_b = (*(const struct structure **)b)->cu;
+
+	return cu_a < cu_b ? -1 : cu_a > cu_b;
+}
+
+/*
+ * Finding holes and inferring packed attributes is done lazily when printing
+ * and changes the classes, including the types of members, that may be being
+ * printed by another thread, so do it for all the classes in the CUs first.
+ */
+static void ordered_classes__prepare(struct ordered_classes *oc)
+{
+	struct structure **by_cu = malloc(oc->nr_structures * sizeof(*by_cu));
+	struct cu *prev = NULL;
+	uint32_t i;
+
+	if (by_cu == NULL)
+		return;
+
+	memcpy(by_cu, oc->structures, oc->nr_structures * sizeof(*by_cu));
+	qsort(by_cu, oc->nr_structures, sizeof(*by_cu), structures__cmp_cu);
+
+	for (i = 0; i < oc->nr_structures; ++i) {
+		struct cu *cu = by_cu[i]->cu;
+		struct class *pos;
+		uint32_t id;
+
+		if (cu == prev)
+			continue;
+		prev = cu;
+
+		cu__for_each_struct_or_union(cu, id, pos) {
+			struct type *type = &pos->type;
+
+			if (tag__is_union(class__tag(pos))) {
+				union__infer_packed_attributes(type, cu);
+				continue;
+			}
+
+			class__find_holes(pos);
+			class__infer_packed_attributes(pos, cu);
+		}
+	}
+
+	free(by_cu);
+}
+
+static bool ordered_classes__print_parallel(struct rb_root *root, int nr_jobs)
+{
+	struct ordered_classes oc = { .nr_structures = 0, };
+	pthread_t threads[nr_jobs];
+	struct rb_node *next;
+	bool ret = false;
+	int i;
+
+	for (next = rb_first(root); next; next = rb_next(next))
+		++oc.nr_structures;
+
+	if (oc.nr_structures == 0)
+		return true;
+
+	oc.structures = malloc(oc.nr_structures * sizeof(*oc.structures));
+	oc.outputs    = zalloc(oc.nr_structures * sizeof(*oc.outputs));
+	if (oc.structures == NULL || oc.outputs == NULL)
+		goto out_free;
+
+	for (i = 0, next = rb_first(root); next; next = rb_next(next))
+		oc.structures[i++] = rb_entry(next, struct structure, rb_node);
+
+	ordered_classes__prepare(&oc);
+
+	pthread_mutex_init(&oc.mutex, NULL);
+
+	for (i = 0; i < nr_jobs; ++i) {
+		if (pthread_create(&threads[i], NULL, ordered_classes__worker, &oc) != 0)
+			break;
 	}
+
+	// Couldn't create any thread? Do it all in this one then
+	if (i == 0)
+		ordered_classes__worker(&oc);
+
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&oc.mutex);
+	ret = true;
+out_free:
+	free(oc.structures);
+	free(oc.outputs);
+	return ret;
 }
 
 static void __print_ordered_classes(struct rb_root *root)
 {
 	struct rb_node *next = rb_first(root);
 
+	// The expansions change the types being expanded while printing them
+	if (conf_load.nr_jobs > 1 && !conf.expand_types && !conf.expand_pointers &&
+	    ordered_classes__print_parallel(root, conf_load.nr_jobs))
+		return;
+
 	while (next) {
 		struct structure *st = rb_entry(next, struct structure, rb_node);
 
-		class_formatter(st->class, st->cu, st->id);
+		class_formatter(st->class, st->cu, st->id, stdout);
 
 		next = rb_next(&st->rb_node);
 	}
@@ -609,6 +1157,14 @@ static struct cu *cu__filter(struct cu *cu)
 	return cu;
 }
 
+static void class__reorganize_selected(struct class *class, struct cu *cu, int verbose, FILE *fp)
+{
+	if (reorganize_optimal)
+		class__reorganize_optimal(class, cu, verbose, fp);
+	else
+		class__reorganize(class, cu, verbose, fp);
+}
+
 static int class__packable(struct class *class, struct cu *cu)
 {
 	struct class *clone;
@@ -619,7 +1175,7 @@ static int class__packable(struct class *class, struct cu *cu)
 	clone = class__clone(class, NULL);
 	if (clone == NULL)
 		return 0;
-	class__reorganize(clone, cu, 0, stdout);
+	class__reorganize_selected(clone, cu, 0, stdout);
 	if (class__size(class) > class__size(clone)) {
 		class->priv = clone;
 		return 1;
@@ -751,47 +1307,502 @@ static struct class *class__filter(struct class *class, struct cu *cu,
 	return class;
 }
 
-static void union__find_new_size(struct tag *tag, struct cu *cu);
+/*
+ * --reorganize without -C: reorganize clones of all the structs with holes,
+ * in parallel, and report the ones that would shrink, ranked by the bytes
+ * saved times an estimate of how many instances of each there are: one, as
+ * it is probably allocated somewhere, plus the ones embedded in other types,
+ * arrays counting as many, plus the variables of that type.
+ *
+ * With --instances the number of instances comes from a file instead, say a
+ * /proc/slabinfo snapshot, for what is really using memory in some system.
+ */
 
-static void class__resize_LP(struct tag *tag, struct cu *cu)
-{
-	struct tag *tag_pos;
-	struct class *class = tag__class(tag);
-	size_t word_size_diff;
-	size_t orig_size = class->type.size;
+struct instance_count {
+	char	 *name;
+	uint64_t count;
+};
 
-	if (tag__type(tag)->resized)
-		return;
+static struct instance_counts {
+	struct instance_count *entries;
+	int		      nr_entries;
+} instance_counts;
 
-	tag__type(tag)->resized = 1;
+static int instance_count__cmp(const void *a, const void *b)
+{
+	const struct instance_count *ca = a, *cb = b;
 
-	if (original_word_size > word_size)
-		word_size_diff = original_word_size - word_size;
-	else
-		word_size_diff = word_size - original_word_size;
+	return strcmp(ca->name, cb->name);
+}
 
-	type__for_each_tag(tag__type(tag), tag_pos) {
-		struct tag *type;
-		size_t diff = 0;
-		size_t array_multiplier = 1;
+/*
+ * Lines with a name and a count, that is also the format of the first two
+ * columns in /proc/slabinfo, name and active_objs, whose header is skipped.
+ */
+static int instance_counts__load(struct instance_counts *counts, const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	int nr_allocated = 0, line_nr = 0, err = -1, i, j;
+	char line[1024];
 
-		/* we want only data members, i.e. with byte_offset attr */
-		if (tag_pos->tag != DW_TAG_member &&
-		    tag_pos->tag != DW_TAG_inheritance)
-		    	continue;
+	if (fp == NULL) {
+		fprintf(stderr, "pahole: couldn't open the '%s' instance counts: %s\n", filename, strerror(errno));
+		return -1;
+	}
 
-		type = cu__type(cu, tag_pos->type);
-		tag__assert_search_result(type);
-		if (type->tag == DW_TAG_array_type) {
-			int i;
-			for (i = 0; i < tag__array_type(type)->dimensions; ++i)
-				array_multiplier *= tag__array_type(type)->nr_entries[i];
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char name[256];
+		uint64_t count;
 
-			type = cu__type(cu, type->type);
-			tag__assert_search_result(type);
+		++line_nr;
+		if (line[0] == '#' || strstarts(line, "slabinfo - version") || line[strspn(line, " \t\n")] == '\0')
+			continue;
+
+		if (sscanf(line, "%255s %" SCNu64, name, &count) != 2) {
+			fprintf(stderr, "pahole: invalid line %d in the '%s' instance counts, expected 'NAME COUNT'\n",
+				line_nr, filename);
+			goto out_close;
 		}
 
-		if (tag__is_typedef(type)) {
+		if (counts->nr_entries == nr_allocated) {
+			int nr = nr_allocated ? nr_allocated * 2 : 256;
+			struct instance_count *entries = realloc(counts->entries, nr * sizeof(*entries));
+
+			if (entries == NULL)
+				goto out_enomem;
+
+			counts->entries = entries;
+			nr_allocated = nr;
+		}
+
+		counts->entries[counts->nr_entries].name = strdup(name);
+		if (counts->entries[counts->nr_entries].name == NULL)
+			goto out_enomem;
+		counts->entries[counts->nr_entries++].count = count;
+	}
+
+	qsort(counts->entries, counts->nr_entries, sizeof(*counts->entries), instance_count__cmp);
+
+	// Add up the counts for the same name
+	for (i = 0, j = 0; i < counts->nr_entries; ++i) {
+		if (j != 0 && strcmp(counts->entries[j - 1].name, counts->entries[i].name) == 0) {
+			counts->entries[j - 1].count += counts->entries[i].count;
+			free(counts->entries[i].name);
+		} else
+			counts->entries[j++] = counts->entries[i];
+	}
+	counts->nr_entries = j;
+
+	err = 0;
+out_close:
+	fclose(fp);
+	return err;
+out_enomem:
+	fprintf(stderr, "pahole: insufficient memory for loading the '%s' instance counts\n", filename);
+	goto out_close;
+}
+
+static void instance_counts__exit(struct instance_counts *counts)
+{
+	for (int i = 0; i < counts->nr_entries; ++i)
+		free(counts->entries[i].name);
+	zfree(&counts->entries);
+	counts->nr_entries = 0;
+}
+
+static struct instance_count *instance_counts__find(struct instance_counts *counts, const char *name)
+{
+	struct instance_count key = { .name = (char *)name, };
+
+	if (name == NULL || counts->nr_entries == 0)
+		return NULL;
+
+	return bsearch(&key, counts->entries, counts->nr_entries, sizeof(key), instance_count__cmp);
+}
+
+/*
+ * Strips typedefs, modifiers and arrays, multiplying @nr_instances by the
+ * number of array entries, returning the type id of what is instantiated.
+ */
+static struct tag *cu__instantiated_type(struct cu *cu, type_id_t *id, uint64_t *nr_instances)
+{
+	struct tag *type = cu__type(cu, *id);
+
+	while (type != NULL) {
+		if (type->tag == DW_TAG_array_type) {
+			struct array_type *at = tag__array_type(type);
+			int i;
+
+			for (i = 0; i < at->dimensions; ++i)
+				*nr_instances *= at->nr_entries[i];
+		} else if (!tag__is_typedef(type) && !tag__is_modifier(type))
+			break;
+
+		*id  = type->type;
+		type = cu__type(cu, *id);
+	}
+
+	return type;
+}
+
+static void cu__account_instances_of(struct cu *cu, type_id_t id, uint64_t nr_instances)
+{
+	struct tag *type = cu__instantiated_type(cu, &id, &nr_instances);
+	struct structure *str;
+	bool existing_entry;
+
+	if (type == NULL || nr_instances == 0 || !tag__is_struct(type) || tag__namespace(type)->name == 0)
+		return;
+
+	pthread_mutex_lock(&structures_lock);
+	str = __structures__add(tag__class(type), cu, id, &existing_entry);
+	if (str != NULL)
+		str->nr_instances += nr_instances;
+	pthread_mutex_unlock(&structures_lock);
+}
+
+static void type__account_embedded_instances(struct type *type, struct cu *cu, uint64_t nr_instances)
+{
+	struct class_member *member;
+
+	type__for_each_data_member(type, member) {
+		uint64_t nr_member_instances = nr_instances;
+		type_id_t id = member->tag.type;
+		struct tag *member_type = cu__instantiated_type(cu, &id, &nr_member_instances);
+
+		if (member_type == NULL || nr_member_instances == 0)
+			continue;
+
+		// Anonymous structs and unions are only in the type they are in
+		if ((tag__is_struct(member_type) || tag__is_union(member_type)) &&
+		    tag__namespace(member_type)->name == 0)
+			type__account_embedded_instances(tag__type(member_type), cu, nr_member_instances);
+		else
+			cu__account_instances_of(cu, id, nr_member_instances);
+	}
+}
+
+static int cu__account_reorganize_candidates(struct cu *cu)
+{
+	uint32_t *first_found = malloc(cu->types_table.nr_entries * sizeof(uint32_t)), nr_first_found = 0, i;
+	struct class *pos;
+	struct tag *var;
+	uint32_t id;
+
+	if (first_found == NULL)
+		return -ENOMEM;
+
+	/*
+	 * Add all first, so that the types embedded in the ones found first in
+	 * this CU are found when accounting their instances.
+	 */
+	cu__for_each_struct_or_union(cu, id, pos) {
+		bool existing_entry;
+		struct structure *str;
+
+		if (pos->type.namespace.name == 0)
+			continue;
+
+		str = structures__add(pos, cu, id, &existing_entry, NULL, NULL);
+		if (str == NULL) {
+			free(first_found);
+			return -ENOMEM;
+		}
+
+		// Only count what is embedded in the first definition found
+		if (!existing_entry)
+			first_found[nr_first_found++] = id;
+
+		if (tag__is_struct(class__tag(pos)) && class__filter(pos, cu, id) &&
+		    (pos->nr_holes != 0 || pos->nr_bit_holes != 0 || pos->padding != 0)) {
+			pthread_mutex_lock(&structures_lock);
+			// Reorganize the one in the CU being kept
+			if (!str->reorg_candidate) {
+				str->class = pos;
+				str->cu	   = cu;
+				str->id	   = id;
+				str->reorg_candidate = true;
+			}
+			pthread_mutex_unlock(&structures_lock);
+		}
+	}
+
+	// No need to estimate it if we know how many instances there are
+	if (instances_filename != NULL)
+		nr_first_found = 0;
+
+	for (i = 0; i < nr_first_found; ++i)
+		type__account_embedded_instances(tag__type(cu__type(cu, first_found[i])), cu, 1);
+
+	free(first_found);
+
+	if (instances_filename != NULL)
+		return 0;
+
+	cu__for_each_variable(cu, id, var) {
+		if (!tag__variable(var)->declaration)
+			cu__account_instances_of(cu, var->type, 1);
+	}
+
+	return 0;
+}
+
+/*
+ * @wasted - bytes in holes and padding
+ */
+struct reorganize_report_entry {
+	struct structure *st;
+	size_t		 size;
+	size_t		 new_size;
+	size_t		 wasted;
+	uint64_t	 nr_instances;
+	uint32_t	 idx;
+};
+
+static size_t reorganize_report_entry__savings(const struct reorganize_report_entry *entry)
+{
+	return entry->new_size < entry->size ? entry->size - entry->new_size : 0;
+}
+
+/*
+ * @fp - where class__reorganize*() prints its notes, not stdout, as the
+ *	 workers would interleave them with each other and with the report
+ */
+struct reorganize_report {
+	struct reorganize_report_entry *entries;
+	FILE			       *fp;
+	uint32_t		       nr_entries;
+	uint32_t		       next;
+	pthread_mutex_t		       mutex;
+};
+
+static size_t class__wasted_bytes(struct class *class)
+{
+	struct class_member *member;
+	size_t wasted = class->pre_hole + class->padding;
+
+	type__for_each_data_member(&class->type, member)
+		wasted += member->hole;
+
+	return wasted;
+}
+
+static void reorganize_report_entry__reorganize(struct reorganize_report_entry *entry, FILE *fp)
+{
+	struct structure *st = entry->st;
+	struct class *clone = class__clone(st->class, NULL);
+
+	entry->size = entry->new_size = class__size(st->class);
+	entry->wasted = class__wasted_bytes(st->class);
+
+	if (clone == NULL)
+		return;
+
+	class__reorganize_selected(clone, st->cu, 0, fp);
+	entry->new_size = class__size(clone);
+	class__delete(clone);
+}
+
+static void *reorganize_report__worker(void *arg)
+{
+	struct reorganize_report *report = arg;
+
+	while (1) {
+		uint32_t idx;
+
+		pthread_mutex_lock(&report->mutex);
+		idx = report->next++;
+		pthread_mutex_unlock(&report->mutex);
+
+		if (idx >= report->nr_entries)
+			break;
+
+		reorganize_report_entry__reorganize(&report->entries[idx], report->fp);
+	}
+
+	return NULL;
+}
+
+static uint64_t reorganize_report_entry__weighted_savings(const struct reorganize_report_entry *entry)
+{
+	return reorganize_report_entry__savings(entry) * entry->nr_instances;
+}
+
+static uint64_t reorganize_report_entry__weighted_wasted(const struct reorganize_report_entry *entry)
+{
+	return entry->wasted * entry->nr_instances;
+}
+
+static int reorganize_report_entry__cmp(const void *a, const void *b)
+{
+	const struct reorganize_report_entry *ea = a, *eb = b;
+	const uint64_t wa = reorganize_report_entry__weighted_savings(ea),
+		       wb = reorganize_report_entry__weighted_savings(eb),
+		       wwa = reorganize_report_entry__weighted_wasted(ea),
+		       wwb = reorganize_report_entry__weighted_wasted(eb);
+
+	// With the real number of instances rank by where the memory is wasted, even if it can't be saved
+	if (instances_filename != NULL && wwa != wwb)
+		return wwa < wwb ? 1 : -1;
+
+	if (wa != wb)
+		return wa < wb ? 1 : -1;
+
+	if (wwa != wwb)
+		return wwa < wwb ? 1 : -1;
+
+	if (reorganize_report_entry__savings(ea) != reorganize_report_entry__savings(eb))
+		return reorganize_report_entry__savings(ea) < reorganize_report_entry__savings(eb) ? 1 : -1;
+
+	// So that the output doesn't depend on the order the CUs were loaded with -j
+	int ret = strcmp(class__name(ea->st->class), class__name(eb->st->class));
+
+	if (ret)
+		return ret;
+
+	return ea->idx < eb->idx ? -1 : ea->idx > eb->idx;
+}
+
+static int print_reorganize_report(void)
+{
+	struct reorganize_report report = { .nr_entries = 0, };
+	int nr_jobs = conf_load.nr_jobs > 1 ? conf_load.nr_jobs : 1;
+	pthread_t threads[nr_jobs];
+	struct structure *st;
+	uint32_t i;
+	int t;
+
+	list_for_each_entry(st, &structures__list, node) {
+		if (st->reorg_candidate)
+			++report.nr_entries;
+	}
+
+	if (report.nr_entries == 0)
+		return 0;
+
+	report.entries = malloc(report.nr_entries * sizeof(*report.entries));
+	if (report.entries == NULL)
+		return -ENOMEM;
+
+	i = 0;
+	list_for_each_entry(st, &structures__list, node) {
+		struct instance_count *count = NULL;
+
+		if (!st->reorg_candidate)
+			continue;
+
+		// Only the ones we know are in use
+		if (instances_filename != NULL) {
+			count = instance_counts__find(&instance_counts, class__name(st->class));
+			if (count == NULL || count->count == 0)
+				continue;
+		}
+
+		report.entries[i].st	       = st;
+		report.entries[i].nr_instances = count ? count->count : st->nr_instances;
+		report.entries[i].idx	       = i;
+		++i;
+	}
+	report.nr_entries = i;
+
+	/*
+	 * The natural alignments used by --reorganize_optimal are cached in the
+	 * types, including the ones of members, so find them before going parallel.
+	 */
+	if (reorganize_optimal && nr_jobs > 1) {
+		for (i = 0; i < report.nr_entries; ++i)
+			tag__natural_alignment(class__tag(report.entries[i].st->class), report.entries[i].st->cu);
+	}
+
+	report.fp = fopen("/dev/null", "w");
+	if (report.fp == NULL) {
+		free(report.entries);
+		return -errno;
+	}
+
+	pthread_mutex_init(&report.mutex, NULL);
+
+	for (t = 0; nr_jobs > 1 && t < nr_jobs; ++t) {
+		if (pthread_create(&threads[t], NULL, reorganize_report__worker, &report) != 0)
+			break;
+	}
+
+	// Single threaded or couldn't create any thread? Do it all in this one then
+	if (t == 0)
+		reorganize_report__worker(&report);
+
+	while (--t >= 0)
+		pthread_join(threads[t], NULL);
+
+	pthread_mutex_destroy(&report.mutex);
+	fclose(report.fp);
+
+	qsort(report.entries, report.nr_entries, sizeof(*report.entries), reorganize_report_entry__cmp);
+
+	for (i = 0; i < report.nr_entries; ++i) {
+		struct reorganize_report_entry *entry = &report.entries[i];
+
+		// With the real number of instances, show where the memory is wasted, even if it can't be saved
+		if (reorganize_report_entry__savings(entry) == 0 &&
+		    (instances_filename == NULL || entry->wasted == 0))
+			continue;
+
+		printf("%s%c%zd%c%zd%c%zd%c%" PRIu64 "%c%" PRIu64 "%c%zd%c%" PRIu64 "\n",
+		       class__name(entry->st->class), separator,
+		       entry->size, separator,
+		       entry->new_size, separator,
+		       reorganize_report_entry__savings(entry), separator,
+		       entry->nr_instances, separator,
+		       reorganize_report_entry__weighted_savings(entry), separator,
+		       entry->wasted, separator,
+		       reorganize_report_entry__weighted_wasted(entry));
+	}
+
+	free(report.entries);
+	return 0;
+}
+
+static void union__find_new_size(struct tag *tag, struct cu *cu);
+
+static void class__resize_LP(struct tag *tag, struct cu *cu)
+{
+	struct tag *tag_pos;
+	struct class *class = tag__class(tag);
+	size_t word_size_diff;
+	size_t orig_size = class->type.size;
+
+	if (tag__type(tag)->resized)
+		return;
+
+	tag__type(tag)->resized = 1;
+
+	if (original_word_size > word_size)
+		word_size_diff = original_word_size - word_size;
+	else
+		word_size_diff = word_size - original_word_size;
+
+	type__for_each_tag(tag__type(tag), tag_pos) {
+		struct tag *type;
+		size_t diff = 0;
+		size_t array_multiplier = 1;
+
+		/* we want only data members, i.e. with byte_offset attr */
+		if (tag_pos->tag != DW_TAG_member &&
+		    tag_pos->tag != DW_TAG_inheritance)
+		    	continue;
+
+		type = cu__type(cu, tag_pos->type);
+		tag__assert_search_result(type);
+		if (type->tag == DW_TAG_array_type) {
+			int i;
+			for (i = 0; i < tag__array_type(type)->dimensions; ++i)
+				array_multiplier *= tag__array_type(type)->nr_entries[i];
+
+			type = cu__type(cu, type->type);
+			tag__assert_search_result(type);
+		}
+
+		if (tag__is_typedef(type)) {
 			type = tag__follow_typedef(type, cu);
 			tag__assert_search_result(type);
 		}
@@ -931,8 +1942,12 @@ static void cu_fixup_word_size_iterator(struct cu *cu)
 
 	uint32_t id;
 	struct tag *pos;
+
+	/* The sizes of typedefs, arrays, etc will change together with structs */
+	cu__invalidate_tag_sizes(cu);
 	cu__for_each_type(cu, id, pos)
 		tag__fixup_word_size(pos, cu);
+	cu__invalidate_tag_sizes(cu);
 }
 
 static void cu__account_nr_methods(struct cu *cu)
@@ -964,7 +1979,7 @@ static void cu__account_nr_methods(struct cu *cu)
 				continue;
 
 			bool existing_entry;
-			str = structures__add(class, cu, id, &existing_entry);
+			str = structures__add(class, cu, id, &existing_entry, NULL, NULL);
 			if (str == NULL) {
 				fprintf(stderr, "pahole: insufficient memory "
 					"for processing %s, skipping it...\n",
@@ -981,67 +1996,211 @@ static void cu__account_nr_methods(struct cu *cu)
 
 static char tab[128];
 
-static void print_structs_with_pointer_to(struct cu *cu, uint32_t type)
+/*
+ * Reverse index of the references to types in the members of the structs and
+ * unions of a CU, built once per CU, when first needed, so that looking for
+ * the containers of and pointers to types doesn't go thru all the members of
+ * all the types in the CU for each type being looked for.
+ *
+ * The refs to type id N, ordered by container id and then by member, are in
+ * refs[first[N]] .. refs[first[N + 1] - 1], the same for pointers to type N.
+ */
+struct type_ref {
+	uint32_t	    container;
+	struct class_member *member;
+};
+
+struct type_refs {
+	uint32_t	nr_types;
+	uint32_t	*first;
+	struct type_ref *refs;
+	uint32_t	*first_ptr;
+	struct type_ref *ptr_refs;
+};
+
+static void type_refs__delete(struct type_refs *refs)
 {
-	struct class *pos;
-	struct class_member *pos_member;
-	uint32_t id;
+	if (refs == NULL)
+		return;
 
-	cu__for_each_struct_or_union(cu, id, pos) {
-		bool looked = false;
-		/*
-		 * Set it to NULL just to silence the compiler, as the printf
-		 * at the end of the type__for_each_member() loop is only reached
-		 * after str _is_ set, as looked starts as false, str is used with
-		 * structures_add and if it is NULL, we return.
-		 */
-		struct structure *str = NULL;
+	free(refs->first);
+	free(refs->refs);
+	free(refs->first_ptr);
+	free(refs->ptr_refs);
+	free(refs);
+}
 
-		if (pos->type.namespace.name == 0)
-			continue;
+/* Returns the type id a member refers to thru a pointer, UINT32_MAX if it isn't a pointer */
+static uint32_t class_member__pointee(struct class_member *member, struct cu *cu)
+{
+	struct tag *type = cu__type(cu, member->tag.type);
 
-		if (!class__filter(pos, cu, id))
-			continue;
+	return type && tag__is_pointer(type) ? type->type : UINT32_MAX;
+}
+
+static struct type_refs *type_refs__new(struct cu *cu)
+{
+	struct type_refs *refs = zalloc(sizeof(*refs));
+	struct class_member *member;
+	struct class *pos;
+	uint32_t id, i;
 
-		type__for_each_member(&pos->type, pos_member) {
-			struct tag *ctype = cu__type(cu, pos_member->tag.type);
+	if (refs == NULL)
+		return NULL;
 
-			tag__assert_search_result(ctype);
-			if (!tag__is_pointer_to(ctype, type))
-				continue;
+	refs->nr_types	= cu->types_table.nr_entries;
+	refs->first	= zalloc((refs->nr_types + 1) * sizeof(uint32_t));
+	refs->first_ptr = zalloc((refs->nr_types + 1) * sizeof(uint32_t));
+	if (refs->first == NULL || refs->first_ptr == NULL)
+		goto out_delete;
 
-			if (!looked) {
-				bool existing_entry;
+	// First count how many refs each type has, in first[type + 1]
+	cu__for_each_struct_or_union(cu, id, pos) {
+		type__for_each_member(&pos->type, member) {
+			uint32_t pointee = class_member__pointee(member, cu);
 
-				str = structures__add(pos, cu, id, &existing_entry);
-				if (str == NULL) {
-					fprintf(stderr, "pahole: insufficient memory for "
-						"processing %s, skipping it...\n",
-						cu->name);
-					return;
-				}
-				/*
-				 * We already printed this struct in another CU
-				 */
-				if (existing_entry)
-					break;
-				looked = true;
-			}
-			printf("%s: %s\n", class__name(str->class),
-			       class_member__name(pos_member));
+			if (member->tag.type < refs->nr_types)
+				++refs->first[member->tag.type + 1];
+			if (pointee < refs->nr_types)
+				++refs->first_ptr[pointee + 1];
 		}
 	}
+
+	for (i = 0; i < refs->nr_types; ++i) {
+		refs->first[i + 1]     += refs->first[i];
+		refs->first_ptr[i + 1] += refs->first_ptr[i];
+	}
+
+	refs->refs     = malloc((refs->first[refs->nr_types] ?: 1) * sizeof(struct type_ref));
+	refs->ptr_refs = malloc((refs->first_ptr[refs->nr_types] ?: 1) * sizeof(struct type_ref));
+	if (refs->refs == NULL || refs->ptr_refs == NULL)
+		goto out_delete;
+
+	// Then fill them, using first[type] as the cursor, restored at the end
+	cu__for_each_struct_or_union(cu, id, pos) {
+		type__for_each_member(&pos->type, member) {
+			uint32_t pointee = class_member__pointee(member, cu);
+
+			if (member->tag.type < refs->nr_types) {
+				struct type_ref *ref = &refs->refs[refs->first[member->tag.type]++];
+
+				ref->container = id;
+				ref->member    = member;
+			}
+
+			if (pointee < refs->nr_types) {
+				struct type_ref *ref = &refs->ptr_refs[refs->first_ptr[pointee]++];
+
+				ref->container = id;
+				ref->member    = member;
+			}
+		}
+	}
+
+	for (i = refs->nr_types; i > 0; --i) {
+		refs->first[i]	   = refs->first[i - 1];
+		refs->first_ptr[i] = refs->first_ptr[i - 1];
+	}
+	refs->first[0] = refs->first_ptr[0] = 0;
+
+	return refs;
+
+out_delete:
+	type_refs__delete(refs);
+	return NULL;
+}
+
+static struct type_refs *type_refs__get(struct type_refs **refs, struct cu *cu)
+{
+	if (*refs == NULL) {
+		*refs = type_refs__new(cu);
+		if (*refs == NULL)
+			fprintf(stderr, "pahole: insufficient memory for processing %s, skipping it...\n", cu->name);
+	}
+
+	return *refs;
+}
+
+/* How many members of the @container type are of the @type type */
+static uint32_t type_refs__nr_members_of_type(struct type_refs *refs, uint32_t container, uint32_t type)
+{
+	uint32_t start, end, n = 0;
+
+	if (type >= refs->nr_types)
+		return 0;
+
+	start = refs->first[type];
+	end   = refs->first[type + 1];
+
+	// The refs to a type are sorted by container
+	while (start < end) {
+		uint32_t mid = start + (end - start) / 2;
+
+		if (refs->refs[mid].container < container)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+
+	while (start < refs->first[type + 1] && refs->refs[start].container == container) {
+		++start;
+		++n;
+	}
+
+	return n;
+}
+
+static void print_structs_with_pointer_to(struct cu *cu, uint32_t type, struct type_refs *refs)
+{
+	uint32_t i, end;
+
+	if (type >= refs->nr_types)
+		return;
+
+	end = refs->first_ptr[type + 1];
+
+	for (i = refs->first_ptr[type]; i < end; ) {
+		uint32_t id = refs->ptr_refs[i].container;
+		struct class *pos = tag__class(cu__type(cu, id));
+		bool existing_entry;
+		struct structure *str;
+
+		if (pos->type.namespace.name == 0 || !class__filter(pos, cu, id))
+			goto next_container;
+
+		str = structures__add(pos, cu, id, &existing_entry, NULL, NULL);
+		if (str == NULL) {
+			fprintf(stderr, "pahole: insufficient memory for "
+				"processing %s, skipping it...\n",
+				cu->name);
+			return;
+		}
+		/*
+		 * We already printed this struct in another CU
+		 */
+		if (existing_entry)
+			goto next_container;
+
+		for (; i < end && refs->ptr_refs[i].container == id; ++i)
+			printf("%s: %s\n", class__name(str->class),
+			       class_member__name(refs->ptr_refs[i].member));
+		continue;
+next_container:
+		while (i < end && refs->ptr_refs[i].container == id)
+			++i;
+	}
 }
 
-static int type__print_containers(struct type *type, struct cu *cu, uint32_t contained_type_id, int ident)
+static int type__print_containers(struct type *type, uint32_t type_id, struct cu *cu, uint32_t contained_type_id,
+				  int ident, struct type_refs *refs)
 {
-	const uint32_t n = type__nr_members_of_type(type, contained_type_id);
+	const uint32_t n = type_refs__nr_members_of_type(refs, type_id, contained_type_id);
 	if (n == 0)
 		return 0;
 
 	if (ident == 0) {
 		bool existing_entry; // FIXME: This should really just search, no need to try to add it.
-		struct structure *str = structures__add(type__class(type), cu, 0, &existing_entry);
+		struct structure *str = structures__add(type__class(type), cu, 0, &existing_entry, NULL, NULL);
 		if (str == NULL) {
 			fprintf(stderr, "pahole: insufficient memory for "
 				"processing %s, skipping it...\n",
@@ -1066,26 +2225,40 @@ static int type__print_containers(struct type *type, struct cu *cu, uint32_t con
 			struct tag *member_type = cu__type(cu, member->tag.type);
 
 			if (tag__is_struct(member_type) || tag__is_union(member_type))
-				type__print_containers(tag__type(member_type), cu, contained_type_id, ident + 1);
+				type__print_containers(tag__type(member_type), member->tag.type, cu,
+						       contained_type_id, ident + 1, refs);
 		}
 	}
 
 	return 0;
 }
 
-static void print_containers(struct cu *cu, uint32_t type, int ident)
+static void print_containers(struct cu *cu, uint32_t type, int ident, struct type_refs *refs)
 {
-	struct class *pos;
-	uint32_t id;
+	uint32_t i, end;
+
+	if (type >= refs->nr_types)
+		return;
+
+	end = refs->first[type + 1];
+
+	for (i = refs->first[type]; i < end; ++i) {
+		uint32_t id = refs->refs[i].container;
+		struct class *pos;
+
+		// Once per container, it may have several members of this type
+		if (i > refs->first[type] && refs->refs[i - 1].container == id)
+			continue;
+
+		pos = tag__class(cu__type(cu, id));
 
-	cu__for_each_struct_or_union(cu, id, pos) {
 		if (pos->type.namespace.name == 0)
 			continue;
 
 		if (!class__filter(pos, cu, id))
 			continue;
 
-		if (type__print_containers(&pos->type, cu, type, ident))
+		if (type__print_containers(&pos->type, id, cu, type, ident, refs))
 			break;
 	}
 }
@@ -1127,6 +2300,12 @@ ARGP_PROGRAM_VERSION_HOOK_DEF = dwarves_print_version;
 #define ARGP_skip_encoding_btf_decl_tag 331
 #define ARGP_skip_missing          332
 #define ARGP_skip_encoding_btf_type_tag 333
+#define ARGP_prettify_stats	   334
+#define ARGP_prettify_format	   335
+#define ARGP_reorganize_optimal	   336
+#define ARGP_reorganize_profile	   337
+#define ARGP_false_sharing	   338
+#define ARGP_instances		   339
 
 static const struct argp_option pahole__options[] = {
 	{
@@ -1254,6 +2433,28 @@ static const struct argp_option pahole__options[] = {
 		.key  = 'R',
 		.doc  = "reorg struct trying to kill holes",
 	},
+	{
+		.name = "reorganize_optimal",
+		.key  = ARGP_reorganize_optimal,
+		.doc  = "reorg struct finding the layout with the minimal size, implies --reorganize unless used with --packable",
+	},
+	{
+		.name = "false_sharing",
+		.key  = ARGP_false_sharing,
+		.doc  = "show structs with locks, atomics, refcounts, etc sharing cachelines with other members, with a risk score and where to split them",
+	},
+	{
+		.name = "instances",
+		.key  = ARGP_instances,
+		.arg  = "FILE",
+		.doc  = "rank the structs in FILE, with 'NAME COUNT' lines or a /proc/slabinfo snapshot, by the bytes wasted in holes and padding, implies --reorganize",
+	},
+	{
+		.name = "reorganize_profile",
+		.key  = ARGP_reorganize_profile,
+		.arg  = "FILE",
+		.doc  = "reorg structs in FILE, with 'STRUCT MEMBER READS WRITES' lines, grouping hot members in cachelines, implies --reorganize",
+	},
 	{
 		.name = "show_reorg_steps",
 		.key  = 'S',
@@ -1512,6 +2713,19 @@ static const struct argp_option pahole__options[] = {
 		.key  = ARGP_skip_encoding_btf_type_tag,
 		.doc  = "Do not encode TAGs in BTF."
 	},
+	{
+		.name = "prettify_stats",
+		.key  = ARGP_prettify_stats,
+		.arg  = "MEMBERS",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc  = "Instead of pretty printing the records, show how many there are and their size, per type, with histograms of the values of the optional comma separated list of MEMBERS"
+	},
+	{
+		.name = "prettify_format",
+		.key  = ARGP_prettify_format,
+		.arg  = "FORMAT",
+		.doc  = "Output format for --prettify: 'text' (default) or 'binary', length prefixed rows with a schema derived from the type"
+	},
 	{
 		.name = NULL,
 	}
@@ -1577,6 +2791,8 @@ static error_t pahole__options_parser(int key, char *arg,
 	case 'r': conf.rel_offset = 1;			break;
 	case 'S': show_reorg_steps = 1;			break;
 	case 's': formatter = size_formatter;		break;
+	case ARGP_false_sharing:
+		formatter = false_sharing_formatter;	break;
 	case 'T': stats_formatter = nr_definitions_formatter;
 		  formatter = NULL;			break;
 	case 't': separator = arg[0];			break;
@@ -1666,6 +2882,25 @@ static error_t pahole__options_parser(int key, char *arg,
 		conf_load.skip_missing = true;          break;
 	case ARGP_skip_encoding_btf_type_tag:
 		conf_load.skip_encoding_btf_type_tag = true;	break;
+	case ARGP_prettify_stats:
+		prettify_stats = true;
+		prettify_stats_exprs = arg;		break;
+	case ARGP_reorganize_optimal:
+		reorganize_optimal = true;		break;
+	case ARGP_reorganize_profile:
+		reorganize_profile_filename = arg;
+		reorganize = 1;				break;
+	case ARGP_instances:
+		instances_filename = arg;
+		reorganize = 1;				break;
+	case ARGP_prettify_format:
+		if (strcmp(arg, "binary") == 0)
+			prettify_format = PRETTIFY_FORMAT__BINARY;
+		else if (strcmp(arg, "text") == 0)
+			prettify_format = PRETTIFY_FORMAT__TEXT;
+		else
+			argp_error(state, "unknown --prettify_format '%s', use 'text' or 'binary'", arg);
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -1680,9 +2915,207 @@ static struct argp pahole__argp = {
 	.args_doc = pahole__args_doc,
 };
 
+/*
+ * --reorganize_profile: how often members are accessed, e.g. from 'perf c2c'
+ * or 'perf mem' output, one 'STRUCT MEMBER READS WRITES' per line.
+ */
+struct reorganize_profile_entry {
+	char			    *class_name;
+	struct class_member_access access;
+};
+
+static struct reorganize_profile {
+	struct reorganize_profile_entry *entries;
+	int				nr_entries;
+	char				*class_names;
+} reorganize_profile;
+
+static int reorganize_profile__load(struct reorganize_profile *profile, const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	int nr_allocated = 0, line_nr = 0, err = -1;
+	size_t class_names_len = 0;
+	char line[1024];
+
+	if (fp == NULL) {
+		fprintf(stderr, "pahole: couldn't open the '%s' profile: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char class_name[256], member_name[256];
+		uint64_t reads, writes;
+		int i;
+
+		++line_nr;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+
+		if (sscanf(line, "%255s %255s %" SCNu64 " %" SCNu64, class_name, member_name, &reads, &writes) != 4) {
+			fprintf(stderr, "pahole: invalid line %d in the '%s' profile, expected 'STRUCT MEMBER READS WRITES'\n",
+				line_nr, filename);
+			goto out_close;
+		}
+
+		if (profile->nr_entries == nr_allocated) {
+			int nr = nr_allocated ? nr_allocated * 2 : 64;
+			struct reorganize_profile_entry *entries = realloc(profile->entries, nr * sizeof(*entries));
+
+			if (entries == NULL)
+				goto out_enomem;
+
+			profile->entries = entries;
+			nr_allocated = nr;
+		}
+
+		struct reorganize_profile_entry *entry = &profile->entries[profile->nr_entries];
+
+		entry->class_name    = strdup(class_name);
+		entry->access.name   = strdup(member_name);
+		entry->access.reads  = reads;
+		entry->access.writes = writes;
+		if (entry->class_name == NULL || entry->access.name == NULL) {
+			free(entry->class_name);
+			free((char *)entry->access.name);
+			goto out_enomem;
+		}
+		++profile->nr_entries;
+
+		// The first time this class appears
+		for (i = 0; i < profile->nr_entries - 1; ++i) {
+			if (strcmp(profile->entries[i].class_name, class_name) == 0)
+				break;
+		}
+		if (i == profile->nr_entries - 1)
+			class_names_len += strlen(class_name) + 1;
+	}
+
+	// To use when no -C is specified
+	profile->class_names = zalloc(class_names_len + 1);
+	if (profile->class_names == NULL)
+		goto out_enomem;
+
+	for (int i = 0; i < profile->nr_entries; ++i) {
+		int j;
+
+		for (j = 0; j < i; ++j) {
+			if (strcmp(profile->entries[j].class_name, profile->entries[i].class_name) == 0)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		if (profile->class_names[0] != '\0')
+			strcat(profile->class_names, ",");
+		strcat(profile->class_names, profile->entries[i].class_name);
+	}
+
+	err = 0;
+out_close:
+	fclose(fp);
+	return err;
+out_enomem:
+	fprintf(stderr, "pahole: insufficient memory for loading the '%s' profile\n", filename);
+	goto out_close;
+}
+
+static void reorganize_profile__exit(struct reorganize_profile *profile)
+{
+	for (int i = 0; i < profile->nr_entries; ++i) {
+		free(profile->entries[i].class_name);
+		free((char *)profile->entries[i].access.name);
+	}
+	zfree(&profile->entries);
+	zfree(&profile->class_names);
+	profile->nr_entries = 0;
+}
+
+/* The accesses to the members of @class_name, returns how many there are */
+static int reorganize_profile__accesses(struct reorganize_profile *profile, const char *class_name,
+					struct class_member_access **paccesses)
+{
+	struct class_member_access *accesses;
+	int i, nr = 0;
+
+	if (class_name == NULL)
+		return 0;
+
+	for (i = 0; i < profile->nr_entries; ++i) {
+		if (strcmp(profile->entries[i].class_name, class_name) == 0)
+			++nr;
+	}
+
+	if (nr == 0)
+		return 0;
+
+	accesses = malloc(nr * sizeof(*accesses));
+	if (accesses == NULL)
+		return -ENOMEM;
+
+	for (i = 0, nr = 0; i < profile->nr_entries; ++i) {
+		if (strcmp(profile->entries[i].class_name, class_name) == 0)
+			accesses[nr++] = profile->entries[i].access;
+	}
+
+	*paccesses = accesses;
+	return nr;
+}
+
+/*
+ * Counts the cachelines with accessed members and the ones where members that
+ * are written to share the cacheline with mostly read ones.
+ */
+static void class__count_accessed_cachelines(struct class *class, const struct class_member_access *accesses,
+					      int nr_accesses, uint32_t *nr_accessed, uint32_t *nr_shared)
+{
+	enum { CACHELINE__READ = 1, CACHELINE__WRITTEN = 2, };
+	const uint32_t nr_cachelines = class__size(class) / conf.cacheline_size + 1;
+	uint8_t *cachelines = zalloc(nr_cachelines);
+	struct class_member *member;
+	uint32_t i;
+
+	*nr_accessed = *nr_shared = 0;
+
+	if (cachelines == NULL)
+		return;
+
+	type__for_each_data_member(&class->type, member) {
+		const char *name = class_member__name(member);
+		const struct class_member_access *access = NULL;
+		uint32_t first, last;
+		uint8_t kind;
+		int j;
+
+		for (j = 0; name != NULL && j < nr_accesses; ++j) {
+			if (strcmp(accesses[j].name, name) == 0) {
+				access = &accesses[j];
+				break;
+			}
+		}
+
+		if (access == NULL || access->reads + access->writes == 0)
+			continue;
+
+		kind = class_member_access__write_hot(access->reads, access->writes) ? CACHELINE__WRITTEN : CACHELINE__READ;
+		class_member__cachelines(member, &first, &last);
+		for (i = first; i <= last && i < nr_cachelines; ++i)
+			cachelines[i] |= kind;
+	}
+
+	for (i = 0; i < nr_cachelines; ++i) {
+		if (cachelines[i] != 0)
+			++*nr_accessed;
+		if (cachelines[i] == (CACHELINE__READ | CACHELINE__WRITTEN))
+			++*nr_shared;
+	}
+
+	free(cachelines);
+}
+
 static void do_reorg(struct tag *class, struct cu *cu)
 {
-	int savings;
+	struct class_member_access *accesses = NULL;
+	int savings, nr_accesses;
 	const uint8_t reorg_verbose =
 			show_reorg_steps ? 2 : global_verbose;
 	struct class *clone = class__clone(tag__class(class), NULL);
@@ -1690,7 +3123,17 @@ static void do_reorg(struct tag *class, struct cu *cu)
 		fprintf(stderr, "pahole: out of memory!\n");
 		exit(EXIT_FAILURE);
 	}
-	class__reorganize(clone, cu, reorg_verbose, stdout);
+	nr_accesses = reorganize_profile__accesses(&reorganize_profile, class__name(clone), &accesses);
+	if (nr_accesses < 0) {
+		fprintf(stderr, "pahole: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	if (nr_accesses == 0)
+		class__reorganize_selected(clone, cu, reorg_verbose, stdout);
+	else if (class__reorganize_by_access(clone, cu, accesses, nr_accesses, conf.cacheline_size,
+					     reorg_verbose, stdout) != 0)
+		fprintf(stderr, "pahole: couldn't reorganize '%s' using the profile, its layout can't be modeled\n",
+			class__name(clone));
 	savings = class__size(tag__class(class)) - class__size(clone);
 	if (savings != 0 && reorg_verbose) {
 		putchar('\n');
@@ -1698,7 +3141,7 @@ static void do_reorg(struct tag *class, struct cu *cu)
 			puts("/* Final reorganized struct: */");
 	}
 	tag__fprintf(class__tag(clone), cu, &conf, stdout);
-	if (savings != 0) {
+	if (savings > 0) {
 		const size_t cacheline_savings =
 		      (tag__nr_cachelines(&conf, class, cu) -
 		       tag__nr_cachelines(&conf, class__tag(clone), cu));
@@ -1711,9 +3154,25 @@ static void do_reorg(struct tag *class, struct cu *cu)
 			       cacheline_savings != 1 ?
 					"s" : "");
 		puts("! */");
+	} else if (savings < 0) {
+		// Separating the members written to from the ones mostly read may need padding
+		printf("   /* grew %d byte%s */\n", -savings, savings != -1 ? "s" : "");
 	} else
 		putchar('\n');
 
+	if (nr_accesses > 0) {
+		uint32_t nr_accessed_before, nr_shared_before, nr_accessed_after, nr_shared_after;
+
+		class__count_accessed_cachelines(tag__class(class), accesses, nr_accesses,
+						 &nr_accessed_before, &nr_shared_before);
+		class__count_accessed_cachelines(clone, accesses, nr_accesses,
+						 &nr_accessed_after, &nr_shared_after);
+		printf("   /* accessed cachelines: %u before, %u after; "
+		       "shared by written to and mostly read members: %u before, %u after */\n",
+		       nr_accessed_before, nr_accessed_after, nr_shared_before, nr_shared_after);
+		free(accesses);
+	}
+
 	 class__delete(clone);
 }
 
@@ -1734,18 +3193,25 @@ static int instance__fprintf_hexdump_value(void *instance, int _sizeof, FILE *fp
 	return printed;
 }
 
+/*
+ * Records are decoded in place, straight from a mmaped file, so they may not
+ * be naturally aligned.
+ */
+#define instance__load(instance, type) \
+	({ type __value; memcpy(&__value, instance, sizeof(__value)); __value; })
+
 static uint64_t base_type__value(void *instance, int _sizeof)
 {
 	if (_sizeof == sizeof(int))
-		return *(int *)instance;
+		return instance__load(instance, int);
 	else if (_sizeof == sizeof(long))
-		return *(long *)instance;
+		return instance__load(instance, long);
 	else if (_sizeof == sizeof(long long))
-		return *(long long *)instance;
+		return instance__load(instance, long long);
 	else if (_sizeof == sizeof(char))
-		return *(char *)instance;
+		return instance__load(instance, char);
 	else if (_sizeof == sizeof(short))
-		return *(short *)instance;
+		return instance__load(instance, short);
 
 	return 0;
 }
@@ -1763,10 +3229,8 @@ static int base_type__fprintf_value(void *instance, int _sizeof, FILE *fp)
 	return fprintf__value(fp, value);
 }
 
-static uint64_t class_member__bitfield_value(struct class_member *member, void *instance)
+static uint64_t class_member__bitfield_mask(struct class_member *member)
 {
-	int byte_size = member->byte_size;
-	uint64_t value = base_type__value(instance, byte_size);
 	uint64_t mask = 0;
 	int bits = member->bitfield_size;
 
@@ -1776,15 +3240,7 @@ static uint64_t class_member__bitfield_value(struct class_member *member, void *
 			mask <<= 1;
 	}
 
-	mask <<= member->bitfield_offset;
-
-	return (value & mask) >> member->bitfield_offset;
-}
-
-static int class_member__fprintf_bitfield_value(struct class_member *member, void *instance, FILE *fp)
-{
-	const char *format = conf.hex_fmt ? "%#" PRIx64 : "%" PRIi64;
-	return fprintf(fp, format, class_member__bitfield_value(member, instance));
+	return mask << member->bitfield_offset;
 }
 
 static const char *enumeration__lookup_value(struct type *enumeration, uint64_t value)
@@ -1869,11 +3325,129 @@ static int64_t enumerations__lookup_enumerator(struct list_head *enumerations, c
 	return -1;
 }
 
-static int base_type__fprintf_enum_value(void *instance, int _sizeof, struct list_head *enumerations, FILE *fp)
+/*
+ * The type for records whose type= member has the value of this enumerator:
+ * the struct with the enumerator name in lower case, i.e. PERF_RECORD_COMM ->
+ * struct perf_record_comm, looked up in *cup and then cached in the
+ * enumerator.
+ */
+static struct tag *enumerator__real_type(struct enumerator *enumerator, struct cu **cup)
+{
+	char name[1024];
+
+	if (enumerator->type_enum.tag) {
+		*cup = enumerator->type_enum.cu;
+		return enumerator->type_enum.tag;
+	}
+
+	snprintf(name, sizeof(name), "%s", enumerator__name(enumerator));
+	strlwr(name);
+
+	struct tag *real_type = cu__find_type_by_name(*cup, name, false, NULL);
+
+	if (real_type == NULL || !tag__is_struct(real_type))
+		return NULL;
+
+	enumerator->type_enum.tag = real_type;
+	enumerator->type_enum.cu  = *cup;
+	return real_type;
+}
+
+/*
+ * struct type_enum_table - value -> enumerator + type dispatch for type_enum=
+ *
+ * Looking up the enumerator for a type= value walks all the enumerators in
+ * all the type_enum= enumerations and then the type gets looked up by name,
+ * for every record, so, when the enumerator values are dense enough, which
+ * is the case for things like 'enum perf_event_type', precompute all that
+ * into an array indexed by the value.
+ *
+ * @real_type - NULL when there is no struct for the enumerator, i.e. the
+ *		record should be decoded using the type with the type= member
+ */
+struct type_enum_entry {
+	struct enumerator *enumerator;
+	struct tag	  *real_type;
+	struct cu	  *cu;
+};
+
+struct type_enum_table {
+	uint64_t	       min;
+	uint32_t	       nr_entries;
+	struct type_enum_entry entries[0];
+};
+
+#define TYPE_ENUM_TABLE__MAX_ENTRIES (64 * 1024)
+
+static struct type_enum_table *type_enum_table__new(struct list_head *enumerations, struct cu *cu)
+{
+	uint64_t min = UINT64_MAX, max = 0;
+	struct type_enum_table *table;
+	struct tag_cu_node *pos;
+
+	list_for_each_entry(pos, enumerations, node) {
+		struct enumerator *entry;
+
+		type__for_each_enumerator(tag__type(pos->tc.tag), entry) {
+			if (entry->value < min)
+				min = entry->value;
+			if (entry->value > max)
+				max = entry->value;
+		}
+	}
+
+	if (min > max || max - min >= TYPE_ENUM_TABLE__MAX_ENTRIES)
+		return NULL;
+
+	table = zalloc(sizeof(*table) + (max - min + 1) * sizeof(struct type_enum_entry));
+	if (table == NULL)
+		return NULL;
+
+	table->min	  = min;
+	table->nr_entries = max - min + 1;
+
+	list_for_each_entry(pos, enumerations, node) {
+		struct enumerator *entry;
+
+		type__for_each_enumerator(tag__type(pos->tc.tag), entry) {
+			struct type_enum_entry *slot = &table->entries[entry->value - min];
+
+			// Same precedence as the linear lookups: first one wins
+			if (slot->enumerator)
+				continue;
+
+			slot->enumerator = entry;
+			slot->cu	 = cu;
+			slot->real_type	 = enumerator__real_type(entry, &slot->cu);
+		}
+	}
+
+	return table;
+}
+
+static struct type_enum_entry *type_enum_table__entry(struct type_enum_table *table, uint64_t value)
+{
+	uint64_t index = value - table->min;
+
+	if (value < table->min || index >= table->nr_entries || table->entries[index].enumerator == NULL)
+		return NULL;
+
+	return &table->entries[index];
+}
+
+static int base_type__fprintf_enum_value(void *instance, int _sizeof, struct list_head *enumerations,
+					 struct type_enum_table *table, FILE *fp)
 {
 	uint64_t value = base_type__value(instance, _sizeof);
+	const char *entry;
+
+	if (table) {
+		struct type_enum_entry *slot = type_enum_table__entry(table, value);
 
-	const char *entry = enumerations__lookup_value(enumerations, value);
+		entry = slot ? enumerator__name(slot->enumerator) : NULL;
+	} else {
+		entry = enumerations__lookup_value(enumerations, value);
+	}
 
 	if (entry)
 		return fprintf(fp, "%s", entry);
@@ -1886,26 +3460,13 @@ static int string__fprintf_value(char *instance, int _sizeof, FILE *fp)
 	return fprintf(fp, "\"%-.*s\"", _sizeof, instance);
 }
 
-static int array__fprintf_base_type_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+static int array__fprintf_base_type_value(void *instance, int _sizeof, int sizeof_entry, int nr_entries, FILE *fp)
 {
-	struct array_type *array = tag__array_type(tag);
-	struct tag *array_type = cu__type(cu, tag->type);
 	void *contents = instance;
-
-	if (array->dimensions != 1) {
-		// Support multi dimensional arrays later
-		return instance__fprintf_hexdump_value(instance, _sizeof, fp);
-	}
-
-	if (tag__is_typedef(array_type))
-		array_type = tag__follow_typedef(array_type, cu);
-
-	int i, printed = 0, sizeof_entry = base_type__size(array_type);
+	int i, printed = 0;
 
 	printed += fprintf(fp, "{ ");
 
-	int nr_entries = array->nr_entries[0];
-
 	// Look for zero sized arrays
 	if (nr_entries == 0)
 		nr_entries = _sizeof / sizeof_entry;
@@ -1920,320 +3481,2063 @@ static int array__fprintf_base_type_value(struct tag *tag, struct cu *cu, void *
 	return printed + fprintf(fp, " }");
 }
 
-static int array__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, FILE *fp)
-{
-	struct tag *array_type = cu__type(cu, tag->type);
-	char type_name[1024];
-
-	if (strcmp(tag__name(array_type, cu, type_name, sizeof(type_name), NULL), "char") == 0)
-		return string__fprintf_value(instance, _sizeof, fp);
+/*
+ * Walking the class members, resolving typedefs and looking at the member
+ * types for every record is the same work over and over, so the first time a
+ * type is pretty printed it gets compiled into a decode plan, a flat array of
+ * operations, one per value printed plus the opening and closing of structs
+ * and named unions, that is then just executed for each record.
+ */
+enum decode_op_kind {
+	DECODE_OP__OPEN,	/* '{' of a struct or named union */
+	DECODE_OP__CLOSE,	/* and its '}' */
+	DECODE_OP__VALUE,	/* base type */
+	DECODE_OP__ENUM,	/* base type translated using type_enum= */
+	DECODE_OP__BITFIELD,
+	DECODE_OP__STRING,	/* char array */
+	DECODE_OP__ARRAY,	/* one dimensional array of base types */
+	DECODE_OP__HEXDUMP,
+};
 
-	if (tag__is_base_type(array_type, cu))
-		return array__fprintf_base_type_value(tag, cu, instance, _sizeof, fp);
+/*
+ * struct decode_op - one step in a decode plan
+ *
+ * @name - printed as '.name = ' before the value, NULL for anonymous members
+ * @enumerations - for DECODE_OP__ENUM, @enum_table if dense enough
+ * @mask - for DECODE_OP__BITFIELD, @bitfield_offset is how much to shift it
+ * @offset - from the start of the record
+ * @size - in bytes
+ * @entry_size - for DECODE_OP__ARRAY
+ * @nr_entries - for DECODE_OP__ARRAY, zero for as many as fit in @size
+ * @indent - for @name and DECODE_OP__CLOSE
+ * @to_end - zero sized array at the end of the record, @size is what is left
+ * @comma - print a ',' after the value
+ */
+struct decode_op {
+	const char	 *name;
+	struct list_head *enumerations;
+	struct type_enum_table *enum_table;
+	uint64_t	 mask;
+	uint32_t	 offset;
+	uint32_t	 size;
+	uint32_t	 entry_size;
+	uint32_t	 nr_entries;
+	uint8_t		 kind;
+	uint8_t		 bitfield_offset;
+	uint8_t		 indent;
+	bool		 to_end;
+	bool		 comma;
+};
 
-	return instance__fprintf_hexdump_value(instance, _sizeof, fp);
-}
+/*
+ * @type_enum_table - to find the real type of records using the type= member
+ * 		     of the outermost struct
+ * @columns - for --prettify_format=binary, one per op printing a value
+ * @row_id - id used in the binary rows, zero if its schema wasn't written yet
+ */
+struct type_decode_plan {
+	struct list_head node;
+	struct type_enum_table *type_enum_table;
+	uint32_t	 nr_ops;
+	uint32_t	 nr_allocated;
+	struct decode_op *ops;
+	char		 **columns;
+	uint32_t	 nr_columns;
+	uint32_t	 row_id;
+};
+
+static LIST_HEAD(type_decode_plans);
+
+static struct decode_op *type_decode_plan__add_op(struct type_decode_plan *plan, enum decode_op_kind kind,
+						  const char *name, uint32_t offset, uint32_t size, int indent)
+{
+	if (plan->nr_ops == plan->nr_allocated) {
+		uint32_t nr_allocated = plan->nr_allocated ? plan->nr_allocated * 2 : 16;
+		struct decode_op *ops = realloc(plan->ops, nr_allocated * sizeof(*ops));
+
+		if (ops == NULL)
+			return NULL;
+
+		plan->ops	   = ops;
+		plan->nr_allocated = nr_allocated;
+	}
+
+	struct decode_op *op = &plan->ops[plan->nr_ops++];
+
+	memset(op, 0, sizeof(*op));
+	op->kind   = kind;
+	op->name   = name;
+	op->offset = offset;
+	op->size   = size;
+	op->indent = indent;
+	op->comma  = true;
+
+	return op;
+}
+
+static struct decode_op *type_decode_plan__add_array(struct type_decode_plan *plan, struct tag *tag, struct cu *cu,
+						     const char *name, uint32_t offset, uint32_t size, int indent)
+{
+	struct array_type *array = tag__array_type(tag);
+	struct tag *array_type = cu__type(cu, tag->type);
+	char type_name[1024];
+
+	if (strcmp(tag__name(array_type, cu, type_name, sizeof(type_name), NULL), "char") == 0)
+		return type_decode_plan__add_op(plan, DECODE_OP__STRING, name, offset, size, indent);
+
+	// Support multi dimensional arrays later
+	if (!tag__is_base_type(array_type, cu) || array->dimensions != 1)
+		goto hexdump;
+
+	if (tag__is_typedef(array_type))
+		array_type = tag__follow_typedef(array_type, cu);
+
+	uint32_t sizeof_entry = base_type__size(array_type);
+
+	if (sizeof_entry == 0)
+		goto hexdump;
+
+	struct decode_op *op = type_decode_plan__add_op(plan, DECODE_OP__ARRAY, name, offset, size, indent);
+
+	if (op) {
+		op->entry_size = sizeof_entry;
+		op->nr_entries = array->nr_entries[0];
+	}
+
+	return op;
+hexdump:
+	return type_decode_plan__add_op(plan, DECODE_OP__HEXDUMP, name, offset, size, indent);
+}
 
-static int __class__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, int indent, bool brackets, FILE *fp)
+/*
+ * Mirrors how records were printed, recursively, before decode plans, with
+ * _sizeof being the size of the struct being compiled, unknown till decode
+ * time for the outermost one, as it can be a variable sized record.
+ */
+static int type_decode_plan__compile(struct type_decode_plan *plan, struct tag *tag, struct cu *cu,
+				     const char *name, uint32_t offset, uint32_t _sizeof, bool outermost,
+				     int indent, int member_indent, bool brackets)
 {
 	struct type *type = tag__type(tag);
 	struct class_member *member;
-	int printed = 0;
+	struct decode_op *op;
 
-	if (brackets)
-		printed += fprintf(fp, "{");
+	if (brackets) {
+		op = type_decode_plan__add_op(plan, DECODE_OP__OPEN, name, offset, 0, indent);
+		if (op == NULL)
+			return -ENOMEM;
+		op->comma = false;
+	}
 
 	type__for_each_member(type, member) {
-		void *member_contents = instance + member->byte_offset;
+		uint32_t member_offset = offset + member->byte_offset;
 		struct tag *member_type = cu__type(cu, member->tag.type);
-		const char *name = class_member__name(member);
-
-		if (name)
-			printed += fprintf(fp, "\n%.*s\t.%s = ", indent, tabs, name);
+		const char *member_name = class_member__name(member);
+		int err;
 
 		if (member == type->type_member && !list_empty(&type->type_enum)) {
-			printed += base_type__fprintf_enum_value(member_contents, member->byte_size, &type->type_enum, fp);
+			op = type_decode_plan__add_op(plan, DECODE_OP__ENUM, member_name, member_offset, member->byte_size, member_indent);
+			if (op) {
+				op->enumerations = &type->type_enum;
+				op->enum_table	 = type_enum_table__new(&type->type_enum, cu);
+				if (outermost)
+					plan->type_enum_table = op->enum_table;
+			}
 		} else if (member->bitfield_size) {
-			printed += class_member__fprintf_bitfield_value(member, member_contents, fp);
+			op = type_decode_plan__add_op(plan, DECODE_OP__BITFIELD, member_name, member_offset, member->byte_size, member_indent);
+			if (op) {
+				op->mask	    = class_member__bitfield_mask(member);
+				op->bitfield_offset = member->bitfield_offset;
+			}
 		} else if (tag__is_base_type(member_type, cu)) {
-			printed += base_type__fprintf_value(member_contents, member->byte_size, fp);
+			op = type_decode_plan__add_op(plan, DECODE_OP__VALUE, member_name, member_offset, member->byte_size, member_indent);
 		} else if (tag__is_array(member_type, cu)) {
-			int sizeof_member = member->byte_size;
+			uint32_t sizeof_member = member->byte_size;
+			bool to_end = false;
 
 			// zero sized array, at the end of the struct?
-			if (sizeof_member == 0 && list_is_last(&member->tag.node, &type->namespace.tags))
-				sizeof_member = _sizeof - member->byte_offset;
-			printed += array__fprintf_value(member_type, cu, member_contents, sizeof_member, fp);
+			if (sizeof_member == 0 && list_is_last(&member->tag.node, &type->namespace.tags)) {
+				if (outermost)
+					to_end = true;
+				else if (_sizeof > member->byte_offset)
+					sizeof_member = _sizeof - member->byte_offset;
+			}
+
+			op = type_decode_plan__add_array(plan, member_type, cu, member_name, member_offset, sizeof_member, member_indent);
+			if (op)
+				op->to_end = to_end;
 		} else if (tag__is_struct(member_type)) {
-			printed += __class__fprintf_value(member_type, cu, member_contents, member->byte_size, indent + 1, true, fp);
+			err = type_decode_plan__compile(plan, member_type, cu, member_name, member_offset, member->byte_size,
+							false, member_indent, member_indent + 1, true);
+			if (err)
+				return err;
+			continue;
 		} else if (tag__is_union(member_type)) {
-			printed += __class__fprintf_value(member_type, cu, member_contents, member->byte_size, indent + (name ? 1 : 0), !!name, fp);
-			if (!name)
-				continue;
+			// Anonymous unions have its members printed as if they were in the enclosing struct
+			err = type_decode_plan__compile(plan, member_type, cu, member_name, member_offset, member->byte_size,
+							false, member_indent, member_indent + (member_name ? 1 : 0), !!member_name);
+			if (err)
+				return err;
+			continue;
 		} else {
-			printed += instance__fprintf_hexdump_value(member_contents, member->byte_size, fp);
+			op = type_decode_plan__add_op(plan, DECODE_OP__HEXDUMP, member_name, member_offset, member->byte_size, member_indent);
 		}
 
-		fputc(',', fp);
-		++printed;
+		if (op == NULL)
+			return -ENOMEM;
+	}
+
+	if (brackets) {
+		op = type_decode_plan__add_op(plan, DECODE_OP__CLOSE, NULL, offset, 0, member_indent);
+		if (op == NULL)
+			return -ENOMEM;
+		// The outermost struct is followed by ',\n', printed by the caller
+		op->comma = !outermost;
 	}
 
-	if (brackets)
-		printed += fprintf(fp, "\n%.*s}", indent, tabs);
-	return printed;
+	return 0;
 }
 
-static int class__fprintf_value(struct tag *tag, struct cu *cu, void *instance, int _sizeof, int indent, FILE *fp)
+static void type_decode_plan__delete(struct type_decode_plan *plan)
 {
-	return __class__fprintf_value(tag, cu, instance, _sizeof, indent, true, fp);
+	uint32_t i;
+
+	if (plan == NULL)
+		return;
+
+	for (i = 0; i < plan->nr_ops; ++i)
+		free(plan->ops[i].enum_table);
+
+	for (i = 0; i < plan->nr_columns; ++i)
+		free(plan->columns[i]);
+	free(plan->columns);
+
+	list_del(&plan->node);
+	free(plan->ops);
+	free(plan);
 }
 
-static int tag__fprintf_value(struct tag *type, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+static void type_decode_plans__delete(void)
 {
-	if (tag__is_struct(type))
-		return class__fprintf_value(type, cu, instance, _sizeof, 0, fp);
+	struct type_decode_plan *pos, *n;
 
-	return instance__fprintf_hexdump_value(instance, _sizeof, fp);
+	list_for_each_entry_safe(pos, n, &type_decode_plans, node)
+		type_decode_plan__delete(pos);
 }
 
-static int pipe_seek(FILE *fp, off_t offset)
+static struct type_decode_plan *type__decode_plan(struct type *type, struct cu *cu)
 {
-	char bf[4096];
-	int chunk = sizeof(bf);
+	if (type->decode_plan)
+		return type->decode_plan;
 
-	if (chunk > offset)
-		chunk = offset;
+	struct type_decode_plan *plan = zalloc(sizeof(*plan));
 
-	while (fread(bf, chunk, 1, fp) == 1) {
-		offset -= chunk;
-		if (offset == 0)
-			return 0;
-		if (chunk > offset)
-			chunk = offset;
+	if (plan == NULL)
+		return NULL;
+
+	list_add_tail(&plan->node, &type_decode_plans);
+
+	if (type_decode_plan__compile(plan, type__tag(type), cu, NULL, 0, 0, true, 0, 0, true)) {
+		type_decode_plan__delete(plan);
+		return NULL;
 	}
 
-	return offset == 0 ? 0 : -1;
+	type->decode_plan = plan;
+	return plan;
 }
 
-static uint64_t tag__real_sizeof(struct tag *tag, int _sizeof, void *instance)
+static int decode_op__size(const struct decode_op *op, int _sizeof)
 {
-	if (tag__is_struct(tag)) {
-		struct type *type = tag__type(tag);
+	if (op->to_end)
+		return _sizeof > (int)op->offset ? _sizeof - (int)op->offset : 0;
+	return op->size;
+}
 
-		if (type->sizeof_member) {
-			struct class_member *member = type->sizeof_member;
-			return base_type__value(instance + member->byte_offset, member->byte_size);
+static int type_decode_plan__fprintf_value(const struct type_decode_plan *plan, void *instance, int _sizeof, FILE *fp)
+{
+	const char *bitfield_format = conf.hex_fmt ? "%#" PRIx64 : "%" PRIi64;
+	int printed = 0;
+	uint32_t i;
+
+	for (i = 0; i < plan->nr_ops; ++i) {
+		const struct decode_op *op = &plan->ops[i];
+		void *contents = instance + op->offset;
+		int size = decode_op__size(op, _sizeof);
+
+		if (op->name)
+			printed += fprintf(fp, "\n%.*s\t.%s = ", op->indent, tabs, op->name);
+
+		switch (op->kind) {
+		case DECODE_OP__OPEN:
+			fputc('{', fp);
+			++printed;
+			break;
+		case DECODE_OP__CLOSE:
+			printed += fprintf(fp, "\n%.*s}", op->indent, tabs);
+			break;
+		case DECODE_OP__VALUE:
+			printed += base_type__fprintf_value(contents, size, fp);
+			break;
+		case DECODE_OP__ENUM:
+			printed += base_type__fprintf_enum_value(contents, size, op->enumerations, op->enum_table, fp);
+			break;
+		case DECODE_OP__BITFIELD:
+			printed += fprintf(fp, bitfield_format,
+					   (base_type__value(contents, size) & op->mask) >> op->bitfield_offset);
+			break;
+		case DECODE_OP__STRING:
+			printed += string__fprintf_value(contents, size, fp);
+			break;
+		case DECODE_OP__ARRAY:
+			printed += array__fprintf_base_type_value(contents, size, op->entry_size, op->nr_entries, fp);
+			break;
+		default:
+			printed += instance__fprintf_hexdump_value(contents, size, fp);
+			break;
+		}
+
+		if (op->comma) {
+			fputc(',', fp);
+			++printed;
 		}
 	}
 
-	return _sizeof;
+	return printed;
 }
 
 /*
- * Classes should start close to where they are needed, then moved elsewhere, remember:
- * "Premature optimization is the root of all evil" (Knuth till unproven).
+ * --prettify_format=binary: decoded records written as length prefixed binary
+ * rows, in host endianness, so that they can be loaded into other tools
+ * without parsing the text output. Each frame is:
  *
- * So far just the '==' operator is supported, so just a struct member + a value are
- * needed, no, strings are not supported so far.
+ *   u32 length of what follows, u8 kind, u32 row id, payload
  *
- * If the class member is the 'type=' and we have a 'type_enum=' in place, then we will
- * resolve that at parse time and convert that to an uint64_t and it'll do the trick.
+ * Kind 'H', row id 0, is the first frame, with the 0x01020304 u32 to
+ * detect the endianness, followed by "pahole rows 1\0". Kind 'S' is the
+ * schema for a type, written before its first row, with the type name, a
+ * NUL terminated string, followed by the u32 number of columns and then, for
+ * each of them, its u8 kind and NUL terminated path, i.e. "header.type".
+ * Kind 'R' is a row, with the values in the same order as in the schema:
  *
- * More to come, when needed.
+ *   'i' - s64, with the same value as printed as text, bitfields extracted
+ *   's' - u32 length + chars, up to the first NUL
+ *   'a' - u32 number of entries + s64 for each of them
+ *   'b' - u32 length + bytes
  */
-struct class_member_filter {
-	struct class_member *left;
-	uint64_t	    right;
+static uint32_t prettify_binary__nr_rows_ids;
+
+static char decode_op__column_kind(const struct decode_op *op)
+{
+	switch (op->kind) {
+	case DECODE_OP__VALUE:
+	case DECODE_OP__ENUM:
+	case DECODE_OP__BITFIELD: return 'i';
+	case DECODE_OP__STRING:	  return 's';
+	case DECODE_OP__ARRAY:	  return 'a';
+	}
+
+	return 'b';
+}
+
+static int type_decode_plan__build_columns(struct type_decode_plan *plan)
+{
+	const char **path = malloc((plan->nr_ops + 1) * sizeof(char *));
+	uint32_t i, depth = 0;
+
+	plan->columns = calloc(plan->nr_ops ?: 1, sizeof(char *));
+	if (plan->columns == NULL || path == NULL)
+		goto out_enomem;
+
+	for (i = 0; i < plan->nr_ops; ++i) {
+		const struct decode_op *op = &plan->ops[i];
+
+		if (op->kind == DECODE_OP__OPEN) {
+			path[depth++] = op->name;
+			continue;
+		}
+
+		if (op->kind == DECODE_OP__CLOSE) {
+			--depth;
+			continue;
+		}
+
+		size_t len = 1;
+		uint32_t j;
+
+		path[depth] = op->name;
+
+		for (j = 0; j <= depth; ++j)
+			if (path[j])
+				len += strlen(path[j]) + 1;
+
+		char *column = malloc(len);
+
+		if (column == NULL)
+			goto out_enomem;
+
+		column[0] = '\0';
+
+		for (j = 0; j <= depth; ++j) {
+			if (path[j] == NULL)
+				continue;
+			if (column[0])
+				strcat(column, ".");
+			strcat(column, path[j]);
+		}
+
+		plan->columns[plan->nr_columns++] = column;
+	}
+
+	free(path);
+	return 0;
+
+out_enomem:
+	free(path);
+	return -ENOMEM;
+}
+
+static int prettify_binary__write_frame_header(char kind, uint32_t row_id, uint32_t len, FILE *fp)
+{
+	uint32_t length = len + sizeof(uint8_t) + sizeof(row_id);
+
+	if (fwrite(&length, sizeof(length), 1, fp) != 1 ||
+	    fputc(kind, fp) == EOF ||
+	    fwrite(&row_id, sizeof(row_id), 1, fp) != 1)
+		return -EIO;
+
+	return sizeof(length) + length - len;
+}
+
+static int type_decode_plan__fwrite_schema(struct type_decode_plan *plan, struct type *type, FILE *fp)
+{
+	const char *name = type__name(type) ?: "";
+	uint32_t i, column, len = strlen(name) + 1 + sizeof(uint32_t);
+	int printed;
+
+	if (plan->columns == NULL && type_decode_plan__build_columns(plan))
+		return -ENOMEM;
+
+	for (i = 0; i < plan->nr_columns; ++i)
+		len += 1 + strlen(plan->columns[i]) + 1;
+
+	if (prettify_binary__nr_rows_ids == 0) {
+		static const char header[] = "pahole rows 1";
+		uint32_t endianness = 0x01020304;
+
+		printed = prettify_binary__write_frame_header('H', 0, sizeof(endianness) + sizeof(header), fp);
+		if (printed < 0 ||
+		    fwrite(&endianness, sizeof(endianness), 1, fp) != 1 ||
+		    fwrite(header, sizeof(header), 1, fp) != 1)
+			return -EIO;
+	}
+
+	plan->row_id = ++prettify_binary__nr_rows_ids;
+
+	printed = prettify_binary__write_frame_header('S', plan->row_id, len, fp);
+	if (printed < 0 ||
+	    fwrite(name, strlen(name) + 1, 1, fp) != 1 ||
+	    fwrite(&plan->nr_columns, sizeof(plan->nr_columns), 1, fp) != 1)
+		return -EIO;
+
+	for (i = 0, column = 0; i < plan->nr_ops; ++i) {
+		const struct decode_op *op = &plan->ops[i];
+
+		if (op->kind == DECODE_OP__OPEN || op->kind == DECODE_OP__CLOSE)
+			continue;
+
+		const char *path = plan->columns[column++];
+
+		if (fputc(decode_op__column_kind(op), fp) == EOF ||
+		    fwrite(path, strlen(path) + 1, 1, fp) != 1)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static uint32_t decode_op__nr_entries(const struct decode_op *op, int size)
+{
+	return op->nr_entries ?: size / op->entry_size;
+}
+
+static int type_decode_plan__fwrite_row(struct type_decode_plan *plan, void *instance, int _sizeof, FILE *fp)
+{
+	uint32_t i, len = 0;
+	int printed;
+
+	for (i = 0; i < plan->nr_ops; ++i) {
+		const struct decode_op *op = &plan->ops[i];
+		void *contents = instance + op->offset;
+		int size = decode_op__size(op, _sizeof);
+
+		switch (op->kind) {
+		case DECODE_OP__OPEN:
+		case DECODE_OP__CLOSE:
+			break;
+		case DECODE_OP__VALUE:
+		case DECODE_OP__ENUM:
+		case DECODE_OP__BITFIELD:
+			len += sizeof(int64_t);
+			break;
+		case DECODE_OP__STRING:
+			len += sizeof(uint32_t) + strnlen(contents, size);
+			break;
+		case DECODE_OP__ARRAY:
+			len += sizeof(uint32_t) + decode_op__nr_entries(op, size) * sizeof(int64_t);
+			break;
+		default:
+			len += sizeof(uint32_t) + size;
+			break;
+		}
+	}
+
+	printed = prettify_binary__write_frame_header('R', plan->row_id, len, fp);
+	if (printed < 0)
+		return printed;
+
+	for (i = 0; i < plan->nr_ops; ++i) {
+		const struct decode_op *op = &plan->ops[i];
+		void *contents = instance + op->offset;
+		int size = decode_op__size(op, _sizeof);
+		uint32_t n, j;
+		int64_t value;
+
+		switch (op->kind) {
+		case DECODE_OP__OPEN:
+		case DECODE_OP__CLOSE:
+			continue;
+		case DECODE_OP__VALUE:
+		case DECODE_OP__ENUM:
+			value = base_type__value(contents, size);
+			goto write_value;
+		case DECODE_OP__BITFIELD:
+			value = (base_type__value(contents, size) & op->mask) >> op->bitfield_offset;
+write_value:
+			if (fwrite(&value, sizeof(value), 1, fp) != 1)
+				return -EIO;
+			continue;
+		case DECODE_OP__STRING:
+			n = strnlen(contents, size);
+			break;
+		case DECODE_OP__ARRAY:
+			n = decode_op__nr_entries(op, size);
+			if (fwrite(&n, sizeof(n), 1, fp) != 1)
+				return -EIO;
+			for (j = 0; j < n; ++j) {
+				value = base_type__value(contents + j * op->entry_size, op->entry_size);
+				if (fwrite(&value, sizeof(value), 1, fp) != 1)
+					return -EIO;
+			}
+			continue;
+		default:
+			n = size;
+			break;
+		}
+
+		if (fwrite(&n, sizeof(n), 1, fp) != 1 || (n && fwrite(contents, n, 1, fp) != 1))
+			return -EIO;
+	}
+
+	return printed + len;
+}
+
+static int tag__fwrite_row(struct tag *type, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+{
+	if (!tag__is_struct(type)) {
+		fprintf(stderr, "pahole: --prettify_format=binary requires a struct type\n");
+		return -EINVAL;
+	}
+
+	struct type_decode_plan *plan = type__decode_plan(tag__type(type), cu);
+
+	if (plan == NULL) {
+		fprintf(stderr, "pahole: not enough memory to decode '%s'\n", type__name(tag__type(type)));
+		return -ENOMEM;
+	}
+
+	if (plan->row_id == 0) {
+		int err = type_decode_plan__fwrite_schema(plan, tag__type(type), fp);
+
+		if (err)
+			return err;
+	}
+
+	return type_decode_plan__fwrite_row(plan, instance, _sizeof, fp);
+}
+
+/*
+ * The parallel decoders write to per chunk buffers, so write the schemas for
+ * the prototype and all the types it may be cast to before starting them.
+ */
+static int prototype__fwrite_schemas(struct tag *type, struct cu *cu, FILE *fp)
+{
+	if (!tag__is_struct(type)) {
+		fprintf(stderr, "pahole: --prettify_format=binary requires a struct type\n");
+		return -EINVAL;
+	}
+
+	struct type_decode_plan *plan = type__decode_plan(tag__type(type), cu);
+	int err = 0;
+
+	if (plan == NULL)
+		return -ENOMEM;
+
+	if (plan->row_id == 0)
+		err = type_decode_plan__fwrite_schema(plan, tag__type(type), fp);
+
+	struct type_enum_table *table = plan->type_enum_table;
+	uint32_t i;
+
+	for (i = 0; table && !err && i < table->nr_entries; ++i) {
+		struct type_enum_entry *entry = &table->entries[i];
+
+		if (entry->real_type == NULL || !tag__is_struct(entry->real_type))
+			continue;
+
+		struct type_decode_plan *real_plan = type__decode_plan(tag__type(entry->real_type), entry->cu);
+
+		if (real_plan == NULL)
+			return -ENOMEM;
+
+		if (real_plan->row_id == 0)
+			err = type_decode_plan__fwrite_schema(real_plan, tag__type(entry->real_type), fp);
+	}
+
+	return err;
+}
+
+static int tag__fprintf_value(struct tag *type, struct cu *cu, void *instance, int _sizeof, FILE *fp)
+{
+	if (tag__is_struct(type)) {
+		struct type_decode_plan *plan = type__decode_plan(tag__type(type), cu);
+
+		if (plan == NULL) {
+			fprintf(stderr, "pahole: not enough memory to decode '%s'\n", type__name(tag__type(type)));
+			return -ENOMEM;
+		}
+
+		return type_decode_plan__fprintf_value(plan, instance, _sizeof, fp);
+	}
+
+	return instance__fprintf_hexdump_value(instance, _sizeof, fp);
+}
+
+/*
+ * struct record_stream - where --prettify gets its records from
+ *
+ * Regular files are mmaped, pipes are read into a big buffer that gets
+ * refilled, reading ahead as much as the pipe has available, when a record
+ * doesn't fit in what is left in it. Either way the records are decoded in
+ * place, without copying each one to a separate buffer, and seeking is just
+ * pointer arithmetic, going back in the input only being possible when
+ * mmaped.
+ *
+ * @data - the mmaped file or the buffer
+ * @size - bytes available in @data
+ * @pos - position in @data of the next record
+ * @offset - offset in the input of @data[0], always zero when mmaped
+ * @buf_size - size of the buffer, zero when mmaped
+ */
+struct record_stream {
+	FILE	 *fp;
+	uint8_t	 *data;
+	size_t	 size;
+	size_t	 pos;
+	uint64_t offset;
+	size_t	 buf_size;
+	bool	 mmaped;
+	bool	 eof;
 };
 
-static bool type__filter_value(struct tag *tag, void *instance)
+#define RECORD_STREAM__BUF_SIZE (1024 * 1024)
+
+static struct record_stream prettify_stream;
+
+static int record_stream__init(struct record_stream *stream, FILE *fp)
 {
-	// this has to be a type, otherwise we'd not have a type->filter
-	struct type *type = tag__type(tag);
-	struct class_member_filter *filter = type->filter;
-	struct class_member *member = filter->left;
-	uint64_t value = base_type__value(instance + member->byte_offset, member->byte_size);
+	off_t start = ftello(fp);
+	struct stat st;
+
+	memset(stream, 0, sizeof(*stream));
+	stream->fp = fp;
+
+	if (start >= 0 && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0 && start <= st.st_size) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			stream->data   = map;
+			stream->size   = st.st_size;
+			stream->pos    = start;
+			stream->mmaped = true;
+			return 0;
+		}
+	}
+
+	stream->buf_size = RECORD_STREAM__BUF_SIZE;
+	stream->data = malloc(stream->buf_size);
+	if (stream->data == NULL)
+		return -ENOMEM;
+
+	stream->offset = start >= 0 ? start : 0;
+	return 0;
+}
+
+static void record_stream__exit(struct record_stream *stream)
+{
+	if (stream->mmaped)
+		munmap(stream->data, stream->size);
+	else
+		free(stream->data);
+
+	stream->data = NULL;
+}
+
+static uint64_t record_stream__offset(const struct record_stream *stream)
+{
+	return stream->offset + stream->pos;
+}
+
+static int record_stream__fill(struct record_stream *stream, size_t len)
+{
+	size_t avail = stream->size - stream->pos;
+
+	// Move what is left to the start, to have len contiguous bytes
+	if (stream->pos + len > stream->buf_size || avail == 0) {
+		memmove(stream->data, stream->data + stream->pos, avail);
+		stream->offset += stream->pos;
+		stream->size	= avail;
+		stream->pos	= 0;
+	}
+
+	if (len > stream->buf_size) {
+		size_t buf_size = stream->buf_size;
+
+		while (buf_size < len)
+			buf_size *= 2;
+
+		uint8_t *data = realloc(stream->data, buf_size);
+
+		if (data == NULL)
+			return -ENOMEM;
+
+		stream->data	 = data;
+		stream->buf_size = buf_size;
+	}
+
+	while (stream->size - stream->pos < len && !stream->eof) {
+		ssize_t n = read(fileno(stream->fp), stream->data + stream->size,
+				 stream->buf_size - stream->size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (n == 0)
+			stream->eof = true;
+
+		stream->size += n;
+	}
+
+	return stream->size - stream->pos < len ? -1 : 0;
+}
+
+/*
+ * Returns a pointer to the next len bytes in the input, valid till the next
+ * record_stream__peek() call, without consuming them.
+ */
+static void *record_stream__peek(struct record_stream *stream, size_t len)
+{
+	if (stream->size - stream->pos < len &&
+	    (stream->mmaped || record_stream__fill(stream, len) < 0))
+		return NULL;
+
+	return stream->data + stream->pos;
+}
+
+static void record_stream__advance(struct record_stream *stream, size_t len)
+{
+	stream->pos += len;
+}
+
+static int record_stream__seek(struct record_stream *stream, uint64_t offset)
+{
+	if (stream->mmaped) {
+		if (offset > stream->size)
+			return -1;
+		stream->pos = offset;
+		return 0;
+	}
+
+	if (offset < record_stream__offset(stream))
+		return -1;
+
+	uint64_t skip = offset - record_stream__offset(stream);
+
+	while (skip != 0) {
+		size_t avail = stream->size - stream->pos;
+
+		if (skip <= avail) {
+			stream->pos += skip;
+			break;
+		}
+
+		skip -= avail;
+		stream->pos = stream->size;
+
+		if (record_stream__fill(stream, 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t tag__real_sizeof(struct tag *tag, int _sizeof, void *instance)
+{
+	if (tag__is_struct(tag)) {
+		struct type *type = tag__type(tag);
+
+		if (type->sizeof_member) {
+			struct class_member *member = type->sizeof_member;
+			return base_type__value(instance + member->byte_offset, member->byte_size);
+		}
+	}
+
+	return _sizeof;
+}
+
+/*
+ * Classes should start close to where they are needed, then moved elsewhere, remember:
+ * "Premature optimization is the root of all evil" (Knuth till unproven).
+ *
+ * Record filters are expressions over the struct members, compiled once, when the
+ * prototype is resolved, into a tree of nodes with the member offsets, sizes and
+ * signedness already looked up, so that filtering records, done before any
+ * formatting, is just loading values and comparing them:
+ *
+ *   expr	:= and ( '||' and )*
+ *   and	:= unary ( '&&' unary )*
+ *   unary	:= '!' unary | comparison
+ *   comparison	:= bitand [ ( '==' | '!=' ) range ] | bitand [ op bitand ]
+ *   op		:= '==' | '!=' | '<' | '<=' | '>' | '>='
+ *   range	:= bitand '..' bitand
+ *   bitand	:= primary ( '&' primary )*
+ *   primary	:= member | number | enumerator | '(' expr ')'
+ *
+ * A member may be in a nested struct, i.e. 'header.type', an enumerator
+ * is resolved using the 'type_enum=' enumerations, possibly without their
+ * common prefix, and values are compared as 64-bit signed integers.
+ */
+enum filter_op {
+	FILTER_OP__CONST,
+	FILTER_OP__MEMBER,
+	FILTER_OP__BITAND,
+	FILTER_OP__EQ,
+	FILTER_OP__NE,
+	FILTER_OP__LT,
+	FILTER_OP__LE,
+	FILTER_OP__GT,
+	FILTER_OP__GE,
+	FILTER_OP__RANGE,
+	FILTER_OP__NOT,
+	FILTER_OP__AND,
+	FILTER_OP__OR,
+};
+
+/*
+ * struct filter_node - node in a compiled filter expression
+ *
+ * @value - FILTER_OP__CONST value
+ * @offset - FILTER_OP__MEMBER offset in the record, @size bytes wide
+ * @left, @right - operands, indexes in class_member_filter->nodes, for
+ *		   FILTER_OP__RANGE these are the low and high limits and
+ *		   @operand what is being checked.
+ */
+struct filter_node {
+	int64_t	 value;
+	uint32_t offset;
+	uint32_t left;
+	uint32_t right;
+	uint32_t operand;
+	uint8_t	 op;
+	uint8_t	 size;
+	uint8_t	 bitfield_offset;
+	uint8_t	 bitfield_size;
+	bool	 is_signed;
+};
+
+struct class_member_filter {
+	struct filter_node *nodes;
+	uint32_t	   nr_nodes;
+	uint32_t	   nr_allocated;
+	uint32_t	   root;
+};
+
+static int64_t filter_node__load(const struct filter_node *node, void *instance)
+{
+	void *contents = instance + node->offset;
+	uint64_t value;
+	int bits;
+
+	switch (node->size) {
+	case 1: value = instance__load(contents, uint8_t);  break;
+	case 2: value = instance__load(contents, uint16_t); break;
+	case 4: value = instance__load(contents, uint32_t); break;
+	default: value = instance__load(contents, uint64_t); break;
+	}
+
+	bits = node->size * 8;
+
+	if (node->bitfield_size) {
+		bits = node->bitfield_size;
+		value = (value >> node->bitfield_offset) & ((1ULL << bits) - 1);
+	}
+
+	if (node->is_signed && bits < 64 && (value & (1ULL << (bits - 1))))
+		value |= ~0ULL << bits;
+
+	return value;
+}
+
+static int64_t class_member_filter__eval(const struct class_member_filter *filter, uint32_t index, void *instance)
+{
+	const struct filter_node *node = &filter->nodes[index];
+
+	switch (node->op) {
+	case FILTER_OP__CONST:	return node->value;
+	case FILTER_OP__MEMBER: return filter_node__load(node, instance);
+	case FILTER_OP__NOT:	return !class_member_filter__eval(filter, node->operand, instance);
+	case FILTER_OP__AND:	return class_member_filter__eval(filter, node->left, instance) &&
+				       class_member_filter__eval(filter, node->right, instance);
+	case FILTER_OP__OR:	return class_member_filter__eval(filter, node->left, instance) ||
+				       class_member_filter__eval(filter, node->right, instance);
+	case FILTER_OP__RANGE: {
+		int64_t value = class_member_filter__eval(filter, node->operand, instance);
+
+		return value >= class_member_filter__eval(filter, node->left, instance) &&
+		       value <= class_member_filter__eval(filter, node->right, instance);
+	}
+	}
+
+	int64_t left  = class_member_filter__eval(filter, node->left, instance),
+		right = class_member_filter__eval(filter, node->right, instance);
+
+	switch (node->op) {
+	case FILTER_OP__BITAND: return left & right;
+	case FILTER_OP__EQ:	return left == right;
+	case FILTER_OP__NE:	return left != right;
+	case FILTER_OP__LT:	return left <	right;
+	case FILTER_OP__LE:	return left <= right;
+	case FILTER_OP__GT:	return left >	right;
+	case FILTER_OP__GE:	return left >= right;
+	}
+
+	return 0;
+}
+
+static bool type__filter_value(struct tag *tag, void *instance)
+{
+	// this has to be a type, otherwise we'd not have a type->filter
+	struct type *type = tag__type(tag);
+	struct class_member_filter *filter = type->filter;
+
+	return !class_member_filter__eval(filter, filter->root, instance);
+}
+
+struct filter_parser {
+	struct class_member_filter *filter;
+	struct type		   *type;
+	struct cu		   *cu;
+	const char		   *expression;
+	const char		   *pos;
+};
+
+// Returns the index of the new node or -1 on failure
+static int64_t filter_parser__add_node(struct filter_parser *parser, enum filter_op op, uint32_t left, uint32_t right)
+{
+	struct class_member_filter *filter = parser->filter;
+
+	if (filter->nr_nodes == filter->nr_allocated) {
+		uint32_t nr_allocated = filter->nr_allocated ? filter->nr_allocated * 2 : 8;
+		struct filter_node *nodes = realloc(filter->nodes, nr_allocated * sizeof(*nodes));
+
+		if (nodes == NULL) {
+			fprintf(stderr, "pahole: not enough memory for filter '%s'\n", parser->expression);
+			return -1;
+		}
+
+		filter->nodes	     = nodes;
+		filter->nr_allocated = nr_allocated;
+	}
+
+	struct filter_node *node = &filter->nodes[filter->nr_nodes];
+
+	memset(node, 0, sizeof(*node));
+	node->op    = op;
+	node->left  = left;
+	node->right = right;
+
+	return filter->nr_nodes++;
+}
+
+static int filter_parser__error(struct filter_parser *parser, const char *msg)
+{
+	if (global_verbose)
+		fprintf(stderr, "%s at '%s' in filter '%s'\n", msg, parser->pos, parser->expression);
+	return -1;
+}
+
+static bool filter_parser__skip(struct filter_parser *parser, const char *token)
+{
+	size_t len = strlen(token);
+
+	while (isspace(*parser->pos))
+		++parser->pos;
+
+	if (strncmp(parser->pos, token, len) != 0)
+		return false;
+
+	// Don't take the first char of '&&', '==', '<=', etc as '&', '=', '<'
+	if (len == 1 && (parser->pos[1] == '=' || (token[0] == '&' && parser->pos[1] == '&')))
+		return false;
+
+	parser->pos += len;
+	return true;
+}
+
+static int64_t filter_parser__member(struct filter_parser *parser, char *name)
+{
+	struct type *type = parser->type;
+	struct class_member *member;
+	uint32_t offset = 0;
+	struct tag *member_type;
+	char *sep;
+
+	while (1) {
+		sep = strchr(name, '.');
+		if (sep)
+			*sep = '\0';
+
+		member = type__find_member_by_name(type, name);
+		if (member == NULL)
+			return -1;
+
+		offset += member->byte_offset;
+		member_type = cu__type(parser->cu, member->tag.type);
+		if (member_type && tag__is_typedef(member_type))
+			member_type = tag__follow_typedef(member_type, parser->cu);
+
+		if (sep == NULL)
+			break;
+
+		if (member_type == NULL || !(tag__is_struct(member_type) || tag__is_union(member_type)))
+			return -1;
+
+		type = tag__type(member_type);
+		name = sep + 1;
+	}
+
+	if (member_type == NULL || member->byte_size > 8 || (member->byte_size & (member->byte_size - 1)) ||
+	    !(tag__is_base_type(member_type, parser->cu) || tag__is_enumeration(member_type))) {
+		if (global_verbose)
+			fprintf(stderr, "The '%s' member in filter '%s' isn't an integer\n", name, parser->expression);
+		return -2;
+	}
+
+	int64_t index = filter_parser__add_node(parser, FILTER_OP__MEMBER, 0, 0);
+
+	if (index >= 0) {
+		struct filter_node *node = &parser->filter->nodes[index];
+
+		node->offset	      = offset;
+		node->size	      = member->byte_size;
+		node->bitfield_offset = member->bitfield_offset;
+		node->bitfield_size   = member->bitfield_size;
+		node->is_signed	      = tag__is_base_type(member_type, parser->cu) &&
+					tag__base_type(member_type)->is_signed;
+	}
+
+	return index;
+}
+
+static int64_t filter_parser__expr(struct filter_parser *parser);
+
+static int64_t filter_parser__primary(struct filter_parser *parser)
+{
+	int64_t index;
+
+	if (filter_parser__skip(parser, "(")) {
+		index = filter_parser__expr(parser);
+		if (index >= 0 && !filter_parser__skip(parser, ")"))
+			return filter_parser__error(parser, "Missing ')'");
+		return index;
+	}
+
+	const char *start = parser->pos;
+	char *end;
+	int64_t value = strtoll(start, &end, 0);
+
+	if (end > start && !isalnum(*end) && *end != '_') {
+		parser->pos = end;
+		goto out_const;
+	}
+
+	if (!isalpha(*start) && *start != '_')
+		return filter_parser__error(parser, "Expected a member, number or enumerator");
+
+	while (isalnum(*parser->pos) || *parser->pos == '_' || (parser->pos[0] == '.' && parser->pos[1] != '.'))
+		++parser->pos;
+
+	char *name = strndup(start, parser->pos - start);
+
+	if (name == NULL) {
+		fprintf(stderr, "pahole: not enough memory for filter '%s'\n", parser->expression);
+		return -1;
+	}
+
+	index = filter_parser__member(parser, name);
+	if (index != -1) {
+		free(name);
+		return index < 0 ? -1 : index;
+	}
+
+	// Not a member, try it as an enumerator
+	if (list_empty(&parser->type->type_enum)) {
+		if (global_verbose)
+			fprintf(stderr, "'%s' isn't a member of '%s' and there is no type_enum= to resolve it to a number in filter '%s'\n",
+				name, type__name(parser->type), parser->expression);
+		free(name);
+		return -1;
+	}
+
+	enumerations__calc_prefix(&parser->type->type_enum);
+
+	value = enumerations__lookup_enumerator(&parser->type->type_enum, name);
+	if (value < 0) {
+		if (global_verbose)
+			fprintf(stderr, "Couldn't resolve '%s' in filter '%s' with the specified 'type_enum'\n",
+				name, parser->expression);
+		free(name);
+		return -1;
+	}
+
+	free(name);
+out_const:
+	index = filter_parser__add_node(parser, FILTER_OP__CONST, 0, 0);
+	if (index >= 0)
+		parser->filter->nodes[index].value = value;
+	return index;
+}
+
+static int64_t filter_parser__bitand(struct filter_parser *parser)
+{
+	int64_t left = filter_parser__primary(parser);
+
+	while (left >= 0 && filter_parser__skip(parser, "&")) {
+		int64_t right = filter_parser__primary(parser);
+
+		if (right < 0)
+			return -1;
+
+		left = filter_parser__add_node(parser, FILTER_OP__BITAND, left, right);
+	}
+
+	return left;
+}
+
+static int64_t filter_parser__comparison(struct filter_parser *parser)
+{
+	static const struct {
+		const char     *token;
+		enum filter_op op;
+	} ops[] = {
+		{ "==", FILTER_OP__EQ, },
+		{ "!=", FILTER_OP__NE, },
+		{ "<=", FILTER_OP__LE, },
+		{ ">=", FILTER_OP__GE, },
+		{ "<",	FILTER_OP__LT, },
+		{ ">",	FILTER_OP__GT, },
+	};
+	const size_t nr_ops = sizeof(ops) / sizeof(ops[0]);
+	int64_t left = filter_parser__bitand(parser), right, index;
+	size_t i;
+
+	if (left < 0)
+		return -1;
+
+	for (i = 0; i < nr_ops; ++i) {
+		if (filter_parser__skip(parser, ops[i].token))
+			break;
+	}
+
+	// Just a value, true if not zero
+	if (i == nr_ops)
+		return left;
+
+	right = filter_parser__bitand(parser);
+	if (right < 0)
+		return -1;
+
+	if ((ops[i].op != FILTER_OP__EQ && ops[i].op != FILTER_OP__NE) || !filter_parser__skip(parser, ".."))
+		return filter_parser__add_node(parser, ops[i].op, left, right);
+
+	int64_t high = filter_parser__bitand(parser);
+
+	if (high < 0)
+		return -1;
+
+	index = filter_parser__add_node(parser, FILTER_OP__RANGE, right, high);
+	if (index < 0)
+		return -1;
+
+	parser->filter->nodes[index].operand = left;
+
+	if (ops[i].op == FILTER_OP__NE) {
+		right = index;
+		index = filter_parser__add_node(parser, FILTER_OP__NOT, 0, 0);
+		if (index >= 0)
+			parser->filter->nodes[index].operand = right;
+	}
+
+	return index;
+}
+
+static int64_t filter_parser__unary(struct filter_parser *parser)
+{
+	if (filter_parser__skip(parser, "!")) {
+		int64_t operand = filter_parser__unary(parser), index;
+
+		if (operand < 0)
+			return -1;
+
+		index = filter_parser__add_node(parser, FILTER_OP__NOT, 0, 0);
+		if (index >= 0)
+			parser->filter->nodes[index].operand = operand;
+		return index;
+	}
+
+	return filter_parser__comparison(parser);
+}
+
+static int64_t filter_parser__and(struct filter_parser *parser)
+{
+	int64_t left = filter_parser__unary(parser);
+
+	while (left >= 0 && filter_parser__skip(parser, "&&")) {
+		int64_t right = filter_parser__unary(parser);
+
+		if (right < 0)
+			return -1;
+
+		left = filter_parser__add_node(parser, FILTER_OP__AND, left, right);
+	}
+
+	return left;
+}
+
+static int64_t filter_parser__expr(struct filter_parser *parser)
+{
+	int64_t left = filter_parser__and(parser);
+
+	while (left >= 0 && filter_parser__skip(parser, "||")) {
+		int64_t right = filter_parser__and(parser);
+
+		if (right < 0)
+			return -1;
+
+		left = filter_parser__add_node(parser, FILTER_OP__OR, left, right);
+	}
+
+	return left;
+}
+
+static void class_member_filter__delete(struct class_member_filter *filter)
+{
+	if (filter) {
+		free(filter->nodes);
+		free(filter);
+	}
+}
+
+static struct class_member_filter *class_member_filter__new(struct type *type, struct cu *cu, const char *sfilter)
+{
+	struct class_member_filter *filter = zalloc(sizeof(*filter));
+	struct filter_parser parser = {
+		.filter	    = filter,
+		.type	    = type,
+		.cu	    = cu,
+		.expression = sfilter,
+		.pos	    = sfilter,
+	};
+
+	if (filter == NULL)
+		return NULL;
+
+	int64_t root = filter_parser__expr(&parser);
+
+	if (root >= 0) {
+		while (isspace(*parser.pos))
+			++parser.pos;
+
+		if (*parser.pos == '\0') {
+			filter->root = root;
+			return filter;
+		}
+
+		filter_parser__error(&parser, "Unexpected trailing characters");
+	}
+
+	class_member_filter__delete(filter);
+	return NULL;
+}
+
+static struct tag *tag__real_type(struct tag *tag, struct cu **cup, void *instance)
+{
+	if (tag__is_struct(tag)) {
+		struct type *type = tag__type(tag);
+
+		if (!list_empty(&type->type_enum) && type->type_member) {
+			struct class_member *member = type->type_member;
+			uint64_t value = base_type__value(instance + member->byte_offset, member->byte_size);
+
+			if (type->decode_plan && type->decode_plan->type_enum_table) {
+				struct type_enum_entry *entry = type_enum_table__entry(type->decode_plan->type_enum_table, value);
+
+				if (!entry || !entry->real_type)
+					return tag;
+
+				*cup = entry->cu;
+				return entry->real_type;
+			}
+
+			struct enumerator *enumerator = enumerations__lookup_entry_from_value(&type->type_enum, value);
+
+			if (!enumerator)
+				return tag;
+
+			return enumerator__real_type(enumerator, cup);
+		}
+	}
+
+	return tag;
+}
+
+struct type_instance {
+	struct type *type;
+	struct cu   *cu;
+	bool	    read_already;
+	char	    instance[0];
+};
+
+static struct type_instance *type_instance__new(struct type *type, struct cu *cu)
+{
+	if (type == NULL)
+		return NULL;
+
+	struct type_instance *instance = malloc(sizeof(*instance) + type->size);
+
+	if (instance) {
+		instance->type = type;
+		instance->cu   = cu;
+		instance->read_already = false;
+	}
+
+	return instance;
+}
+
+static void type_instance__delete(struct type_instance *instance)
+{
+	if (!instance)
+		return;
+	instance->type = NULL;
+	free(instance);
+}
+
+static int64_t type_instance__int_value(struct type_instance *instance, const char *member_name_orig)
+{
+	struct cu *cu = instance->cu;
+	struct class_member *member = type__find_member_by_name(instance->type, member_name_orig);
+	int byte_offset = 0;
+
+	if (!member) {
+		char *sep = strchr(member_name_orig, '.');
+
+		if (!sep)
+			return -1;
+
+		char *member_name_alloc = strdup(member_name_orig);
+
+		if (!member_name_alloc)
+			return -1;
+
+		char *member_name = member_name_alloc;
+		struct type *type = instance->type;
+
+		sep = member_name_alloc + (sep - member_name_orig);
+		*sep = 0;
+
+		while (1) {
+			member = type__find_member_by_name(type, member_name);
+			if (!member) {
+out_free_member_name:
+				free(member_name_alloc);
+				return -1;
+			}
+			byte_offset += member->byte_offset;
+			type = tag__type(cu__type(cu, member->tag.type));
+			if (type == NULL)
+				goto out_free_member_name;
+			member_name = sep + 1;
+			sep = strchr(member_name, '.');
+			if (!sep)
+				break;
+
+		}
+
+		member = type__find_member_by_name(type, member_name);
+		free(member_name_alloc);
+		if (member == NULL)
+			return -1;
+	}
+
+	byte_offset += member->byte_offset;
+
+	struct tag *member_type = cu__type(cu, member->tag.type);
+
+	if (!tag__is_base_type(member_type, cu))
+		return -1;
+
+	return base_type__value(&instance->instance[byte_offset], member->byte_size);
+}
+
+static int64_t type__instance_read_once(struct type_instance *instance, struct record_stream *input)
+{
+ 	if (!instance || instance->read_already)
+		return 0;
+
+ 	instance->read_already = true;
+
+	void *contents = record_stream__peek(input, instance->type->size);
+
+	if (contents == NULL)
+		return -1;
+
+	memcpy(instance->instance, contents, instance->type->size);
+	record_stream__advance(input, instance->type->size);
+
+	return instance->type->size;
+}
+
+/*
+ * struct prototype - split arguments to a type
+ *
+ * @name - type name
+ * @type - name of the member containing a type id
+ * @type_enum - translate @type into a enum entry/string
+ * @type_enum_resolved - if this was already resolved, i.e. if the enums were find in some CU
+ * @size - the member with the size for variable sized records
+ * @filter - filter expression using record contents and values or enum entries
+ * @range - from where to get seek_bytes and size_bytes where to pretty print this specific class
+ */
+struct prototype {
+	struct list_head node;
+	struct tag	 *class;
+	struct cu	 *cu;
+	const char *type,
+		   *type_enum,
+		   *size,
+		   *range;
+	char	   *filter;
+	uint16_t   nr_args;
+	bool	   type_enum_resolved;
+	char name[0];
+
+};
+
+static int prototype__fprintf_record(struct tag *type, struct cu *cu, void *instance, int _sizeof,
+				     int real_sizeof, uint64_t record_offset, FILE *output)
+{
+	int printed = 0;
+
+	/*
+	 * pahole -C 'perf_event_header(sizeof=size,typeid=type,enum2type=perf_event_type)
+	 *
+	 * So that it gets the 'type' field as the type id, look this
+	 * up in the 'enum perf_event_type' and find the type to cast the
+	 * whole shebang, i.e.:
+	 *
+
+	 $ pahole ~/bin/perf -C perf_event_header
+	   struct perf_event_header {
+		  __u32        type;       / *  0  4 * /
+		  __u16        misc;       / *  4  2 * /
+		  __u16        size;       / *  6  2 * /
+
+		  / * size: 8, cachelines: 1, members: 3 * /
+		  / * last cacheline: 8 bytes * /
+	   };
+	 $
+
+	 enum perf_event_type {
+		PERF_RECORD_MMAP = 1,
+		PERF_RECORD_LOST = 2,
+		PERF_RECORD_COMM = 3,
+		PERF_RECORD_EXIT = 4,
+		<SNIP>
+	 }
+
+	 * So from the type field get the lookup into the enum and from the result, look
+	 * for a type with that name as-is or in lower case, which will produce, when type = 3:
+
+	 $ pahole -C perf_record_comm ~/bin/perf
+	   struct perf_record_comm {
+		   struct perf_event_header   header;   / *     0     8 * /
+		   __u32                      pid;      / *     8     4 * /
+		   __u32                      tid;      / *    12     4 * /
+		   char                       comm[16]; / *    16    16 * /
+
+		   / * size: 32, cachelines: 1, members: 4 * /
+		   / * last cacheline: 32 bytes * /
+	   };
+	   $
+	 */
+
+	struct cu *real_type_cu = cu;
+	struct tag *real_type = tag__real_type(type, &real_type_cu, instance);
+
+	if (real_type == NULL)
+		real_type = type;
+
+	if (prettify_format == PRETTIFY_FORMAT__BINARY)
+		return tag__fwrite_row(real_type, real_type_cu, instance, real_sizeof, output);
+
+	if (global_verbose) {
+		printed += fprintf(output, "// type=%s, offset=%#" PRIx64 ", sizeof=%d", type__name(tag__type(type)), record_offset, _sizeof);
+		if (real_sizeof != _sizeof)
+			printed += fprintf(output, ", real_sizeof=%d\n", real_sizeof);
+		else
+			printed += fprintf(output, "\n");
+	}
+
+	int ret = tag__fprintf_value(real_type, real_type_cu, instance, real_sizeof, output);
+
+	if (ret < 0)
+		return ret;
+
+	return printed + ret + fprintf(output, ",\n");
+}
+
+/*
+ * --prettify_stats: instead of pretty printing the records, count them and
+ * their bytes per real type, i.e. after the type= + type_enum= dispatching,
+ * with optional histograms of the values of members, or of any expression
+ * that can be used in a filter=, compiled for each of the real types.
+ */
+struct prettify_stats_value {
+	uint64_t value;
+	uint64_t count;
+};
+
+struct prettify_stats_histogram {
+	struct class_member_filter *expr; // NULL if not valid for this type
+	void			   *values; // tsearch() tree of prettify_stats_value
+};
+
+struct prettify_stats_type {
+	struct list_head		node;
+	struct tag			*type;
+	struct cu			*cu;
+	uint64_t			nr_records;
+	uint64_t			nr_bytes;
+	struct prettify_stats_histogram histograms[0];
+};
+
+struct prettify_stats {
+	struct list_head types;
+	char		 *exprs_alloc;
+	char		 **exprs;
+	int		 nr_exprs;
+};
+
+static int prettify_stats__init(struct prettify_stats *stats)
+{
+	char *expr, *saveptr;
+
+	memset(stats, 0, sizeof(*stats));
+	INIT_LIST_HEAD(&stats->types);
+
+	if (prettify_stats_exprs == NULL)
+		return 0;
+
+	stats->exprs_alloc = strdup(prettify_stats_exprs);
+	if (stats->exprs_alloc == NULL)
+		return -ENOMEM;
+
+	for (expr = strtok_r(stats->exprs_alloc, ",", &saveptr); expr; expr = strtok_r(NULL, ",", &saveptr)) {
+		char **exprs = realloc(stats->exprs, (stats->nr_exprs + 1) * sizeof(char *));
+
+		if (exprs == NULL)
+			return -ENOMEM;
+
+		stats->exprs = exprs;
+		stats->exprs[stats->nr_exprs++] = expr;
+	}
+
+	return 0;
+}
+
+static struct prettify_stats_type *prettify_stats__find_type(struct prettify_stats *stats, struct tag *type, struct cu *cu)
+{
+	struct prettify_stats_type *stype;
+	int i;
+
+	list_for_each_entry(stype, &stats->types, node) {
+		if (stype->type == type) {
+			// Keep the most used ones at the front
+			list_move(&stype->node, &stats->types);
+			return stype;
+		}
+	}
+
+	stype = zalloc(sizeof(*stype) + stats->nr_exprs * sizeof(stype->histograms[0]));
+	if (stype == NULL)
+		return NULL;
+
+	stype->type = type;
+	stype->cu   = cu;
+
+	for (i = 0; tag__is_struct(type) && i < stats->nr_exprs; ++i)
+		stype->histograms[i].expr = class_member_filter__new(tag__type(type), cu, stats->exprs[i]);
+
+	list_add(&stype->node, &stats->types);
+	return stype;
+}
+
+static int prettify_stats_value__cmp(const void *a, const void *b)
+{
+	const struct prettify_stats_value *va = a, *vb = b;
+
+	return va->value < vb->value ? -1 : va->value > vb->value ? 1 : 0;
+}
+
+static int prettify_stats__add(struct prettify_stats *stats, struct tag *type, struct cu *cu,
+			       void *instance, int real_sizeof)
+{
+	struct cu *real_type_cu = cu;
+	struct tag *real_type = tag__real_type(type, &real_type_cu, instance);
+
+	if (real_type == NULL)
+		real_type = type;
+
+	struct prettify_stats_type *stype = prettify_stats__find_type(stats, real_type, real_type_cu);
+	int i;
+
+	if (stype == NULL)
+		return -ENOMEM;
+
+	++stype->nr_records;
+	stype->nr_bytes += real_sizeof;
+
+	for (i = 0; i < stats->nr_exprs; ++i) {
+		struct prettify_stats_histogram *histogram = &stype->histograms[i];
+		struct prettify_stats_value key, *value, **node;
+
+		if (histogram->expr == NULL)
+			continue;
+
+		key.value = class_member_filter__eval(histogram->expr, histogram->expr->root, instance);
+
+		node = tfind(&key, &histogram->values, prettify_stats_value__cmp);
+		if (node == NULL) {
+			value = malloc(sizeof(*value));
+			if (value == NULL)
+				return -ENOMEM;
+
+			value->value = key.value;
+			value->count = 0;
+
+			node = tsearch(value, &histogram->values, prettify_stats_value__cmp);
+			if (node == NULL) {
+				free(value);
+				return -ENOMEM;
+			}
+		}
+
+		++(*node)->count;
+	}
+
+	return 0;
+}
+
+static FILE *prettify_stats__output;
+
+static void prettify_stats_value__fprintf(const void *nodep, const VISIT which, const int depth __maybe_unused)
+{
+	const struct prettify_stats_value *value = *(const struct prettify_stats_value **)nodep;
+
+	if (which == postorder || which == leaf)
+		fprintf(prettify_stats__output, conf.hex_fmt ? "\t%#18" PRIx64 " %18" PRIu64 "\n" :
+							       "\t%18" PRIi64 " %18" PRIu64 "\n",
+			value->value, value->count);
+}
+
+static int prettify_stats_type__cmp(const void *a, const void *b)
+{
+	const struct prettify_stats_type *ta = *(const struct prettify_stats_type **)a,
+					 *tb = *(const struct prettify_stats_type **)b;
+
+	// Most records first
+	return ta->nr_records > tb->nr_records ? -1 : ta->nr_records < tb->nr_records ? 1 : 0;
+}
+
+static const char *prettify_stats_type__name(struct prettify_stats_type *stype, char *bf, size_t len)
+{
+	if (tag__is_struct(stype->type))
+		return type__name(tag__type(stype->type)) ?: "(anonymous)";
+
+	return tag__name(stype->type, stype->cu, bf, len, NULL);
+}
+
+static int prettify_stats__fprintf(struct prettify_stats *stats, FILE *fp)
+{
+	struct prettify_stats_type *stype, **types;
+	uint64_t nr_records = 0, nr_bytes = 0;
+	int nr_types = 0, i, j, printed;
+	char name[1024];
+
+	list_for_each_entry(stype, &stats->types, node)
+		++nr_types;
+
+	types = malloc((nr_types ?: 1) * sizeof(*types));
+	if (types == NULL)
+		return -ENOMEM;
+
+	i = 0;
+	list_for_each_entry(stype, &stats->types, node)
+		types[i++] = stype;
+
+	qsort(types, nr_types, sizeof(*types), prettify_stats_type__cmp);
+
+	printed = fprintf(fp, "%-40s %18s %18s\n", "type", "records", "bytes");
+
+	for (i = 0; i < nr_types; ++i) {
+		stype = types[i];
+		printed += fprintf(fp, "%-40s %18" PRIu64 " %18" PRIu64 "\n",
+				   prettify_stats_type__name(stype, name, sizeof(name)),
+				   stype->nr_records, stype->nr_bytes);
+		nr_records += stype->nr_records;
+		nr_bytes   += stype->nr_bytes;
+	}
+
+	printed += fprintf(fp, "%-40s %18" PRIu64 " %18" PRIu64 "\n", "total", nr_records, nr_bytes);
+
+	prettify_stats__output = fp;
+
+	for (i = 0; i < nr_types; ++i) {
+		stype = types[i];
+
+		for (j = 0; j < stats->nr_exprs; ++j) {
+			if (stype->histograms[j].values == NULL)
+				continue;
+
+			printed += fprintf(fp, "\n%s: %s\n\t%18s %18s\n",
+					   prettify_stats_type__name(stype, name, sizeof(name)),
+					   stats->exprs[j], "value", "records");
+			twalk(stype->histograms[j].values, prettify_stats_value__fprintf);
+		}
+	}
+
+	free(types);
+	return printed;
+}
+
+static void prettify_stats__exit(struct prettify_stats *stats)
+{
+	struct prettify_stats_type *stype, *n;
+	int i;
+
+	list_for_each_entry_safe(stype, n, &stats->types, node) {
+		for (i = 0; i < stats->nr_exprs; ++i) {
+			tdestroy(stype->histograms[i].values, free);
+			class_member_filter__delete(stype->histograms[i].expr);
+		}
+		list_del(&stype->node);
+		free(stype);
+	}
+
+	free(stats->exprs);
+	free(stats->exprs_alloc);
+}
+
+/*
+ * Records of a fixed size in a mmaped file can be decoded in parallel, in
+ * chunks, each into its own buffer, written out in order. As filtered out
+ * records are only known after decoding, --skip and --count are applied when
+ * writing out the chunks, using where each record ends in its chunk buffer.
+ */
+#define PRETTIFY_PARALLEL__CHUNK_BYTES (1024 * 1024)
+
+struct prettify_record_end {
+	size_t	 end;	 // in the chunk buffer
+	uint32_t index;	 // in the chunk
+};
+
+struct prettify_chunk {
+	char			   *buf;
+	size_t			   size;
+	struct prettify_record_end *records;
+	uint32_t		   nr_records;
+	int			   err;
+	bool			   done;
+};
+
+struct prettify_parallel {
+	struct tag	      *type;
+	struct cu	      *cu;
+	uint8_t		      *records;
+	uint64_t	      offset;
+	uint64_t	      nr_records;
+	uint32_t	      records_per_chunk;
+	uint32_t	      nr_chunks;
+	struct prettify_chunk *chunks;
+	uint32_t	      next_chunk;
+	uint32_t	      next_to_write;
+	uint32_t	      skip;
+	uint32_t	      count;
+	uint32_t	      nr_printed;
+	uint64_t	      consumed;	 // records up to the one that reached --count
+	uint64_t	      printed;
+	int		      _sizeof;
+	int		      err;
+	bool		      stop;
+	FILE		      *output;
+	pthread_mutex_t	      mutex;
+};
+
+static int prettify_parallel__decode_chunk(struct prettify_parallel *pp, struct prettify_chunk *chunk, uint32_t idx)
+{
+	uint64_t first = (uint64_t)idx * pp->records_per_chunk;
+	uint32_t i, nr_records = pp->records_per_chunk;
+	FILE *fp = open_memstream(&chunk->buf, &chunk->size);
+
+	if (fp == NULL)
+		return -ENOMEM;
+
+	if (first + nr_records > pp->nr_records)
+		nr_records = pp->nr_records - first;
+
+	chunk->records = malloc(nr_records * sizeof(*chunk->records));
+	if (chunk->records == NULL) {
+		fclose(fp);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_records; ++i) {
+		void *instance = pp->records + (first + i) * pp->_sizeof;
+
+		if (tag__type(pp->type)->filter && type__filter_value(pp->type, instance))
+			continue;
+
+		int ret = prototype__fprintf_record(pp->type, pp->cu, instance, pp->_sizeof, pp->_sizeof,
+						    pp->offset + (first + i) * pp->_sizeof, fp);
+		if (ret < 0) {
+			fclose(fp);
+			return ret;
+		}
+
+		chunk->records[chunk->nr_records].end	= ftello(fp);
+		chunk->records[chunk->nr_records].index = i;
+		++chunk->nr_records;
+	}
 
-	// Only operator supported so far is '=='
-	return value != filter->right;
+	return fclose(fp) ? -errno : 0;
 }
 
-static struct tag *tag__real_type(struct tag *tag, struct cu **cup, void *instance)
+// Called with pp->mutex held
+static void prettify_parallel__write(struct prettify_parallel *pp)
 {
-	if (tag__is_struct(tag)) {
-		struct type *type = tag__type(tag);
-
-		if (!list_empty(&type->type_enum) && type->type_member) {
-			struct class_member *member = type->type_member;
-			uint64_t value = base_type__value(instance + member->byte_offset, member->byte_size);
-			struct enumerator *enumerator = enumerations__lookup_entry_from_value(&type->type_enum, value);
-			char name[1024];
+	while (pp->next_to_write < pp->nr_chunks && pp->chunks[pp->next_to_write].done) {
+		struct prettify_chunk *chunk = &pp->chunks[pp->next_to_write];
+		uint32_t first = 0, last = chunk->nr_records;
 
-			if (!enumerator)
-				return tag;
+		if (chunk->err && !pp->stop) {
+			pp->err	 = chunk->err;
+			pp->stop = true;
+		}
 
-			if (enumerator->type_enum.tag) {
-				*cup = enumerator->type_enum.cu;
-				return enumerator->type_enum.tag;
-			}
+		if (!pp->stop) {
+			first = pp->skip < last ? pp->skip : last;
+			pp->skip -= first;
 
-			snprintf(name, sizeof(name), "%s", enumerator__name(enumerator));
-			strlwr(name);
+			if (pp->count && last - first > pp->count - pp->nr_printed)
+				last = first + pp->count - pp->nr_printed;
 
-			struct tag *real_type = cu__find_type_by_name(*cup, name, false, NULL);
+			if (last > first) {
+				size_t start = first ? chunk->records[first - 1].end : 0,
+				       end   = chunk->records[last - 1].end;
 
-			if (!real_type)
-				return NULL;
+				fwrite(chunk->buf + start, end - start, 1, pp->output);
+				pp->printed    += end - start;
+				pp->nr_printed += last - first;
+			}
 
-			if (tag__is_struct(real_type)) {
-				enumerator->type_enum.tag = real_type;
-				enumerator->type_enum.cu  = *cup;
-				return real_type;
+			if (pp->count && pp->nr_printed == pp->count) {
+				pp->consumed = (uint64_t)pp->next_to_write * pp->records_per_chunk +
+					       chunk->records[last - 1].index + 1;
+				pp->stop = true;
 			}
 		}
-	}
 
-	return tag;
+		zfree(&chunk->buf);
+		zfree(&chunk->records);
+		++pp->next_to_write;
+	}
 }
 
-struct type_instance {
-	struct type *type;
-	struct cu   *cu;
-	bool	    read_already;
-	char	    instance[0];
-};
-
-static struct type_instance *type_instance__new(struct type *type, struct cu *cu)
+static void *prettify_parallel__worker(void *arg)
 {
-	if (type == NULL)
-		return NULL;
+	struct prettify_parallel *pp = arg;
 
-	struct type_instance *instance = malloc(sizeof(*instance) + type->size);
+	pthread_mutex_lock(&pp->mutex);
 
-	if (instance) {
-		instance->type = type;
-		instance->cu   = cu;
-		instance->read_already = false;
-	}
+	while (!pp->stop && pp->next_chunk < pp->nr_chunks) {
+		uint32_t idx = pp->next_chunk++;
+		struct prettify_chunk *chunk = &pp->chunks[idx];
 
-	return instance;
-}
+		pthread_mutex_unlock(&pp->mutex);
+		int err = prettify_parallel__decode_chunk(pp, chunk, idx);
+		pthread_mutex_lock(&pp->mutex);
 
-static void type_instance__delete(struct type_instance *instance)
-{
-	if (!instance)
-		return;
-	instance->type = NULL;
-	free(instance);
+		chunk->err  = err;
+		chunk->done = true;
+		prettify_parallel__write(pp);
+	}
+
+	pthread_mutex_unlock(&pp->mutex);
+	return NULL;
 }
 
-static int64_t type_instance__int_value(struct type_instance *instance, const char *member_name_orig)
+/*
+ * Parallel decoding needs all the decode plans and type_enum= dispatch
+ * tables in place, as they are lazily built and cached in the types.
+ */
+static bool prototype__can_decode_in_parallel(struct tag *type, struct cu *cu)
 {
-	struct cu *cu = instance->cu;
-	struct class_member *member = type__find_member_by_name(instance->type, member_name_orig);
-	int byte_offset = 0;
+	if (!tag__is_struct(type))
+		return true;
 
-	if (!member) {
-		char *sep = strchr(member_name_orig, '.');
+	struct type *ptype = tag__type(type);
+	struct type_decode_plan *plan = type__decode_plan(ptype, cu);
 
-		if (!sep)
-			return -1;
+	if (plan == NULL || ptype->sizeof_member)
+		return false;
 
-		char *member_name_alloc = strdup(member_name_orig);
+	if (!ptype->type_member || list_empty(&ptype->type_enum))
+		return true;
 
-		if (!member_name_alloc)
-			return -1;
+	struct type_enum_table *table = plan->type_enum_table;
+	uint32_t i;
 
-		char *member_name = member_name_alloc;
-		struct type *type = instance->type;
+	if (table == NULL)
+		return false;
 
-		sep = member_name_alloc + (sep - member_name_orig);
-		*sep = 0;
+	for (i = 0; i < table->nr_entries; ++i) {
+		struct type_enum_entry *entry = &table->entries[i];
 
-		while (1) {
-			member = type__find_member_by_name(type, member_name);
-			if (!member) {
-out_free_member_name:
-				free(member_name_alloc);
-				return -1;
-			}
-			byte_offset += member->byte_offset;
-			type = tag__type(cu__type(cu, member->tag.type));
-			if (type == NULL)
-				goto out_free_member_name;
-			member_name = sep + 1;
-			sep = strchr(member_name, '.');
-			if (!sep)
-				break;
+		if (entry->real_type && type__decode_plan(tag__type(entry->real_type), entry->cu) == NULL)
+			return false;
+	}
 
-		}
+	return true;
+}
 
-		member = type__find_member_by_name(type, member_name);
-		free(member_name_alloc);
-		if (member == NULL)
-			return -1;
+/*
+ * Returns the number of bytes printed or a negative error, with *nr_records
+ * set to how many were consumed from the input.
+ */
+static int prototype__fprintf_parallel(struct tag *type, struct cu *cu, int _sizeof, struct record_stream *input,
+				       uint64_t *nr_records, uint32_t skip, FILE *output)
+{
+	int nr_jobs = conf_load.nr_jobs;
+	struct prettify_parallel pp = {
+		.type	     = type,
+		.cu	     = cu,
+		.records     = input->data + input->pos,
+		.offset	     = record_stream__offset(input),
+		.nr_records  = *nr_records,
+		._sizeof     = _sizeof,
+		.skip	     = skip,
+		.count	     = conf.count,
+		.output	     = output,
+	};
+	pthread_t threads[nr_jobs];
+	int i;
+
+	// Without a filter --skip and --count are just about which records to decode
+	if (tag__is_struct(type) && tag__type(type)->filter == NULL) {
+		uint64_t skipped = pp.skip < pp.nr_records ? pp.skip : pp.nr_records;
+
+		pp.records    += skipped * _sizeof;
+		pp.offset     += skipped * _sizeof;
+		pp.nr_records -= skipped;
+		pp.skip	       = 0;
+
+		if (pp.count && pp.nr_records > pp.count)
+			pp.nr_records = pp.count;
+
+		*nr_records = skipped + pp.nr_records;
 	}
 
-	byte_offset += member->byte_offset;
+	pp.records_per_chunk = PRETTIFY_PARALLEL__CHUNK_BYTES / _sizeof ?: 1;
+	pp.nr_chunks = (pp.nr_records + pp.records_per_chunk - 1) / pp.records_per_chunk;
+	pp.chunks = calloc(pp.nr_chunks ?: 1, sizeof(*pp.chunks));
+	if (pp.chunks == NULL)
+		return -ENOMEM;
 
-	struct tag *member_type = cu__type(cu, member->tag.type);
+	pthread_mutex_init(&pp.mutex, NULL);
 
-	if (!tag__is_base_type(member_type, cu))
-		return -1;
+	for (i = 0; i < nr_jobs; ++i) {
+		if (pthread_create(&threads[i], NULL, prettify_parallel__worker, &pp) != 0)
+			break;
+	}
 
-	return base_type__value(&instance->instance[byte_offset], member->byte_size);
-}
+	// Couldn't create any thread? Do it all in this one then.
+	if (i == 0)
+		prettify_parallel__worker(&pp);
 
-static int64_t type__instance_read_once(struct type_instance *instance, FILE *fp)
-{
- 	if (!instance || instance->read_already)
-		return 0;
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
 
- 	instance->read_already = true;
+	pthread_mutex_destroy(&pp.mutex);
 
-	return fread(instance->instance, instance->type->size, 1, fp) != 1 ? -1 : (int64_t)instance->type->size;
-}
+	// Chunks not written out because --count was reached or an error happened
+	for (i = 0; i < (int)pp.nr_chunks; ++i) {
+		free(pp.chunks[i].buf);
+		free(pp.chunks[i].records);
+	}
+	free(pp.chunks);
 
-/*
- * struct prototype - split arguments to a type
- *
- * @name - type name
- * @type - name of the member containing a type id
- * @type_enum - translate @type into a enum entry/string
- * @type_enum_resolved - if this was already resolved, i.e. if the enums were find in some CU
- * @size - the member with the size for variable sized records
- * @filter - filter expression using record contents and values or enum entries
- * @range - from where to get seek_bytes and size_bytes where to pretty print this specific class
- */
-struct prototype {
-	struct list_head node;
-	struct tag	 *class;
-	struct cu	 *cu;
-	const char *type,
-		   *type_enum,
-		   *size,
-		   *range;
-	char	   *filter;
-	uint16_t   nr_args;
-	bool	   type_enum_resolved;
-	char name[0];
+	if (pp.consumed)
+		*nr_records = (pp.records - (input->data + input->pos)) / _sizeof + pp.consumed;
 
-};
+	if (pp.err)
+		return pp.err;
+
+	return pp.printed > INT_MAX ? INT_MAX : (int)pp.printed;
+}
 
-static int prototype__stdio_fprintf_value(struct prototype *prototype, struct type_instance *header, FILE *input, FILE *output)
+static int prototype__stdio_fprintf_value(struct prototype *prototype, struct type_instance *header, struct record_stream *input, FILE *output)
 {
 	struct tag *type = prototype->class;
 	struct cu *cu = prototype->cu;
 	int _sizeof = tag__size(type, cu), printed = 0;
-	int max_sizeof = _sizeof;
-	void *instance = malloc(_sizeof);
+	void *instance;
 	uint64_t size_bytes = ULLONG_MAX;
 	uint32_t count = 0;
 	uint32_t skip = conf.skip;
 
-	if (instance == NULL)
-		return -ENOMEM;
-
 	if (type__instance_read_once(header, input) < 0) {
 		int err = --errno;
 		fprintf(stderr, "pahole: --header (%s) type couldn't be read\n", conf.header_type);
@@ -2272,11 +5576,10 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 
 		free(member_name);
 
-		off_t total_read_bytes = ftell(input);
+		off_t total_read_bytes = record_stream__offset(input);
 
-		// Since we're reading input, we need to account for what we already read
-		// FIXME: we now have a FILE pointer that _may_ be stdin, but not necessarily
-		if (seek_bytes < total_read_bytes) {
+		// A pipe can't go back to what was already read, a mmaped file can
+		if (!input->mmaped && seek_bytes < total_read_bytes) {
 			fprintf(stderr, "pahole: can't go back in input, already read %" PRIu64 " bytes, can't go to position %#" PRIx64 "\n",
 					total_read_bytes, seek_bytes);
 			return -ENOMEM;
@@ -2287,8 +5590,6 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 				range, seek_bytes);
 		}
 
-		seek_bytes -= total_read_bytes;
-
 		if (asprintf(&member_name, "%s.%s", range, "size") == -1) {
 			fprintf(stderr, "pahole: not enough memory for range=%s\n", range);
 			return -ENOMEM;
@@ -2311,7 +5612,7 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 
 		free(member_name);
 
-		if (pipe_seek(input, seek_bytes) < 0) {
+		if (record_stream__seek(input, seek_bytes) < 0) {
 			int err = --errno;
 			fprintf(stderr, "Couldn't --seek_bytes %s (%" PRIu64 "\n", conf.seek_bytes, seek_bytes);
 			return err;
@@ -2354,12 +5655,7 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 		}
 
 
-		if (header) {
-			// Since we're reading input, we need to account for already read header:
-			seek_bytes -= ftell(input);
-		}
-
-		if (pipe_seek(input, seek_bytes) < 0) {
+		if (record_stream__seek(input, seek_bytes) < 0) {
 			int err = --errno;
 			fprintf(stderr, "Couldn't --seek_bytes %s (%" PRIu64 "\n", conf.seek_bytes, seek_bytes);
 			return err;
@@ -2394,30 +5690,58 @@ static int prototype__stdio_fprintf_value(struct prototype *prototype, struct ty
 do_read:
 {
 	uint64_t read_bytes = 0;
-	off_t record_offset = ftell(input);
+	uint64_t record_offset = record_stream__offset(input);
+	struct prettify_stats stats_storage, *stats = NULL;
+
+	// So that tag__real_type() uses its type_enum= table from the first record
+	if (tag__is_struct(type))
+		type__decode_plan(tag__type(type), cu);
+
+	if (prettify_stats) {
+		stats = &stats_storage;
+		if (prettify_stats__init(stats)) {
+			fputs("pahole: not enough memory for --prettify_stats\n", stderr);
+			printed = -ENOMEM;
+			goto out_stats;
+		}
+	} else if (conf_load.nr_jobs > 1 && input->mmaped && _sizeof > 0 &&
+		   prototype__can_decode_in_parallel(type, cu)) {
+		uint64_t nr_records = (input->size - input->pos) / _sizeof;
+
+		// Up to the record that makes it go over --size_bytes
+		if (size_bytes != ULLONG_MAX) {
+			uint64_t nr_records_size_bytes = (size_bytes + _sizeof - 1) / _sizeof ?: 1;
+
+			if (nr_records > nr_records_size_bytes)
+				nr_records = nr_records_size_bytes;
+		}
+
+		if (prettify_format == PRETTIFY_FORMAT__BINARY) {
+			printed = prototype__fwrite_schemas(type, cu, output);
+			if (printed < 0)
+				goto out;
+		}
+
+		printed = prototype__fprintf_parallel(type, cu, _sizeof, input, &nr_records, skip, output);
+		record_stream__advance(input, nr_records * _sizeof);
+		goto out;
+	}
 
-	while (fread(instance, _sizeof, 1, input) == 1) {
+	while ((instance = record_stream__peek(input, _sizeof)) != NULL) {
 		// Read it from each record/instance
 		int real_sizeof = tag__real_sizeof(type, _sizeof, instance);
 
 		if (real_sizeof > _sizeof) {
-			if (real_sizeof > max_sizeof) {
-				void *new_instance = realloc(instance, real_sizeof);
-				if (!new_instance) {
-					fprintf(stderr, "Couldn't allocate space for a record, too big: %d bytes\n", real_sizeof);
-					printed = -1;
-					goto out;
-				}
-				instance = new_instance;
-				max_sizeof = real_sizeof;
-			}
-			if (fread(instance + _sizeof, real_sizeof - _sizeof, 1, input) != 1) {
+			instance = record_stream__peek(input, real_sizeof);
+			if (instance == NULL) {
 				fprintf(stderr, "Couldn't read record: %d bytes\n", real_sizeof);
 				printed = -1;
-				goto out;
+				goto out_stats;
 			}
 		}
 
+		// instance stays valid till the next peek
+		record_stream__advance(input, real_sizeof > _sizeof ? real_sizeof : _sizeof);
 		read_bytes += real_sizeof;
 
 		if (tag__type(type)->filter && type__filter_value(type, instance))
@@ -2428,64 +5752,17 @@ do_read:
 			goto next_record;
 		}
 
-		/*
-		 * pahole -C 'perf_event_header(sizeof=size,typeid=type,enum2type=perf_event_type)
-		 *
-		 * So that it gets the 'type' field as the type id, look this
-		 * up in the 'enum perf_event_type' and find the type to cast the
-		 * whole shebang, i.e.:
-		 *
-
-		 $ pahole ~/bin/perf -C perf_event_header
-		   struct perf_event_header {
-			  __u32        type;       / *  0  4 * /
-			  __u16        misc;       / *  4  2 * /
-			  __u16        size;       / *  6  2 * /
-
-			  / * size: 8, cachelines: 1, members: 3 * /
-			  / * last cacheline: 8 bytes * /
-		   };
-		 $
-
-		 enum perf_event_type {
-			PERF_RECORD_MMAP = 1,
-			PERF_RECORD_LOST = 2,
-			PERF_RECORD_COMM = 3,
-			PERF_RECORD_EXIT = 4,
-			<SNIP>
-		 }
-
-		 * So from the type field get the lookup into the enum and from the result, look
-		 * for a type with that name as-is or in lower case, which will produce, when type = 3:
-
-		 $ pahole -C perf_record_comm ~/bin/perf
-		   struct perf_record_comm {
-			   struct perf_event_header   header;   / *     0     8 * /
-			   __u32                      pid;      / *     8     4 * /
-			   __u32                      tid;      / *    12     4 * /
-			   char                       comm[16]; / *    16    16 * /
-
-			   / * size: 32, cachelines: 1, members: 4 * /
-			   / * last cacheline: 32 bytes * /
-		   };
-		   $
-		 */
-
-		struct cu *real_type_cu = cu;
-		struct tag *real_type = tag__real_type(type, &real_type_cu, instance);
-
-		if (real_type == NULL)
-			real_type = type;
+		int ret = stats ? prettify_stats__add(stats, type, cu, instance, real_sizeof) :
+				  prototype__fprintf_record(type, cu, instance, _sizeof, real_sizeof, record_offset, output);
 
-		if (global_verbose) {
-			printed += fprintf(output, "// type=%s, offset=%#" PRIx64 ", sizeof=%d", type__name(tag__type(type)), record_offset, _sizeof);
-			if (real_sizeof != _sizeof)
-				printed += fprintf(output, ", real_sizeof=%d\n", real_sizeof);
-			else
-				printed += fprintf(output, "\n");
+		if (ret < 0) {
+			if (stats)
+				fputs("pahole: not enough memory for --prettify_stats\n", stderr);
+			printed = ret;
+			goto out_stats;
 		}
-		printed += tag__fprintf_value(real_type, real_type_cu, instance, real_sizeof, output);
-		printed += fprintf(output, ",\n");
+
+		printed += ret;
 
 		if (conf.count && ++count == conf.count)
 			break;
@@ -2493,97 +5770,19 @@ next_record:
 		if (read_bytes >= size_bytes)
 			break;
 
-		record_offset = ftell(input);
+		record_offset = record_stream__offset(input);
 	}
+
+	if (stats)
+		printed = prettify_stats__fprintf(stats, output);
+out_stats:
+	if (stats)
+		prettify_stats__exit(stats);
 }
 out:
-	free(instance);
 	return printed;
 }
 
-static int class_member_filter__parse(struct class_member_filter *filter, struct type *type, char *sfilter)
-{
-	const char *member_name = sfilter;
-	char *sep = strstr(sfilter, "==");
-
-	if (!sep) {
-		if (global_verbose)
-			fprintf(stderr, "No supported operator ('==' so far) found in filter '%s'\n", sfilter);
-		return -1;
-	}
-
-	char *value = sep + 2, *s = sep;
-
-	while (isspace(*--s))
-		if (s == sfilter) {
-			if (global_verbose)
-				fprintf(stderr, "No left operand (struct field) found in filter '%s'\n", sfilter);
-			return -1; // nothing before ==
-		}
-
-	char before = s[1];
-	s[1] = '\0';
-
-	filter->left = type__find_member_by_name(type, member_name);
-
-	if (!filter->left) {
-		if (global_verbose)
-			fprintf(stderr, "The '%s' member wasn't found in '%s'\n", member_name, type__name(type));
-		s[1] = before;
-		return -1;
-	}
-
-	s[1] = before;
-
-	while (isspace(*value))
-		if (*++value == '\0') {
-			if (global_verbose)
-				fprintf(stderr, "The '%s' member was asked without a value to filter '%s'\n", member_name, type__name(type));
-			return -1; // no value
-		}
-
-	char *endptr;
-	filter->right = strtoll(value, &endptr, 0);
-
-	if (endptr > value && (*endptr == '\0' || isspace(*endptr)))
-		return 0;
-
-	// If t he filter member is the 'type=' one:
-
-	if (list_empty(&type->type_enum) || type->type_member != filter->left) {
-		if (global_verbose)
-			fprintf(stderr, "Symbolic right operand in '%s' but no way to resolve it to a number (type= + type_enum= so far)\n", sfilter);
-		return -1;
-	}
-
-	enumerations__calc_prefix(&type->type_enum);
-
-	int64_t enumerator_value = enumerations__lookup_enumerator(&type->type_enum, value);
-
-	if (enumerator_value < 0) {
-		if (global_verbose)
-			fprintf(stderr, "Couldn't resolve right operand ('%s') in '%s' with the specified 'type=%s' and type_enum' \n",
-				value, sfilter, class_member__name(type->type_member));
-		return -1;
-	}
-
-	filter->right = enumerator_value;
-
-	return 0;
-}
-
-static struct class_member_filter *class_member_filter__new(struct type *type, char *sfilter)
-{
-	struct class_member_filter *filter = malloc(sizeof(*filter));
-
-	if (filter && class_member_filter__parse(filter, type, sfilter)) {
-		free(filter);
-		filter = NULL;
-	}
-
-	return filter;
-}
-
 static struct prototype *prototype__new(const char *expression)
 {
 	struct prototype *prototype = zalloc(sizeof(*prototype) + strlen(expression) + 1);
@@ -2602,7 +5801,8 @@ static struct prototype *prototype__new(const char *expression)
 	if (!args_open)
 		goto out;
 
-	char *args_close = strchr(args_open, ')');
+	// The last one, as filter expressions may have parens
+	char *args_close = strrchr(args_open, ')');
 
 	if (args_close == NULL)
 		goto out_no_closing_parens;
@@ -2623,6 +5823,14 @@ next_arg:
 	if (comma)
 		*comma = '\0';
 
+	// accept foo==bar, foo<bar, etc as filter=foo==bar
+	char *op = strpbrk(args, "=!<>&|(");
+
+	if (op && (*op != '=' || op[1] == '=')) {
+		value = args;
+		goto do_filter;
+	}
+
 	char *assign = strchr(args, '=');
 
 	if (assign == NULL) {
@@ -2636,12 +5844,6 @@ next_arg:
 		goto out_missing_assign;
 	}
 
-	// accept foo==bar as filter=foo==bar
-	if (assign[1] == '=') {
-		value = args;
-		goto do_filter;
-	}
-
 	*assign = 0;
 
 	value = assign + 1;
@@ -2801,10 +6003,19 @@ static struct type_instance *header;
 static enum load_steal_kind pahole_stealer(struct cu *cu,
 					   struct conf_load *conf_load)
 {
+	struct type_refs *type_refs = NULL;
 	int ret = LSK__DELETE;
 
-	if (!cu__filter(cu))
+	if (!cu__filter(cu)) {
+		// So that the CUs after it don't wait for it
+		if (classes_output__needed(conf_load)) {
+			struct classes_output *output = classes_output__new(cu);
+
+			if (output)
+				classes_output__done(output);
+		}
 		goto filter_it;
+	}
 
 	if (conf_load->ptr_table_stats) {
 		static bool first = true;
@@ -2828,7 +6039,7 @@ static enum load_steal_kind pahole_stealer(struct cu *cu,
 		 */
 		if (!btf_encoder) {
 			btf_encoder = btf_encoder__new(cu, detached_btf_filename, conf_load->base_btf, skip_encoding_btf_vars,
-						       btf_encode_force, btf_gen_floats, global_verbose);
+						       btf_encode_force, btf_gen_floats, global_verbose, conf_load->nr_jobs);
 			if (btf_encoder == NULL) {
 				ret = LSK__STOP_LOADING;
 				goto out_btf;
@@ -2866,7 +6077,21 @@ out_btf:
 		if (word_size != 0)
 			cu_fixup_word_size_iterator(cu);
 
-		print_classes(cu);
+		// The report is printed after all the CUs are loaded
+		if (reorganize) {
+			// Kept even if it fails, some of its types may be in the report already
+			if (cu__account_reorganize_candidates(cu) != 0)
+				fprintf(stderr, "pahole: insufficient memory for processing %s, skipping it...\n", cu->name);
+			ret = LSK__KEEPIT;
+			goto dump_it;
+		}
+
+		struct classes_output *output = classes_output__needed(conf_load) ? classes_output__new(cu) : NULL;
+
+		print_classes(cu, output);
+
+		if (output)
+			classes_output__done(output);
 
 		if (sort_output && formatter == class_formatter)
 			ret = LSK__KEEPIT;
@@ -2900,7 +6125,7 @@ out_btf:
 			if (conf_load->skip_missing)
 				continue;
 			else
-				return ret;
+				goto filter_it;
 		}
 
 		if (prototype->nr_args != 0 && !tag__is_struct(class)) {
@@ -2933,7 +6158,7 @@ out_btf:
 		}
 
 		if (prototype->filter) {
-			type->filter = class_member_filter__new(type, prototype->filter);
+			type->filter = class_member_filter__new(type, cu, prototype->filter);
 			if (type->filter == NULL) {
 				fprintf(stderr, "pahole: invalid filter '%s' for '%s'\n",
 					prototype->filter, prototype->name);
@@ -2969,11 +6194,16 @@ out_btf:
 		if (reorganize) {
 			if (class && tag__is_struct(class))
 				do_reorg(class, cu);
-		} else if (find_containers)
-			print_containers(cu, class_id, 0);
-		else if (find_pointers_in_structs)
-			print_structs_with_pointer_to(cu, class_id);
-		else if (class) {
+		} else if (find_containers || find_pointers_in_structs) {
+			// Built once for all the --class_name entries found in this CU
+			if (type_refs__get(&type_refs, cu) == NULL)
+				goto filter_it;
+
+			if (find_containers)
+				print_containers(cu, class_id, 0, type_refs);
+			else
+				print_structs_with_pointer_to(cu, class_id, type_refs);
+		} else if (class) {
 			/*
 			 * We don't need to print it for every compile unit
 			 * but the previous options need
@@ -2998,7 +6228,7 @@ out_btf:
 		// All set, pretty print it!
 		list_for_each_entry_safe(prototype, n, &class_names, node) {
 			list_del_init(&prototype->node);
-			if (prototype__stdio_fprintf_value(prototype, header, prettify_input, stdout) < 0)
+			if (prototype__stdio_fprintf_value(prototype, header, &prettify_stream, stdout) < 0)
 				break;
 		}
 
@@ -3016,6 +6246,7 @@ dump_it:
 	if (first_obj_only)
 		ret = LSK__STOP_LOADING;
 filter_it:
+	type_refs__delete(type_refs);
 	return ret;
 }
 
@@ -3102,33 +6333,43 @@ static int populate_class_names(void)
 	 * Commas inside parameters shouldn't be considered, as those don't
 	 * separate classes, but arguments to a particular class hack a simple
 	 * parser, but really this will end up needing lex/yacc...
+	 *
+	 * The arguments may have parens too, as in filter=(a||b)&&c, so only
+	 * a comma outside of any parens separates classes.
 	 */
-	while ((sep = strchr(s, ',')) != NULL) {
-		char *parens = strchr(s, '(');
-
-		// perf_event_header(sizeof=size),a
+	while (1) {
+		char *parens = NULL;
+		int depth = 0;
+
+		// perf_event_header(sizeof=size,filter=(type==COMM||type==EXIT)&&size>32),a
+
+		for (sep = s; *sep != '\0'; ++sep) {
+			if (*sep == '(') {
+				if (depth++ == 0)
+					parens = sep;
+			} else if (*sep == ')') {
+				if (depth > 0)
+					--depth;
+			} else if (*sep == ',' && depth == 0)
+				break;
+		}
 
-		if (parens && parens < sep) {
-			char *close_parens = strchr(parens, ')');
+		if (depth != 0) {
 			ret = -1;
-			if (!close_parens) {
-				fprintf(stderr, "Unterminated '(' in '%s'\n", class_name);
-				fprintf(stderr, "                     %*.s^\n", (int)(parens - sdup), "");
-				goto out_free;
-			}
-			if (close_parens > sep)
-				sep = close_parens + 1;
+			fprintf(stderr, "Unterminated '(' in '%s'\n", class_name);
+			fprintf(stderr, "                     %*.s^\n", (int)(parens - sdup), "");
+			goto out_free;
 		}
 
+		if (*sep == '\0')
+			break;
+
 		*sep = '\0';
 		ret = add_class_name_entry(s);
 		if (ret)
 			goto out_free;
 
-		while (isspace(*sep))
-			++sep;
-
-		if (sep == end)
+		if (sep + 1 == end)
 			goto out_free;
 
 		s = sep + 1;
@@ -3144,6 +6385,8 @@ int main(int argc, char *argv[])
 {
 	int err, remaining, rc = EXIT_FAILURE;
 
+	fprintf__setvbuf(stdout);
+
 	if (argp_parse(&pahole__argp, argc, argv, 0, &remaining, NULL)) {
 		argp_help(&pahole__argp, stderr, ARGP_HELP_SEE, argv[0]);
 		goto out;
@@ -3159,6 +6402,14 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	/*
+	 * With --packable it just selects how the packed sizes are found, it
+	 * would otherwise get pahole_stealer() to skip class__packable() and
+	 * print the whole binary --reorganize report.
+	 */
+	if (reorganize_optimal && !show_packable)
+		reorganize = 1;
+
 	if (conf_load.hashtable_bits > 31) {
 		fprintf(stderr, "Invalid --hashbits value (%d) should be less than 32\n", conf_load.hashtable_bits);
 		goto out;
@@ -3182,6 +6433,22 @@ int main(int argc, char *argv[])
 				goto out_dwarves_exit;
 			}
 		}
+
+		if (record_stream__init(&prettify_stream, prettify_input)) {
+			fputs("pahole: insufficient memory\n", stderr);
+			goto out_dwarves_exit;
+		}
+	}
+
+	if (instances_filename && instance_counts__load(&instance_counts, instances_filename))
+		goto out_dwarves_exit;
+
+	if (reorganize_profile_filename) {
+		if (reorganize_profile__load(&reorganize_profile, reorganize_profile_filename))
+			goto out_dwarves_exit;
+		// Reorganize all the structs in the profile
+		if (class_name == NULL && reorganize_profile.nr_entries != 0)
+			class_name = reorganize_profile.class_names;
 	}
 
 	if (base_btf_file) {
@@ -3250,6 +6517,17 @@ try_sole_arg_as_class_names:
 		goto out_cus_delete;
 	}
 
+	classes_outputs__flush();
+
+	if (reorganize && class_name == NULL) {
+		err = print_reorganize_report();
+		if (err != 0) {
+			fprintf(stderr, "pahole: couldn't produce the --reorganize report: %s\n", strerror(-err));
+			goto out_cus_delete;
+		}
+		goto out_ok;
+	}
+
 	if (sort_output && formatter == class_formatter) {
 		print_ordered_classes();
 		goto out_ok;
@@ -3308,10 +6586,14 @@ out_cus_delete:
 #ifdef DEBUG_CHECK_LEAKS
 	cus__delete(cus);
 	structures__delete();
+	type_decode_plans__delete();
 	btf__free(conf_load.base_btf);
 	conf_load.base_btf = NULL;
 #endif
 out_dwarves_exit:
+	record_stream__exit(&prettify_stream);
+	reorganize_profile__exit(&reorganize_profile);
+	instance_counts__exit(&instance_counts);
 	if (prettify_input && prettify_input != stdin) {
 		fclose(prettify_input);
 		prettify_input = NULL;
@@ -131,6 +131,8 @@ int main(int argc, char *argv[])
 	int remaining, rc = EXIT_FAILURE, err;
 	struct cus *cus = cus__new();
 
+	fprintf__setvbuf(stdout);
+
 	if (dwarves__init() || cus == NULL) {
 		fputs("pwdtags: insufficient memory\n", stderr);
 		goto out;
@@ -152,7 +154,7 @@ int main(int argc, char *argv[])
 
 	cus__fprintf_load_files_err(cus, "pdwtags", argv + remaining, err, stderr);
 out:
-	cus__delete(cus);
+	cus__delete_at_exit(cus);
 	dwarves__exit();
 	return rc;
 }
@@ -7,6 +7,9 @@
 */
 
 #include <argp.h>
+#include <ctype.h>
+#include <elfutils/version.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +23,7 @@
 #include "dwarves_emit.h"
 #include "dutil.h"
 #include "elf_symtab.h"
+#include "hash.h"
 
 static int verbose;
 static int show_inline_expansions;
@@ -33,6 +37,8 @@ static bool expand_types;
 static bool compilable_output;
 static struct type_emissions emissions;
 static uint64_t addr;
+static const char *addrs_from;
+static bool addrs_sorted;
 static char *class_name;
 static char *function_name;
 
@@ -44,6 +50,7 @@ static struct conf_load conf_load = {
 
 struct fn_stats {
 	struct list_head node;
+	struct hlist_node hash_node;
 	struct tag	 *tag;
 	const struct cu	 *cu;
 	uint32_t	 nr_expansions;
@@ -75,11 +82,36 @@ static void fn_stats__delete(struct fn_stats *stats)
 
 static LIST_HEAD(fn_stats__list);
 
+/*
+ * Also hashed by name, as looking them up in fn_stats__list for each function
+ * in each CU was quadratic, with the most recently added ones first in each
+ * bucket, just like in fn_stats__list, for the static functions with the same
+ * name.
+ */
+static struct hlist_head *fn_stats__hash;
+static uint32_t fn_stats__hash_bits;
+
+static int fn_stats__init_hash(uint32_t nr_functions)
+{
+	fn_stats__hash_bits = 8;
+	while ((1U << fn_stats__hash_bits) < nr_functions && fn_stats__hash_bits < 24)
+		++fn_stats__hash_bits;
+
+	fn_stats__hash = calloc(1U << fn_stats__hash_bits, sizeof(*fn_stats__hash));
+	return fn_stats__hash ? 0 : -ENOMEM;
+}
+
+static struct hlist_head *fn_stats__bucket(const char *name)
+{
+	return &fn_stats__hash[hash_str(name, fn_stats__hash_bits)];
+}
+
 static struct fn_stats *fn_stats__find(const char *name)
 {
+	struct hlist_node *node;
 	struct fn_stats *pos;
 
-	list_for_each_entry(pos, &fn_stats__list, node)
+	hlist_for_each_entry(pos, node, fn_stats__bucket(name), hash_node)
 		if (strcmp(function__name(tag__function(pos->tag)), name) == 0)
 			return pos;
 	return NULL;
@@ -93,13 +125,17 @@ static void fn_stats__delete_list(void)
 		list_del_init(&pos->node);
 		fn_stats__delete(pos);
 	}
+
+	zfree(&fn_stats__hash);
 }
 
 static void fn_stats__add(struct tag *tag, const struct cu *cu)
 {
 	struct fn_stats *fns = fn_stats__new(tag, cu);
-	if (fns != NULL)
+	if (fns != NULL) {
 		list_add(&fns->node, &fn_stats__list);
+		hlist_add_head(&fns->hash_node, fn_stats__bucket(function__name(tag__function(tag))));
+	}
 }
 
 static void fn_stats_inline_exps_fmtr(const struct fn_stats *stats)
@@ -275,10 +311,48 @@ static bool function__filter(struct function *function, struct cu *cu)
 	return false;
 }
 
-static int cu_unique_iterator(struct cu *cu, void *cookie __maybe_unused)
+static int cu_collect_iterator(struct cu *cu, void *cookie)
 {
-	cu__account_inline_expansions(cu);
+	struct cu ***pos = cookie;
 
+	*(*pos)++ = cu;
+	return 0;
+}
+
+static int cu__seq_cmp(const void *a, const void *b)
+{
+	const struct cu *cua = *(const struct cu **)a, *cub = *(const struct cu **)b;
+
+	return cua->seq < cub->seq ? -1 : cua->seq > cub->seq;
+}
+
+/*
+ * With -j the CUs are added to cus in the order they finish loading, so walk
+ * them in the order they are in the file, for the output not to depend on it.
+ */
+static int cus__for_each_cu_in_file_order(struct cus *cus,
+					  int (*iterator)(struct cu *cu, void *cookie),
+					  void *cookie)
+{
+	uint32_t i, nr_cus = cus__nr_entries(cus);
+	struct cu **cus_by_seq = malloc((nr_cus ?: 1) * sizeof(*cus_by_seq)), **pos = cus_by_seq;
+	int err = 0;
+
+	if (cus_by_seq == NULL)
+		return -ENOMEM;
+
+	cus__for_each_cu(cus, cu_collect_iterator, &pos, NULL);
+	qsort(cus_by_seq, nr_cus, sizeof(*cus_by_seq), cu__seq_cmp);
+
+	for (i = 0; i < nr_cus && err == 0; ++i)
+		err = iterator(cus_by_seq[i], cookie);
+
+	free(cus_by_seq);
+	return err;
+}
+
+static int cu_unique_iterator(struct cu *cu, void *cookie __maybe_unused)
+{
 	struct function *pos;
 	uint32_t id;
 
@@ -288,6 +362,488 @@ static int cu_unique_iterator(struct cu *cu, void *cookie __maybe_unused)
 	return 0;
 }
 
+static int cu_account_inline_expansions_iterator(struct cu *cu, void *cookie __maybe_unused,
+						 FILE *fp __maybe_unused)
+{
+	cu__account_inline_expansions(cu);
+	return 0;
+}
+
+static int cu_count_functions_iterator(struct cu *cu, void *cookie)
+{
+	uint32_t *nr_functions = cookie;
+
+	*nr_functions += cu->functions_table.nr_entries;
+	return 0;
+}
+
+/*
+ * The inline expansions are accounted per CU, in parallel with -j, but the
+ * functions are then added to fn_stats__list in CU order, as which ones get
+ * added, for the static functions with the same name, and the messages from
+ * fn_stats__chkdupdef() depend on that order.
+ */
+static int cus__unique_functions(struct cus *cus)
+{
+	uint32_t nr_functions = 0;
+	int err;
+
+	cus__for_each_cu(cus, cu_count_functions_iterator, &nr_functions, NULL);
+
+	err = fn_stats__init_hash(nr_functions) ?:
+	      cus__for_each_cu_parallel(cus, cu_account_inline_expansions_iterator, NULL,
+					conf_load.nr_jobs, NULL, NULL, false);
+	if (err)
+		return err;
+
+	return cus__for_each_cu_in_file_order(cus, cu_unique_iterator, NULL);
+}
+
+/*
+ * The ELF symbol table of a file, for --symtab and for the addresses that are
+ * not in any function described in the debug info, e.g. assembly code.
+ */
+struct symtab_file {
+	int		  fd;
+	Elf		  *elf;
+	struct elf_symtab *symtab;
+};
+
+static int symtab_file__open(struct symtab_file *file, const char *filename, const char *name)
+{
+	file->elf    = NULL;
+	file->symtab = NULL;
+	file->fd     = open(filename, O_RDONLY);
+	if (file->fd < 0)
+		return -errno;
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		goto out_close;
+
+	file->elf = elf_begin(file->fd, ELF_C_READ_MMAP, NULL);
+	if (file->elf == NULL)
+		goto out_close;
+
+	GElf_Ehdr ehdr;
+	if (gelf_getehdr(file->elf, &ehdr) == NULL)
+		goto out_elf_end;
+
+	file->symtab = elf_symtab__new(name, file->elf, conf_load.nr_jobs);
+	if (file->symtab == NULL)
+		goto out_elf_end;
+
+	return 0;
+
+out_elf_end:
+	elf_end(file->elf);
+	file->elf = NULL;
+out_close:
+	close(file->fd);
+	file->fd = -1;
+	return -EINVAL;
+}
+
+static void symtab_file__close(struct symtab_file *file)
+{
+	elf_symtab__delete(file->symtab);
+	file->symtab = NULL;
+	elf_end(file->elf);
+	file->elf = NULL;
+	close(file->fd);
+	file->fd = -1;
+}
+
+/* The symbol tables of the files being looked at, the ones without one are skipped */
+static struct symtab_files {
+	struct symtab_file *entries;
+	int		   nr_entries;
+} symtab_files;
+
+static void symtab_files__close(struct symtab_files *files)
+{
+	int i;
+
+	for (i = 0; i < files->nr_entries; ++i)
+		symtab_file__close(&files->entries[i]);
+	zfree(&files->entries);
+	files->nr_entries = 0;
+}
+
+static int symtab_files__open(struct symtab_files *files, char *filenames[])
+{
+	int nr = 0;
+
+	while (filenames[nr] != NULL)
+		++nr;
+
+	files->nr_entries = 0;
+	files->entries = malloc((nr ?: 1) * sizeof(*files->entries));
+	if (files->entries == NULL)
+		return -ENOMEM;
+
+	for (; *filenames != NULL; ++filenames) {
+		if (symtab_file__open(&files->entries[files->nr_entries], *filenames, NULL) == 0)
+			++files->nr_entries;
+	}
+
+	return 0;
+}
+
+/* Prints the symbol containing addr, like addr_range__fprintf() does, if there is one */
+static bool symtab_files__symbolize(const struct symtab_files *files, uint64_t addr, FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < files->nr_entries; ++i) {
+		const struct elf_symtab *symtab = files->entries[i].symtab;
+		const GElf_Sym *sym = elf_symtab__find_by_addr(symtab, addr, NULL);
+
+		// e.g. STT_SECTION symbols
+		if (sym == NULL || sym->st_name == 0)
+			continue;
+
+		fprintf(fp, "%s+%#llx/%#llx\n", elf_sym__name(sym, symtab),
+			(unsigned long long)(addr - elf_sym__value(sym)),
+			(unsigned long long)elf_sym__size(sym));
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Address ranges for the batch symbolization mode, --addrs_from: the functions
+ * are kept in an array sorted by start address, with max_end[i] being the
+ * highest end address in functions[0..i], so that a lookup is a binary search
+ * followed by a short walk back over the ranges that may still contain the
+ * address. The inline expansions, that the loader flattens into the function
+ * lexblocks, are kept in one slice per function, sorted by start address and,
+ * for the same start, by decreasing end, i.e. the outer expansions first.
+ */
+struct addr_range {
+	uint64_t	start;
+	uint64_t	end;
+	struct tag	*tag;
+	struct cu	*cu;
+	uint32_t	order;
+	uint32_t	first_expansion;
+	uint32_t	nr_expansions;
+};
+
+static struct addr_index {
+	struct addr_range *functions;
+	uint64_t	  *max_end;
+	struct addr_range *expansions;
+	uint32_t	  nr_functions;
+	uint32_t	  nr_expansions;
+} addr_index;
+
+static void addr_index__add_expansion_range(struct addr_index *index, struct tag *tag, struct cu *cu,
+					    uint64_t start, uint64_t end)
+{
+	if (index->expansions != NULL) {
+		struct addr_range *range = &index->expansions[index->nr_expansions];
+
+		range->start = start;
+		range->end   = end;
+		range->tag   = tag;
+		range->cu    = cu;
+		range->order = index->nr_expansions;
+	}
+	++index->nr_expansions;
+}
+
+/*
+ * The expansions in more than one address range get one entry per range, so
+ * that the addresses in the gaps between them aren't attributed to them.
+ */
+static void addr_index__add_lexblock(struct addr_index *index,
+				     struct lexblock *block, struct cu *cu)
+{
+	struct tag *pos;
+	uint32_t i;
+
+	list_for_each_entry(pos, &block->tags, node) {
+		if (pos->tag == DW_TAG_lexical_block) {
+			addr_index__add_lexblock(index, tag__lexblock(pos), cu);
+			continue;
+		} else if (pos->tag != DW_TAG_inlined_subroutine)
+			continue;
+
+		struct inline_expansion *exp = tag__inline_expansion(pos);
+
+		if (exp->ip.addr == 0 || exp->size == 0)
+			continue;
+
+		if (exp->nr_ranges == 0) {
+			addr_index__add_expansion_range(index, pos, cu, exp->ip.addr, exp->ip.addr + exp->size);
+			continue;
+		}
+
+		for (i = 0; i < exp->nr_ranges; ++i) {
+			if (exp->ranges[i].end > exp->ranges[i].start)
+				addr_index__add_expansion_range(index, pos, cu, exp->ranges[i].start, exp->ranges[i].end);
+		}
+	}
+}
+
+/*
+ * Called twice, first with the arrays not allocated, just to count the
+ * entries, then to fill them.
+ */
+static int cu_addr_index_iterator(struct cu *cu, void *cookie)
+{
+	struct addr_index *index = cookie;
+	struct function *pos;
+	uint32_t id;
+
+	cu__for_each_function(cu, id, pos) {
+		if (pos->lexblock.ip.addr == 0 || pos->lexblock.size == 0)
+			continue;
+
+		uint32_t first_expansion = index->nr_expansions;
+
+		addr_index__add_lexblock(index, &pos->lexblock, cu);
+
+		if (index->functions != NULL) {
+			struct addr_range *range = &index->functions[index->nr_functions];
+
+			range->start = pos->lexblock.ip.addr;
+			range->end   = pos->lexblock.ip.addr + pos->lexblock.size;
+			range->tag   = function__tag(pos);
+			range->cu    = cu;
+			range->order = index->nr_functions;
+			range->first_expansion = first_expansion;
+			range->nr_expansions   = index->nr_expansions - first_expansion;
+		}
+		++index->nr_functions;
+	}
+
+	return 0;
+}
+
+static int addr_range__cmp(const void *a, const void *b)
+{
+	const struct addr_range *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	if (ra->end != rb->end)
+		return ra->end > rb->end ? -1 : 1;
+	return ra->order < rb->order ? -1 : ra->order > rb->order;
+}
+
+static void addr_index__exit(struct addr_index *index)
+{
+	zfree(&index->functions);
+	zfree(&index->max_end);
+	zfree(&index->expansions);
+	index->nr_functions = index->nr_expansions = 0;
+}
+
+static int addr_index__init(struct addr_index *index, struct cus *cus)
+{
+	uint32_t i;
+
+	index->nr_functions = index->nr_expansions = 0;
+	if (cus__for_each_cu_in_file_order(cus, cu_addr_index_iterator, index))
+		return -ENOMEM;
+
+	index->functions  = malloc((index->nr_functions ?: 1) * sizeof(*index->functions));
+	index->max_end	  = malloc((index->nr_functions ?: 1) * sizeof(*index->max_end));
+	index->expansions = malloc((index->nr_expansions ?: 1) * sizeof(*index->expansions));
+	if (index->functions == NULL || index->max_end == NULL || index->expansions == NULL) {
+		addr_index__exit(index);
+		return -ENOMEM;
+	}
+
+	index->nr_functions = index->nr_expansions = 0;
+	if (cus__for_each_cu_in_file_order(cus, cu_addr_index_iterator, index)) {
+		addr_index__exit(index);
+		return -ENOMEM;
+	}
+
+	qsort(index->functions, index->nr_functions, sizeof(*index->functions), addr_range__cmp);
+
+	for (i = 0; i < index->nr_functions; ++i) {
+		struct addr_range *range = &index->functions[i];
+
+		index->max_end[i] = range->end;
+		if (i > 0 && index->max_end[i - 1] > range->end)
+			index->max_end[i] = index->max_end[i - 1];
+
+		qsort(index->expansions + range->first_expansion, range->nr_expansions,
+		      sizeof(*index->expansions), addr_range__cmp);
+	}
+
+	return 0;
+}
+
+/*
+ * If more than one function contains addr, e.g. the same code described in
+ * more than one CU, pick the first one found in CU order, like
+ * cus__find_function_at_addr() does.
+ */
+static struct addr_range *addr_index__find_function(const struct addr_index *index, uint64_t addr)
+{
+	struct addr_range *found = NULL;
+	uint32_t lo = 0, hi = index->nr_functions;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (index->functions[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	while (lo > 0 && index->max_end[lo - 1] > addr) {
+		struct addr_range *range = &index->functions[--lo];
+
+		if (range->end > addr && (found == NULL || range->order < found->order))
+			found = range;
+	}
+
+	return found;
+}
+
+static const char *addr_range__name(const struct addr_range *range)
+{
+	struct tag *tag = range->tag;
+
+	if (tag->tag == DW_TAG_inlined_subroutine)
+		tag = cu__function(range->cu, tag->type);
+
+	const char *name = tag ? function__name(tag__function(tag)) : NULL;
+
+	return name ?: "??";
+}
+
+static void addr_range__fprintf(const struct addr_range *range, uint64_t addr, FILE *fp)
+{
+	fprintf(fp, "%s+%#llx/%#llx", addr_range__name(range),
+		(unsigned long long)(addr - range->start),
+		(unsigned long long)(range->end - range->start));
+
+	if (conf.show_decl_info && range->tag->tag == DW_TAG_inlined_subroutine) {
+		const char *file = tag__decl_file(range->tag, range->cu);
+
+		if (file != NULL)
+			fprintf(fp, " (%s:%u)", file, tag__decl_line(range->tag, range->cu));
+	}
+}
+
+/*
+ * Prints the innermost inline expansion containing addr first, then the ones
+ * it was inlined by, up to the function, like addr2line -i does.
+ */
+static void addr_index__symbolize(const struct addr_index *index, uint64_t addr, FILE *fp)
+{
+	const struct addr_range *function = addr_index__find_function(index, addr);
+
+	fprintf(fp, "%#llx: ", (unsigned long long)addr);
+
+	if (function == NULL) {
+		if (!symtab_files__symbolize(&symtab_files, addr, fp))
+			fputs("??\n", fp);
+		return;
+	}
+
+	const struct addr_range *exp = index->expansions + function->first_expansion + function->nr_expansions;
+	const char *prefix = "";
+
+	while (exp-- != index->expansions + function->first_expansion) {
+		if (exp->start > addr || exp->end <= addr)
+			continue;
+		fputs(prefix, fp);
+		addr_range__fprintf(exp, addr, fp);
+		prefix = "\n\tinlined by ";
+	}
+
+	fputs(prefix, fp);
+	addr_range__fprintf(function, addr, fp);
+	fputc('\n', fp);
+}
+
+static int addr__cmp(const void *a, const void *b)
+{
+	const uint64_t *aa = a, *ab = b;
+
+	return *aa < *ab ? -1 : *aa > *ab;
+}
+
+/*
+ * Reads one address per line, in hex, with or without the 0x prefix, as in
+ * 'perf script' output, skipping empty lines and the ones starting with '#'.
+ * The results are printed as the addresses are read or, with --addrs_sorted,
+ * after reading all of them, sorted by address.
+ */
+static int addrs__symbolize(struct cus *cus, char *filenames[], FILE *fp)
+{
+	uint64_t *addrs = NULL;
+	size_t nr_addrs = 0, allocated_addrs = 0, linesz = 0;
+	char *line = NULL;
+	int err = addr_index__init(&addr_index, cus);
+
+	if (err)
+		return err;
+
+	err = symtab_files__open(&symtab_files, filenames);
+	if (err)
+		goto out;
+
+	while (getline(&line, &linesz, fp) != -1) {
+		char *s = line, *end;
+
+		while (isspace(*s))
+			++s;
+		if (*s == '\0' || *s == '#')
+			continue;
+
+		uint64_t addr = strtoull(s, &end, 16);
+
+		if (end == s) {
+			s[strcspn(s, "\n")] = '\0';
+			fprintf(stderr, "pfunct: invalid address '%s', skipping it\n", s);
+			continue;
+		}
+
+		if (!addrs_sorted) {
+			addr_index__symbolize(&addr_index, addr, stdout);
+			continue;
+		}
+
+		if (nr_addrs == allocated_addrs) {
+			size_t nr = allocated_addrs ? allocated_addrs * 2 : 1024;
+			uint64_t *n = realloc(addrs, nr * sizeof(*addrs));
+
+			if (n == NULL) {
+				err = -ENOMEM;
+				goto out;
+			}
+			addrs = n;
+			allocated_addrs = nr;
+		}
+		addrs[nr_addrs++] = addr;
+	}
+
+	if (addrs_sorted) {
+		size_t i;
+
+		qsort(addrs, nr_addrs, sizeof(*addrs), addr__cmp);
+
+		for (i = 0; i < nr_addrs; ++i)
+			addr_index__symbolize(&addr_index, addrs[i], stdout);
+	}
+out:
+	free(addrs);
+	free(line);
+	symtab_files__close(&symtab_files);
+	addr_index__exit(&addr_index);
+	return err;
+}
+
 static int cu_class_iterator(struct cu *cu, void *cookie)
 {
 	type_id_t target_id;
@@ -410,31 +966,17 @@ static int cu_function_iterator(struct cu *cu, void *cookie)
 
 int elf_symtab__show(char *filename)
 {
-	int fd = open(filename, O_RDONLY), err = -1;
-	if (fd < 0)
-		return -1;
-
-	if (elf_version(EV_CURRENT) == EV_NONE) {
-		fprintf(stderr, "%s: cannot set libelf version.\n", __func__);
-		goto out_close;
-	}
+	struct symtab_file file;
+	int err = symtab_file__open(&file, filename, symtab_name);
 
-	Elf *elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
-	if (elf == NULL) {
-		fprintf(stderr, "%s: cannot read %s ELF file.\n",
-			__func__, filename);
-		goto out_close;
-	}
-
-	GElf_Ehdr ehdr;
-	if (gelf_getehdr(elf, &ehdr) == NULL) {
-		fprintf(stderr, "%s: cannot get elf header.\n", __func__);
-		goto out_elf_end;
+	if (err) {
+		if (err == -EINVAL)
+			fprintf(stderr, "%s: cannot read the %s symbol table of %s.\n",
+				__func__, symtab_name, filename);
+		return -1;
 	}
 
-	struct elf_symtab *symtab = elf_symtab__new(symtab_name, elf);
-	if (symtab == NULL)
-		goto out_elf_end;
+	struct elf_symtab *symtab = file.symtab;
 
 	GElf_Sym sym;
 	uint32_t index;
@@ -467,13 +1009,8 @@ int elf_symtab__show(char *filename)
 		       elf_sym__size(&sym));
 	}
 
-	elf_symtab__delete(symtab);
-	err = 0;
-out_elf_end:
-	elf_end(elf);
-out_close:
-	close(fd);
-	return err;
+	symtab_file__close(&file);
+	return 0;
 }
 
 int elf_symtabs__show(char *filenames[])
@@ -512,6 +1049,8 @@ ARGP_PROGRAM_VERSION_HOOK_DEF = dwarves_print_version;
 #define ARGP_symtab		300
 #define ARGP_no_parm_names	301
 #define ARGP_compile		302
+#define ARGP_addrs_from		303
+#define ARGP_addrs_sorted	304
 
 static const struct argp_option pfunct__options[] = {
 	{
@@ -637,6 +1176,24 @@ static const struct argp_option pfunct__options[] = {
 		.key   = ARGP_no_parm_names,
 		.doc   = "Don't show parameter names",
 	},
+	{
+		.name  = "addrs_from",
+		.key   = ARGP_addrs_from,
+		.arg   = "FILE",
+		.doc   = "show the functions and inline expansions where the addresses in FILE (- for stdin) are, one per line",
+	},
+	{
+		.name  = "addrs_sorted",
+		.key   = ARGP_addrs_sorted,
+		.doc   = "with --addrs_from, show the addresses sorted instead of in input order",
+	},
+	{
+		.name  = "jobs",
+		.key   = 'j',
+		.arg   = "NR_JOBS",
+		.flags = OPTION_ARG_OPTIONAL, // Use sysconf(_SC_NPROCESSORS_ONLN) * 1.1 by default
+		.doc   = "run N jobs in parallel [default to number of online processors + 10%]",
+	},
 	{
 		.name = NULL,
 	}
@@ -680,11 +1237,22 @@ static error_t pfunct__options_parser(int key, char *arg,
 		  conf_load.get_addr_info = true;	 break;
 	case 'T': show_variables = 1;			 break;
 	case 'N': formatter = fn_stats_name_len_fmtr;	 break;
+	case 'j':
+#if _ELFUTILS_PREREQ(0, 178)
+		  conf_load.nr_jobs = arg ? atoi(arg) :
+					    sysconf(_SC_NPROCESSORS_ONLN) * 1.1;
+#else
+		  fputs("pfunct: Multithreading requires elfutils >= 0.178. Continuing with a single thread...\n", stderr);
+#endif
+							 break;
 	case 'V': verbose = 1;
 		  conf_load.extra_dbg_info = true;
 		  conf_load.get_addr_info = true;	 break;
 	case ARGP_symtab: symtab_name = arg ?: ".symtab";  break;
 	case ARGP_no_parm_names: conf.no_parm_names = 1; break;
+	case ARGP_addrs_from: addrs_from = arg;
+		  conf_load.get_addr_info = true;	 break;
+	case ARGP_addrs_sorted: addrs_sorted = true;	 break;
 	case ARGP_compile:
 		  expand_types = true;
 		  type_emissions__init(&emissions);
@@ -711,6 +1279,7 @@ static struct argp pfunct__argp = {
 int main(int argc, char *argv[])
 {
 	int err, remaining, rc = EXIT_FAILURE;
+	FILE *addrs_fp = NULL;
 
 	if (argp_parse(&pfunct__argp, argc, argv, 0, &remaining, NULL) ||
 	    (remaining == argc && class_name == NULL && function_name == NULL)) {
@@ -721,6 +1290,15 @@ int main(int argc, char *argv[])
 	if (symtab_name != NULL)
 		return elf_symtabs__show(argv + remaining);
 
+	if (addrs_from != NULL) {
+		addrs_fp = strcmp(addrs_from, "-") ? fopen(addrs_from, "r") : stdin;
+		if (addrs_fp == NULL) {
+			fprintf(stderr, "pfunct: couldn't open %s: %s\n",
+				addrs_from, strerror(errno));
+			goto out;
+		}
+	}
+
 	if (dwarves__init()) {
 		fputs("pfunct: insufficient memory\n", stderr);
 		goto out;
@@ -740,7 +1318,7 @@ int main(int argc, char *argv[])
 try_sole_arg_as_function_name:
 	err = cus__load_files(cus, &conf_load, argv + remaining);
 	if (err != 0) {
-		if (function_name == NULL) {
+		if (function_name == NULL && addrs_from == NULL) {
                         function_name = argv[remaining];
                         if (access(function_name, R_OK) == 0) {
                                 fprintf(stderr, "pfunct: file '%s' has no %s type information.\n",
@@ -755,33 +1333,55 @@ try_sole_arg_as_function_name:
 		goto out_cus_delete;
 	}
 
+	if (addrs_fp != NULL) {
+		if (addrs__symbolize(cus, argv + remaining, addrs_fp)) {
+			fputs("pfunct: insufficient memory\n", stderr);
+			goto out_cus_delete;
+		}
+		rc = EXIT_SUCCESS;
+		goto out_cus_delete;
+	}
 
-	cus__for_each_cu(cus, cu_unique_iterator, NULL, NULL);
+	if (cus__unique_functions(cus)) {
+		fputs("pfunct: insufficient memory\n", stderr);
+		goto out_cus_delete;
+	}
 
 	if (addr) {
 		struct cu *cu;
 		struct function *f = cus__find_function_at_addr(cus, addr, &cu);
 
 		if (f == NULL) {
-			fprintf(stderr, "pfunct: No function found at %#llx!\n",
-				(unsigned long long)addr);
-			goto out_cus_delete;
-		}
-		function__show(f, cu);
+			// Not described in the debug info, e.g. assembly, try the symtab
+			bool found = symtab_files__open(&symtab_files, argv + remaining) == 0 &&
+				     symtab_files__symbolize(&symtab_files, addr, stdout);
+
+			symtab_files__close(&symtab_files);
+			if (!found) {
+				fprintf(stderr, "pfunct: No function found at %#llx!\n",
+					(unsigned long long)addr);
+				goto out_cus_delete;
+			}
+		} else
+			function__show(f, cu);
 	} else if (show_total_inline_expansion_stats)
 		print_total_inline_stats();
-	else if (function_name != NULL || expand_types)
-		cus__for_each_cu(cus, cu_function_iterator,
-				 function_name, NULL);
-	else
+	else if (function_name != NULL || expand_types) {
+		if (cus__for_each_cu_in_file_order(cus, cu_function_iterator, function_name) < 0) {
+			fputs("pfunct: insufficient memory\n", stderr);
+			goto out_cus_delete;
+		}
+	} else
 		print_fn_stats(formatter);
 
 	rc = EXIT_SUCCESS;
 out_cus_delete:
-	cus__delete(cus);
+	cus__delete_at_exit(cus);
 	fn_stats__delete_list();
 out_dwarves_exit:
 	dwarves__exit();
 out:
+	if (addrs_fp != NULL && addrs_fp != stdin)
+		fclose(addrs_fp);
 	return rc;
 }
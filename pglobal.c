@@ -333,7 +333,7 @@ int main(int argc, char *argv[])
 	tdestroy(tree, free_node);
 	rc = EXIT_SUCCESS;
 out_cus_delete:
-	cus__delete(cus);
+	cus__delete_at_exit(cus);
 out_dwarves_exit:
 	dwarves__exit();
 out: